@@ -0,0 +1,135 @@
+# bench_stage2.s
+#
+# stand-in stage 2 for the bench_boot makefile target. It prints the timestamps recorded by the timing build of the boot sector
+# to the QEMU debug console and then turns QEMU off
+# This file was written for SawconOS Bootloader Alpha 1.02
+# Compiled using GNU as
+#
+# Written: Saturday 17th October 2026
+# Last Updated: Saturday 17th October 2026
+#
+# Written by Gabriel Jickells
+
+.code16
+
+.equ DEBUG_PORT, 0xe9                   # QEMU -debugcon prints anything written to this port
+.equ EXIT_PORT, 0xf4                    # QEMU -device isa-debug-exit,iobase=0xf4 quits when this port is written to
+.equ TIMESTAMP_TABLE, 0x0500            # has to match TIMESTAMP_TABLE in boot.s
+.equ TIMESTAMP_NEXT, 0x7dfc             # address of TimestampNext in the timing build of boot.s
+.equ FIXED_PHASES, 4                    # phases before the stage 2 runs: drive setup (the INT 13h extensions check or GETPARAMS), root directory, FindEntry, and FAT
+
+start:
+    xor %ax, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov $TIMESTAMP_TABLE + 4, %di       # each phase ends at a timestamp and starts at the one before it
+    xor %bx, %bx                        # phase number
+    PrintPhases:
+        cmpw (TIMESTAMP_NEXT), %di
+        jae PrintTotal
+        inc %bx
+        # the last timestamp is taken just before the ljmp into stage 2
+        mov %di, %ax
+        add $4, %ax
+        cmpw (TIMESTAMP_NEXT), %ax
+        je PrintPhases.handoff
+        cmp $FIXED_PHASES, %bx
+        ja PrintPhases.run
+        mov %bx, %si
+        dec %si
+        shl %si
+        movw PhaseNames(%si), %si
+        call PrintString
+        jmp PrintPhases.cycles
+    PrintPhases.run:
+        mov $RunName, %si
+        call PrintString
+        movzwl %bx, %eax
+        sub $FIXED_PHASES, %eax
+        call PrintNumber
+        jmp PrintPhases.cycles
+    PrintPhases.handoff:
+        mov $HandoffName, %si
+        call PrintString
+    PrintPhases.cycles:
+        mov $Separator, %si
+        call PrintString
+        mov (%di), %eax
+        sub -4(%di), %eax
+        call PrintNumber
+        mov $CyclesName, %si
+        call PrintString
+        add $4, %di
+        jmp PrintPhases
+    PrintTotal:
+        mov $TotalName, %si
+        call PrintString
+        mov $Separator, %si
+        call PrintString
+        mov -4(%di), %eax
+        sub (TIMESTAMP_TABLE), %eax
+        call PrintNumber
+        mov $CyclesName, %si
+        call PrintString
+        # turn QEMU off
+        xor %al, %al
+        out %al, $EXIT_PORT
+        cli
+        hlt
+
+# PrintString
+# writes a NULL terminated string to the debug port
+# =ARGUMENTS=
+# - %si = string
+# =OUTPUT=
+# none
+PrintString:
+    push %ax
+    push %si
+    PrintString.loop:
+        lodsb
+        test %al, %al
+        jz PrintString.end
+        out %al, $DEBUG_PORT
+        jmp PrintString.loop
+    PrintString.end:
+    pop %si
+    pop %ax
+    ret
+
+# PrintNumber
+# writes a 32 bit number to the debug port in decimal
+# =ARGUMENTS=
+# - %eax = number
+# =OUTPUT=
+# none
+PrintNumber:
+    pushal
+    mov $10, %ecx
+    xor %si, %si                        # number of digits
+    PrintNumber.divide:
+        xor %edx, %edx
+        div %ecx
+        push %dx                        # the digits come out backwards so they are put on the stack first
+        inc %si
+        test %eax, %eax
+        jnz PrintNumber.divide
+    PrintNumber.print:
+        pop %ax
+        add $'0', %al
+        out %al, $DEBUG_PORT
+        dec %si
+        jnz PrintNumber.print
+    popal
+    ret
+
+PhaseNames: .word DriveSetupName, RootDirectoryName, FindEntryName, FATName
+DriveSetupName: .asciz "drive setup"
+RootDirectoryName: .asciz "video mode and root directory"
+FindEntryName: .asciz "FindEntry"
+FATName: .asciz "FAT"
+RunName: .asciz "stage 2 run "
+HandoffName: .asciz "handoff"
+TotalName: .asciz "total"
+Separator: .asciz ": "
+CyclesName: .asciz " cycles\n"
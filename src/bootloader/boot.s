@@ -1,11 +1,11 @@
 # boot.s
 #
 # main source file for the boot sector of the SawconOS Bootloader
-# This file was written for SawconOS Bootloader Alpha 1.01
+# This file was written for SawconOS Bootloader Alpha 1.02
 # Compiled using GNU as
 # 
 # Written: Monday 7th August 2023
-# Last Updated: Saturday 23rd September 2023
+# Last Updated: Saturday 17th October 2026
 # 
 # Written by Gabriel Jickells
 
@@ -17,14 +17,40 @@
 .equ VIDEO_TTY, 0x0e                    # mov $VIDEO_TTY, %ah ... int $VIDEO_FUNCTIONS
 .equ VIDEO_SETMODE, 0x00                # mov $VIDEO_SETMODE, %ah ... int $VIDEO_FUNCTIONS
 .equ DISK_GETPARAMS, 0x08               # mov $DISK_GETPARAMS ... int $DISK_FUNCTIONS
+.equ DISK_CHECKEXTENSIONS, 0x41         # mov $DISK_CHECKEXTENSIONS, %ah; mov $EXTENSIONS_QUERY, %bx ... int $DISK_FUNCTIONS
+.equ DISK_READEXTENDED, 0x42            # mov $DISK_READEXTENDED, %ah; %ds:%si = disk address packet ... int $DISK_FUNCTIONS
+.equ EXTENSIONS_QUERY, 0x55aa           # DISK_CHECKEXTENSIONS expects this in %bx
+.equ EXTENSIONS_PRESENT, 0xaa55         # DISK_CHECKEXTENSIONS leaves this in %bx if the BIOS has the INT 13h extensions for the drive
+.equ PACKET_SIZE, 0x10                  # size of a disk address packet for DISK_READEXTENDED in bytes
+.equ MAX_EXTENDED_SECTORS, 127          # most sectors some BIOSes can read with one DISK_READEXTENDED call
 .equ DISK_FUNCTIONS, 0x13               # int $DISK_FUNCTIONS
 .equ VIDEO_FUNCTIONS, 0x10              # int $VIDEO_FUNCTIONS
 .equ VGA_TEXT_80x25_16COLOUR, 0x02      # mov $VIDEO_SETMODE, %ah; mov $VGA_TEXT_80x25_16COLOUR, %al ... int $VIDEO_FUNCTIONS
 .equ DISK_RESET, 0x00                   # mov $DISK_RESET, %ah ... int $DISK_FUNCTIONS
 .equ FAT_ENTRY_SIZE, 32                 # measured in bytes
+.equ FAT_ENTRY_SHIFT, 5                 # log2(FAT_ENTRY_SIZE)
 .equ FIRST_CLUSTER_LOW_OFFSET, 26       # byte offset of the low first cluster value in a directory entry
 .equ CLUSTER_END, 0xff8                 # do not try to read this cluster or anything above it
 .equ STAGE2_LOCATION, 0x8e00            # load the stage 2 binary into this address
+.equ STAGE2_SEGMENT, STAGE2_LOCATION >> 4   # the stage 2 binary is loaded through %es so that it can be bigger than what is left of the first 64KiB
+.equ READ_ATTEMPTS, 3                   # floppy drives often fail the first read while the motor spins up so each read is tried this many times
+.equ TIMESTAMP_TABLE, 0x0500            # the timing build stores its timestamps here, in the free memory after the BIOS data area
+.equ DataSectionLBA, BOOT_ADDR - 2      # LBA of the data section. It is worked out at startup so it is kept just below the boot sector instead of in it
+
+# the BPB values come from the geometry profile the makefile was given (DISK_PROFILE), written out by "scim geometry". The code
+# below still reads the geometry from the BPB at runtime so it works with whatever BPB SCIM puts on the disk
+.include "geometry.inc"
+.if GEOMETRY_FAT_TYPE != 12
+.error "boot.s can only read FAT12 disks. Build it with a FAT12 geometry profile"
+.endif
+
+# TIMESTAMP
+# records the time stamp counter in the timing build (assembled with --defsym BOOT_TIMING=1). Does nothing in the normal build
+.macro TIMESTAMP
+.ifdef BOOT_TIMING
+    call Timestamp
+.endif
+.endm
 
 # FAT Header
 # BIOS Parameter Block (BPB)
@@ -32,24 +58,24 @@ DataSkip:
 jmp start
 nop
 OEM_Identifier: .ascii "SAWCONOS"       # name of the manufacturer or tool that formatted the disk
-BytesPerSector: .word 512
-SectorsPerCluster: .byte 1              # higher values make files take up more space but make the FAT able to hold more information
-ReservedSectors: .word 1                # effectively the LBA of the FAT. Refers to the number of sectors reserved for the bootloader at the start of the disk
-TotalFATs: .byte 1                      # all FATs on the disk are identical and are used for disk repair and verification
-RootDirectoryEntries: .word 128         # amount of file entries that can fit in the root directory
-TotalSectors: .word 2880                # 1.44MiB disk
-MediaDescriptor: .byte 0xF0             # used in old versions of MS DOS to refer to a 1.44MiB floppy
-SectorsPerFAT: .word 8                  # 4KiB reserved for each FAT. This equates to about 2730 clusters which doesnt use the entirety of the disk space but the remainder can be reserved for other purposes
-SectorsPerTrack: .word 18               # value should be updated to the values returned by int $0x13 at startup
-TotalHeads: .word 2                     # value should be updated to the values returned by int $0x13 at startup
+BytesPerSector: .word GEOMETRY_BYTES_PER_SECTOR
+SectorsPerCluster: .byte GEOMETRY_SECTORS_PER_CLUSTER   # higher values make files take up more space but make the FAT able to hold more information
+ReservedSectors: .word GEOMETRY_RESERVED_SECTORS        # effectively the LBA of the FAT. Refers to the number of sectors reserved for the bootloader at the start of the disk
+TotalFATs: .byte GEOMETRY_TOTAL_FATS    # all FATs on the disk are identical and are used for disk repair and verification
+RootDirectoryEntries: .word GEOMETRY_ROOT_DIRECTORY_ENTRIES # amount of file entries that can fit in the root directory
+TotalSectors: .word GEOMETRY_TOTAL_SECTORS  # 2880 on the sawcon profile, which is a 1.44MiB disk
+MediaDescriptor: .byte GEOMETRY_MEDIA_DESCRIPTOR        # used in old versions of MS DOS to refer to the type of disk. 0xF0 is a 1.44MiB floppy
+SectorsPerFAT: .word GEOMETRY_SECTORS_PER_FAT           # the sawcon profile reserves 4KiB for each FAT. This equates to about 2730 clusters which doesnt use the entirety of the disk space but the remainder can be reserved for other purposes
+SectorsPerTrack: .word GEOMETRY_SECTORS_PER_TRACK       # value should be updated to the values returned by int $0x13 at startup. Set to MAX_EXTENDED_SECTORS instead when the INT 13h extensions are used
+TotalHeads: .word GEOMETRY_TOTAL_HEADS  # value should be updated to the values returned by int $0x13 at startup
 HiddenSectors: .long 0                  # effectively the LBA of the current partition. Refers to the number of sectors before the boot sector
-LargeSectors: .long 0                   # used instead of total sectors if there are more than 65535 sectors on the disk
+LargeSectors: .long GEOMETRY_LARGE_SECTORS  # used instead of total sectors if there are more than 65535 sectors on the disk
 # Extended BIOS Parameter Block (EBPB)
-DriveNumber: .byte 0x00                 # should be replaced with the value in %dl at startup
+DriveNumber: .byte GEOMETRY_DRIVE_NUMBER    # should be replaced with the value in %dl at startup
 _reserved: .byte 0                      # used in windows NT
 Signature: .byte 0x28                   # tells the driver that this is a valid file system. Must be 0x28 or 0x29
 SerialID: .long 0x23A1005C              # Serial number of the disk
-VolumeLabel: .ascii "SAWCON  100"       # name of the disk
+VolumeLabel: VOLUME_LABEL                # name of the disk
 SystemID: .ascii "FAT12   "             # specify the file system
 
 # reset segment registers to known values and set up the stack
@@ -58,8 +84,7 @@ start:
     mov %ax, %ds
     mov %ax, %es
     mov %ax, %ss
-    mov $BOOT_ADDR, %sp                 # start the stack at the beginning of the boot sector. The stack grows downwards so nothing will be overwritten
-    mov %sp, %bp
+    mov $DataSectionLBA, %sp            # start the stack just below DataSectionLBA. The stack grows downwards so nothing will be overwritten
     ljmp $EXPECTED_CS, $main            # this far jump instruction makes sure the code segment is set to 0, which isn't standard for all BIOSes
 
 # LBA2CHS
@@ -70,9 +95,8 @@ start:
 # - %ch = Low 8 bits of Cylinder number
 # - %dh = Head number
 # - %cl = Sector number + (High 2 bits of Cylinder number << 6)
+# - %ax and %dl are destroyed
 LBA2CHS:
-    push %ax
-    push %dx
     xor %dx, %dx                        # div instruction expects %dx to be 0
     divw (SectorsPerTrack)              # all conversion operations use this division
     inc %dx                             # the remainder (which will be used for the sector number) is in %dx. Sector numbers start at 1 and LBA numbers start at 0 so the offset is taken care of here
@@ -82,181 +106,268 @@ LBA2CHS:
     shl $6, %ah                         # move the high 2 bits of the cylinder number into the upper 2 bits of the register
     mov %al, %ch                        # store the cylinder number in its expected location
     or %ah, %cl                         # store the high 2 bits of the cylinder number in their expected location
-    mov %dl, %al                        # save the head number
-    pop %dx                             # restore the drive number in %dl
-    mov %al, %dh                        # store the head numbner in its expected location
-    pop %ax
+    mov %dl, %dh                        # store the head number in its expected location
     ret
 
 # ReadSectors
-# reads some number of sectors from a drive
+# reads some number of sectors from a drive using as few BIOS calls as possible
+# each BIOS call reads as much as it can without going past the end of the track or crossing a 64KiB boundary, which the floppy DMA controller can't do
+# and which would wrap %bx. With the INT 13h extensions SectorsPerTrack is MAX_EXTENDED_SECTORS, so each call reads up to that many sectors instead
+# failed reads reset the drive and try again
+# reads from the drive in DriveNumber with the BIOS function in ReadFunction
 # =ARGUMENTS=
 # - %ax = LBA
 # - %es:%bx = output address
-# - %cl = number of sectors to read
-# - %dl = drive to read from
+# - %cx = number of sectors to read
 # =OUTPUT=
-# none
+# - %es = moved past the data that was read. %bx is left as it is
 ReadSectors:
     pusha
-    push %cx                            # save the number of sectors to read
-    call LBA2CHS                        # BIOS expects the location on disk to be in CHS format
-    pop %ax                             # put the number of sectors to read in its expected location
-    mov $DISK_READSECT, %ah
-    stc                                 # some BIOSes don't set the carry flag properly so it is done manually
-    int $DISK_FUNCTIONS
-    jc hang
+    ReadSectors.loop:
+        jcxz ReadSectors.end
+        push %cx                        # save the number of sectors left to read
+        push %ax                        # save the LBA. It stays on the stack until the read works
+        # the sectors left in the track (SectorsPerTrack - LBA % SectorsPerTrack)
+        xor %dx, %dx
+        movw (SectorsPerTrack), %di
+        div %di
+        sub %dx, %di
+        # the sectors left before the next 64KiB boundary ((0xffff - (%es * 16 + %bx) % 0x10000) / BytesPerSector + 1)
+        mov %es, %ax
+        shl $4, %ax
+        add %bx, %ax
+        not %ax
+        xor %dx, %dx
+        divw (BytesPerSector)
+        inc %ax
+        # read the smallest of the two limits and the number of sectors left
+        cmp %di, %ax
+        jae 1f
+        mov %ax, %di
+    1:  cmp %di, %cx
+        jae 2f
+        mov %cx, %di
+    2:  mov $READ_ATTEMPTS, %bp
+        ReadSectors.retry:
+            pop %ax                     # get the LBA back without taking it off the stack
+            push %ax
+            # extended reads take the location from a disk address packet at %ds:%si, which is built on the stack. CHS reads ignore it
+            # %ds is 0, so pushing it 3 times gives the upper 48 bits of the LBA
+            push %ds
+            push %ds
+            push %ds
+            push %ax                    # lower 16 bits of the LBA
+            push %es                    # output segment
+            push %bx                    # output offset
+            push %di                    # number of sectors to read
+            push $PACKET_SIZE           # size of the packet followed by a reserved 0 byte
+            mov %sp, %si
+            call LBA2CHS                # CHS reads expect the location on disk to be in CHS format. Extended reads ignore it
+            movb (DriveNumber), %dl
+            mov %di, %ax                # put the number of sectors to read in its expected location
+            movb (ReadFunction), %ah
+            stc                         # some BIOSes don't set the carry flag properly so it is done manually
+            int $DISK_FUNCTIONS
+            lea PACKET_SIZE(%si), %sp   # throw the packet away. lea leaves the carry flag alone
+            jnc ReadSectors.next
+            dec %bp
+            jz hang                     # the disk really can't be read
+            mov $DISK_RESET, %ah        # move the heads back to a known position before trying again
+            int $DISK_FUNCTIONS
+            jmp ReadSectors.retry
+        ReadSectors.next:
+            pop %ax                     # restore the LBA
+            pop %cx                     # restore the number of sectors left to read
+            add %di, %ax                # move the LBA past the sectors that were read
+            sub %di, %cx
+            # move %es past the sectors that were read (sectors * BytesPerSector / 16)
+            movw (BytesPerSector), %si
+            shr $4, %si
+            imul %di, %si
+            mov %es, %dx
+            add %si, %dx
+            mov %dx, %es
+            jmp ReadSectors.loop
+    ReadSectors.end:
     popa
     ret
 
-# Cluster2LBA
-# convert a FAT cluster number to an LBA address
-# requires the root directory to have been read
+# hang
+# stops the CPU when the boot can't carry on. It is kept between ReadSectors and main so that most of the jumps to it are short ones
+hang:
+    cli                                 # stop hardware interrupts from unhalting the cpu
+    hlt
+
+.ifdef BOOT_TIMING
+# Timestamp
+# stores the low 32 bits of the time stamp counter in the next slot of the table at TIMESTAMP_TABLE
+# TimestampNext is always at 0x7dfc so whatever runs after the boot sector can find the end of the table
 # =ARGUMENTS=
-# - %ax = Cluster
+# none
 # =OUTPUT=
-# - %ax = LBA
-Cluster2LBA:
-    sub $2, %ax                         # cluster numbers start at 2 instead of 0
-    mulb (SectorsPerCluster)
-    addw (DataSectionLBA), %ax          # clusters start counting data from the start of the data section
+# none
+Timestamp:
+    pushal
+    rdtsc
+    movw (TimestampNext), %di
+    mov %eax, (%di)
+    addw $4, (TimestampNext)
+    popal
     ret
+.endif
 
 main:
+    TIMESTAMP
     # save the boot drive number in the fat12 header
     movb %dl, (DriveNumber)
-    # get the geometry of the boot drive
-    mov $DISK_GETPARAMS, %ah
-    # this function expects the drive number to be in %dl
-    # Conveniently, the BIOS puts the boot drive into %dl at startup
-    # to prevent BIOS bugs, %es:%di is set to 0:0
-    xor %di, %di                        # usually, %di would be copied into %es but that was zeroed out in start to I dont need to do it again
-    stc                                 # some BIOSes don't correctly set the carry flag so it is set manually here to be cleared on success
+    # use the INT 13h extensions if the BIOS has them for the boot drive. They take an LBA so the geometry isn't needed
+    # DISK_CHECKEXTENSIONS only changes %dh on success so the boot drive is still in %dl afterwards
+    mov $DISK_CHECKEXTENSIONS, %ah
+    mov $EXTENSIONS_QUERY, %bx
     int $DISK_FUNCTIONS
-    jc hang                             # if GETPARAMS fails then we cannot continue
-    # store the output of GETPARAMS in the fat12 header
-    and $0x3f, %cx                      # lower 6 bits store the SectorsPerTrack value and the rest is the highest cylinder number. Only the sector is needed so the sector is zeroed out
-    movw %cx, (SectorsPerTrack)
-    inc %dh                             # head number starts at 0 and head count starts at 1
-    mov %dh, %cl                        # %ch is already zeroed out
-    movw %cx, (TotalHeads)
-    # clear any information that the BIOS stored in %es:%di
-    xor %di, %di
-    mov %di, %es
+    jc GetGeometry
+    cmp $EXTENSIONS_PRESENT, %bx
+    jne GetGeometry
+    shr %cx                             # bit 0 of %cx is set if DISK_READEXTENDED is supported
+    jnc GetGeometry
+    movb $DISK_READEXTENDED, (ReadFunction)
+    # ReadSectors splits reads at the end of each track, so this makes it split them into the largest extended reads instead
+    # SectorsPerTrack is never more than 63 so only the low byte needs to change
+    movb $MAX_EXTENDED_SECTORS, (SectorsPerTrack)
+    jmp SetVideoMode
+    GetGeometry:
+        # get the geometry of the boot drive
+        mov $DISK_GETPARAMS, %ah
+        # this function expects the drive number to be in %dl
+        # Conveniently, the BIOS puts the boot drive into %dl at startup
+        # to prevent BIOS bugs, %es:%di is set to 0:0
+        xor %di, %di                    # usually, %di would be copied into %es but that was zeroed out in start to I dont need to do it again
+        stc                             # some BIOSes don't correctly set the carry flag so it is set manually here to be cleared on success
+        int $DISK_FUNCTIONS
+        jc hang                         # if GETPARAMS fails then we cannot continue
+        # store the output of GETPARAMS in the fat12 header
+        and $0x3f, %cx                  # lower 6 bits store the SectorsPerTrack value and the rest is the highest cylinder number. Only the sector is needed so the sector is zeroed out
+        movw %cx, (SectorsPerTrack)
+        inc %dh                         # head number starts at 0 and head count starts at 1
+        mov %dh, %cl                    # %ch is already zeroed out
+        movw %cx, (TotalHeads)
+        # clear any information that the BIOS stored in %es (%ds is still 0)
+        push %ds
+        pop %es
+    SetVideoMode:
+    TIMESTAMP
     # make sure the computer is in the expected video mode
-    mov $VIDEO_SETMODE, %ah
-    mov $VGA_TEXT_80x25_16COLOUR, %al
+    mov $(VIDEO_SETMODE << 8 | VGA_TEXT_80x25_16COLOUR), %ax
     int $VIDEO_FUNCTIONS
     ReadRootDirectory:
-        # calculate the root directory lba (SectorsPerFAT * TotalFATS + ReservedSectors)
-        movw (SectorsPerFAT), %ax
-        mulb (TotalFATs)
-        addw (ReservedSectors), %ax
-        push %ax                        # save the lba for after the sector count is calculated
         # calculate the number of sectors in the root directory (((RootDirectoryEntries * FAT_ENTRY_SIZE) + (BytesPerSector - 1)) / BytesPerSector)
         movw (RootDirectoryEntries), %ax
-        mov $FAT_ENTRY_SIZE, %cl
-        mul %cl
+        shl $FAT_ENTRY_SHIFT, %ax
         addw (BytesPerSector), %ax
         dec %ax
         xor %dx, %dx
         divw (BytesPerSector)
-        mov %ax, %cx                    # move the sector count into its expected location
+        xchg %ax, %cx                   # move the sector count into its expected location
+        # calculate the root directory lba (SectorsPerFAT * TotalFATS + ReservedSectors)
+        movw (SectorsPerFAT), %ax
+        mulb (TotalFATs)
+        addw (ReservedSectors), %ax
         # read the sectors into the buffer
-        pop %ax                         # put the lba into its expected location
         mov $buffer, %bx                # %es is already zeroed out
-        movb (DriveNumber), %dl
         call ReadSectors
+        TIMESTAMP
         # store the data section lba for use in the cluster 2 lba conversion
         add %cx, %ax
-        movw %ax, (DataSectionLBA)
+        mov %ax, (DataSectionLBA)
+        # ReadSectors moved %es past the root directory so it needs to be set back to 0 (the same as %ds) for FindEntry and ReadFAT
+        push %ds
+        pop %es
     FindEntry:
-        mov $buffer, %si                # memory to start comparing from
-        mov $11, %cx                    # number of characters to compare
-        mov $0, %dx                     # use %dx to check that FindEntry hasn't gone out of the root directory
+        movw (RootDirectoryEntries), %dx    # use %dx to check that FindEntry hasn't gone out of the root directory
+        mov %bx, %ax                    # %ax points to the entry being compared. %bx is still the start of the buffer
         FindEntry.loop:
-            cmpw (RootDirectoryEntries), %dx
-            je hang                     # the file hasn't been found
-            mov $11, %cx
+            mov %ax, %si
             mov $FileName, %di
-            push %si                    # save current position in the root directory
+            mov $11, %cx                # number of characters to compare
             repe cmpsb
-            pop %si
             je FindEntry.exit
-            add $FAT_ENTRY_SIZE, %si    # go to the next entry in the root directory
-            inc %dx                     # increment the index
-            jmp FindEntry.loop
+            add $FAT_ENTRY_SIZE, %ax    # go to the next entry in the root directory
+            dec %dx
+            jnz FindEntry.loop
+            jmp hang                    # the file hasn't been found
         FindEntry.exit:
             # get the first cluster of the entry
-            add $FIRST_CLUSTER_LOW_OFFSET, %si
-            movw (%si), %ax             # put the first cluster number in its expected location
+            xchg %ax, %si
+            movw FIRST_CLUSTER_LOW_OFFSET(%si), %ax
             push %ax
+            TIMESTAMP
     ReadFAT:
         movw (ReservedSectors), %ax
-        mov $buffer, %bx
-        movw (SectorsPerFAT), %cx
-        movb (DriveNumber), %dl
+        movw (SectorsPerFAT), %cx       # %es:%bx is still the start of the buffer
         call ReadSectors
+        TIMESTAMP
     ReadEntry:
-        mov $STAGE2_LOCATION, %bx
+        push $STAGE2_SEGMENT
+        pop %es
+        xor %bx, %bx
+        movzbw (SectorsPerCluster), %bp # ReadSectors saves %bp so this lasts for the whole file
+        pop %ax                         # retrieve the first cluster from the stack
         ReadEntry.loop:
             # while (currentCluster < CLUSTER_END)
-            pop %ax                     # retrieve the current cluster from the stack
             cmp $CLUSTER_END, %ax
             jae ReadEntry.end
-            # read the current cluster
-            push %ax                    # save the current cluster
-            call Cluster2LBA            # get the LBA to read from
-            movb (SectorsPerCluster), %cl
-            call ReadSectors
-            # calculate the next memory location to read into
-            movw (BytesPerSector), %ax
-            xor %ch, %ch
-            mul %cx
-            shr $4, %ax
-            mov %es, %dx
-            add %ax, %dx
-            mov %dx, %ax
-            mov %dx, %es
-            # calculate the fat index of the next cluster
-            pop %ax                     # get the current cluster from the stack
-            # calculate the fat index (current cluster * 3 / 2)
-            mov $3, %cx
-            mul %cx
-            mov $2, %cx
-            xor %dx, %dx
-            div %cx
-            # get the value from the FAT
-            mov $buffer, %si
-            add %ax, %si
-            mov (%si), %ax
-            # remove the extra 4 bits
-            test %dl, %dl               # get the remainder
-            jz even
-            odd:
+            # clusters that come one after the other on the disk are merged into a run so they can be read together
+            mov %ax, %di                # first cluster of the run
+            xor %cx, %cx                # number of clusters in the run
+            ReadEntry.run:
+                inc %cx
+                # get the next cluster in the chain. Its FAT12 entry starts at byte cluster * 3 / 2 of the FAT
+                mov %ax, %si
+                shr %si
+                add %ax, %si
+                test $1, %al            # odd clusters are in the upper 12 bits of the word
+                movw buffer(%si), %ax
+                jz 1f
                 shr $4, %ax
-            even:
-                and $0xfff, %ax
-                push %ax
+            1:  and $0xfff, %ax         # remove the extra 4 bits
+                mov %di, %si
+                add %cx, %si
+                cmp %si, %ax            # carry on while the next cluster is straight after the run
+                je ReadEntry.run
+            push %ax                    # save the cluster after the run
+            # read the run (clusters * SectorsPerCluster sectors from (first cluster - 2) * SectorsPerCluster + DataSectionLBA)
+            # ReadSectors moves %es past it ready for the next one
+            xchg %ax, %cx
+            mul %bp
+            xchg %ax, %cx
+            lea -2(%di), %ax            # cluster numbers start at 2 instead of 0
+            mul %bp
+            addw (DataSectionLBA), %ax  # clusters start counting data from the start of the data section
+            call ReadSectors
+            TIMESTAMP
+            pop %ax                     # get the next cluster
             jmp ReadEntry.loop
     ReadEntry.end:
         # reset any segment registers that might have changed
-        xor %ax, %ax
-        mov %ax, %es
+        push %ds
+        pop %es
         # reset the stack
         mov $STAGE2_LOCATION, %sp
         mov %sp, %bp
         # store the boot drive in %dl
         movb (DriveNumber), %dl
+        TIMESTAMP
         # jump to the data
         ljmp $EXPECTED_CS, $STAGE2_LOCATION
-    hang:
-        cli                             # stop hardware interrupts from unhalting the cpu
-        hlt
 
-DataSectionLBA: .word 0x0000
+ReadFunction: .byte DISK_READSECT       # replaced with DISK_READEXTENDED if the BIOS has the INT 13h extensions for the boot drive
 FileName: .ascii "SAWCON  BIN"
 
+.ifdef BOOT_TIMING
+.org 508
+TimestampNext: .word TIMESTAMP_TABLE
+.endif
+
 .org 510                                # the last 2 bytes of the boot sector are used by the BIOS to check if a disk is bootable
 .word 0xAA55                            # bytes 0x55, 0xAA are used as the BIOS boot signature at the end of the boot sector
 buffer:
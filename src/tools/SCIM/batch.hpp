@@ -0,0 +1,167 @@
+// batch.hpp
+//
+// batch mode for SCIM, which runs a list of operations from a manifest against a disk image
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// manifest format
+// - one operation per line. Blank lines and lines starting with # are ignored
+// - the operation name comes first, followed by a single space and the 11 character entry name in "NAME    EXT" format
+// - read and write take a host file name after the entry name. read prints to stdout if it is left out
+//
+// list
+// write SAWCON  BIN bin/stage2.bin
+// read  CONFIG  SYS bin/config.sys
+// delete OLD     BIN
+
+#pragma once
+
+#include "scim.hpp"
+#include "operations.hpp"
+
+namespace Batch {
+
+    const char *ValidOperations[] {
+        "list",
+        "read",
+        "write",
+        "delete",
+        NULL                        // end of list
+    };
+
+    enum OPERATIONS {
+        OP_INVALID = 0,
+        OP_LIST,
+        OP_READ,
+        OP_WRITE,
+        OP_DELETE,
+    };
+
+    typedef struct Operation_t {
+        unsigned int Type;                              // one of OPERATIONS
+        char EntryName[12];                             // "NAME    EXT" format with a null terminator on the end
+        char *HostFileName;                             // NULL if the operation doesn't use a host file
+        unsigned int Line;                              // line in the manifest, used for error messages
+    } Operation_t;
+
+    /// @brief turns one line of a manifest into an operation
+    /// @param Line line to parse. Any trailing newline is removed
+    /// @param OperationOut where the operation is stored. HostFileName is strduped and should be freed
+    /// @return true on success, false if the line isn't a valid operation
+    bool ParseLine(char *Line, Operation_t *OperationOut) {
+        Line[strcspn(Line, "\r\n")] = '\0';
+
+        // the operation name ends at the first space
+        size_t NameLength = strcspn(Line, " ");
+        OperationOut->Type = OP_INVALID;
+        for(int i = 0; ValidOperations[i] != NULL; i++)
+            if(strlen(ValidOperations[i]) == NameLength && !strncasecmp(Line, ValidOperations[i], NameLength)) {
+                OperationOut->Type = i + 1;         // index 0 is reserved for invalid operations so an offset needs to be added
+                break;
+            }
+        if(OperationOut->Type == OP_INVALID) return false;
+        OperationOut->EntryName[0] = '\0';
+        OperationOut->HostFileName = NULL;
+        if(OperationOut->Type == OP_LIST) return Line[NameLength] == '\0';
+
+        // entry names can have spaces in them so the next 11 characters are taken as they are
+        char *Arguments = Line + NameLength;
+        while(*Arguments == ' ') Arguments++;
+        if(strlen(Arguments) < 11) return false;
+        memcpy(OperationOut->EntryName, Arguments, 11);
+        OperationOut->EntryName[11] = '\0';
+
+        // anything after the entry name is the host file
+        Arguments += 11;
+        while(*Arguments == ' ' || *Arguments == '\t') Arguments++;
+        if(*Arguments) {
+            if(OperationOut->Type == OP_DELETE) return false;
+            OperationOut->HostFileName = strdup(Arguments);
+            if(!OperationOut->HostFileName) return false;
+        }
+        else if(OperationOut->Type == OP_WRITE) return false;
+        return true;
+    }
+
+    /// @brief carry out a single operation on a disk
+    /// @param FileSystem disk to operate on
+    /// @param Operation operation to carry out
+    /// @return true on success, false on failure
+    bool Apply(FAT::Disk *FileSystem, Operation_t *Operation) {
+        switch(Operation->Type) {
+            case OP_LIST:
+                Operations::List(FileSystem, NULL);
+                return true;
+            case OP_READ:
+                if(Operation->HostFileName) return Operations::Read(FileSystem, Operation->EntryName, Operation->HostFileName);
+                // anything list printed has to come out before the file data
+                fflush(stdout);
+                return Operations::Read(FileSystem, Operation->EntryName, STDOUT_FILENO);
+            case OP_WRITE:
+                return Operations::Write(FileSystem, Operation->EntryName, Operation->HostFileName);
+            case OP_DELETE:
+                return Operations::Delete(FileSystem, Operation->EntryName);
+            default:
+                return false;
+        }
+    }
+
+    /// @brief runs every operation in a manifest against a disk as a single transaction. The root directory and FAT are
+    /// only written once at the end, and if anything fails the disk image is left as it was
+    /// @param FileSystem disk to operate on. Must have been initialised
+    /// @param Manifest stream to read the operations from
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int Run(FAT::Disk *FileSystem, FILE *Manifest) {
+        // parse the whole manifest before doing anything so a typo at the end doesn't waste the work at the start
+        Operation_t *OperationList = NULL;
+        size_t OperationCount = 0, OperationCapacity = 0;
+        char *Line = NULL;
+        size_t LineCapacity = 0;
+        int ReturnCode = 0;
+        for(unsigned int LineNumber = 1; getline(&Line, &LineCapacity, Manifest) >= 0; LineNumber++) {
+            size_t Skip = strspn(Line, " \t");
+            if(Line[Skip] == '#' || Line[Skip] == '\n' || Line[Skip] == '\r' || Line[Skip] == '\0') continue;
+            if(OperationCount == OperationCapacity) {
+                OperationCapacity = OperationCapacity ? OperationCapacity * 2 : 16;
+                Operation_t *Resized = (Operation_t *)realloc(OperationList, OperationCapacity * sizeof(Operation_t));
+                if(!Resized) {
+                    ReturnCode = -17;
+                    break;
+                }
+                OperationList = Resized;
+            }
+            if(!ParseLine(Line + Skip, &OperationList[OperationCount])) {
+                std::cerr << "SCIM: Error - Invalid operation on line " << LineNumber << " of the manifest\n";
+                ReturnCode = -17;
+                break;
+            }
+            OperationList[OperationCount++].Line = LineNumber;
+        }
+        free(Line);
+
+        if(!ReturnCode && !FileSystem->BeginTransaction()) ReturnCode = -18;
+
+        for(size_t i = 0; !ReturnCode && i < OperationCount; i++)
+            if(!Apply(FileSystem, &OperationList[i])) {
+                std::cerr << "SCIM: Error - Operation on line " << OperationList[i].Line << " of the manifest failed. The disk image was not changed\n";
+                ReturnCode = -19;
+            }
+
+        // only write anything if every operation worked
+        if(!ReturnCode && !FileSystem->Commit()) {
+            std::cerr << "SCIM: Error - Could not commit the changes to the disk image\n";
+            ReturnCode = -18;
+        }
+
+        for(size_t i = 0; i < OperationCount; i++)
+            free(OperationList[i].HostFileName);
+        free(OperationList);
+        return ReturnCode;
+    }
+
+}                           // contains the manifest parser and runner for batch mode
@@ -0,0 +1,361 @@
+// bench.cpp
+//
+// benchmark for the Sawcon Image Manipulator. Builds synthetic disk images and times the FAT driver on them
+// This file was written as part of the SawconOS Host Tools
+// This version of the code was written for SCIM Alpha 1.4
+// compiled using g++
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// usage: scim_bench [-d working directory] [-o results.json] [-r repetitions]
+// results are written as JSON to -o, or to stdout if it isn't given. The working directory needs space for sparse images
+// up to 512MiB but only a few MiB actually get written
+
+#include "scim.hpp"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace scim {
+namespace Bench {
+
+    enum BenchInfo {
+        DEFAULT_REPETITIONS = 32,
+        LOOKUPS = 4096,                                 // FindEntry calls per scenario
+        FREE_CLUSTER_SEARCHES = 4096,                   // NextFreeCluster calls per scenario
+        READ_TARGETS = 32,                              // most files ReadEntry is timed on per scenario
+        FAT32_FILES = 1024,                             // files put on FAT32 disks, which don't have a root directory limit
+        SPARE_ENTRIES = 8,                              // root directory entries left free for CreateEntry
+        MAX_HOST_FILE = 0x100000,                       // biggest file CreateEntry is timed with (1MiB)
+    };
+
+    typedef struct Layout_t {
+        const char *Name;
+        unsigned int FillPercent;                       // how much of the disk is used by files
+        bool Fragmented;                                // fill the disk, delete every other file, then fill the holes with files that span several of them
+    } Layout_t;
+
+    const char *Profiles[] { "floppy", "hdd64", "hdd512", NULL };
+
+    const Layout_t Layouts[] {
+        { "fill10", 10, false },
+        { "fill50", 50, false },
+        { "fill90", 90, false },
+        { "frag75", 75, true },
+        { NULL, 0, false }
+    };
+
+    typedef struct Result_t {
+        const char *Name;
+        std::vector<double> Latencies;                  // seconds per operation
+        scim::qword Bytes = 0;                          // file data moved, 0 for operations that don't move any
+        long long Syscalls = 0;                         // read and write syscalls from /proc/self/io
+    } Result_t;
+
+    /// @return monotonic time in seconds
+    double Now() {
+        timespec Time;
+        clock_gettime(CLOCK_MONOTONIC, &Time);
+        return Time.tv_sec + Time.tv_nsec / 1e9;
+    }
+
+    /// @return number of read and write syscalls this process has made so far, or 0 if the kernel doesn't count them
+    long long Syscalls() {
+        FILE *IOStats = fopen("/proc/self/io", "r");
+        if(!IOStats) return 0;
+        char Line[128];
+        long long Total = 0, Value;
+        while(fgets(Line, sizeof(Line), IOStats))
+            if(sscanf(Line, "syscr: %lld", &Value) == 1 || sscanf(Line, "syscw: %lld", &Value) == 1) Total += Value;
+        fclose(IOStats);
+        return Total;
+    }
+
+    long long SyscallOverhead = 0;                      // syscalls made by Syscalls() itself, measured once at startup
+
+    /// @brief generate the name of the nth synthetic file
+    void FileName(unsigned int Index, char *NameOut) {
+        snprintf(NameOut, 12, "B%07uDAT", Index);
+    }
+
+    /// @brief get the value at a percentile of some sorted samples
+    double Percentile(const std::vector<double> &Sorted, double Percent) {
+        if(Sorted.empty()) return 0;
+        size_t Index = (size_t)(Percent / 100 * (Sorted.size() - 1) + 0.5);
+        return Sorted[Index];
+    }
+
+    /// @brief fill a freshly formatted image with synthetic files. Chains are allocated with AddEntry in one transaction and
+    /// never written to, so the files read back as zeroes out of the sparse image and filling a big disk costs nothing
+    /// @param ImageFileName image to fill
+    /// @param Layout how full and how fragmented to make it
+    /// @param FilesOut every file on the disk afterwards
+    /// @param TargetsOut files ReadEntry should be timed on. The fragmented files on fragmented layouts
+    /// @return true on success, false on failure
+    bool Fill(const char *ImageFileName, const Layout_t *Layout, std::vector<unsigned int> *FilesOut, std::vector<unsigned int> *TargetsOut) {
+        Device::BlockDevice *Image = Device::Open(ImageFileName);
+        if(!Image) return false;
+        FAT::Disk FileSystem;
+        if(!FileSystem.Initialise(Image) || !FileSystem.BeginTransaction()) {
+            delete Image;
+            return false;
+        }
+
+        scim::qword ClusterBytes = FileSystem.FS_Info.BPB.BytesPerSector * FileSystem.FS_Info.BPB.SectorsPerCluster;
+        unsigned int FileCount = FileSystem.Type == FAT::T_FAT32 ? FAT32_FILES : FileSystem.RootEntries().size() - SPARE_ENTRIES;
+        // fragmented layouts fill the whole disk first so there is nowhere for the big files to go but the holes
+        scim::qword FillBytes = Image->Size() * (Layout->Fragmented ? 100 : Layout->FillPercent) / 100;
+        scim::qword FileSize = (FillBytes / FileCount + ClusterBytes - 1) / ClusterBytes * ClusterBytes;
+        char Name[12];
+        unsigned int Index;
+        for(Index = 0; Index < FileCount; Index++) {
+            FileName(Index, Name);
+            if(!FileSystem.AddEntry(Name, FAT::A_ARCHIVE, FileSize)) break;
+            FilesOut->push_back(Index);
+        }
+
+        if(Layout->Fragmented) {
+            // every other file is deleted, leaving holes one file long all over the disk
+            std::vector<unsigned int> Kept;
+            for(unsigned int File : *FilesOut) {
+                FileName(File, Name);
+                if(File % 2) FileSystem.DeleteEntry(FileSystem.FindEntry(Name));
+                else Kept.push_back(File);
+            }
+            *FilesOut = Kept;
+            // the deleted clusters can only be reused after the transaction has been committed
+            if(!FileSystem.Commit() || !FileSystem.BeginTransaction()) {
+                FileSystem.Clean();
+                delete Image;
+                return false;
+            }
+            // files 3 holes long have to be split over 3 holes each. Half of the holes are filled which puts the disk at about 75%
+            for(unsigned int Big = 0; Big < FileCount / 12; Big++, Index++) {
+                FileName(Index, Name);
+                if(!FileSystem.AddEntry(Name, FAT::A_ARCHIVE, FileSize * 3)) break;
+                FilesOut->push_back(Index);
+                if(TargetsOut->size() < READ_TARGETS) TargetsOut->push_back(Index);
+            }
+        }
+        else
+            for(size_t i = 0; i < FilesOut->size() && TargetsOut->size() < READ_TARGETS; i += std::max<size_t>(1, FilesOut->size() / READ_TARGETS))
+                TargetsOut->push_back((*FilesOut)[i]);
+
+        bool Success = FileSystem.Commit();
+        FileSystem.Clean();
+        delete Image;
+        return Success;
+    }
+
+    /// @brief time every operation on one image
+    /// @param ImageFileName image to benchmark. Must already be filled
+    /// @param HostFileName host file used by CreateEntry
+    /// @param Files every file on the disk
+    /// @param Targets files to time ReadEntry on
+    /// @param Repetitions how many times the slow operations are repeated
+    /// @param ResultsOut where the results are stored
+    /// @return true on success, false on failure
+    bool Measure(const char *ImageFileName, const char *HostFileName, const std::vector<unsigned int> &Files, const std::vector<unsigned int> &Targets,
+                 unsigned int Repetitions, std::vector<Result_t> *ResultsOut) {
+        char Name[12];
+        double Start;
+        long long SyscallStart;
+        Result_t Result;
+
+        // Initialise is timed with the device open and close around it since every SCIM run pays for both
+        Result = Result_t();
+        Result.Name = "Initialise";
+        SyscallStart = Syscalls();
+        for(unsigned int i = 0; i < Repetitions; i++) {
+            Start = Now();
+            Device::BlockDevice *Image = Device::Open(ImageFileName);
+            FAT::Disk FileSystem;
+            bool Success = Image && FileSystem.Initialise(Image);
+            FileSystem.Clean();
+            delete Image;
+            Result.Latencies.push_back(Now() - Start);
+            if(!Success) return false;
+        }
+        Result.Syscalls = Syscalls() - SyscallStart - SyscallOverhead;
+        ResultsOut->push_back(Result);
+
+        Device::BlockDevice *Image = Device::Open(ImageFileName);
+        FAT::Disk FileSystem;
+        if(!Image || !FileSystem.Initialise(Image)) {
+            delete Image;
+            return false;
+        }
+        size_t ClusterBytes = FileSystem.FS_Info.BPB.BytesPerSector * FileSystem.FS_Info.BPB.SectorsPerCluster;
+
+        Result = Result_t();
+        Result.Name = "FindEntry";
+        SyscallStart = Syscalls();
+        srand(1);
+        for(unsigned int i = 0; i < LOOKUPS && !Files.empty(); i++) {
+            FileName(Files[rand() % Files.size()], Name);
+            Start = Now();
+            FAT::DirectoryEntry_t *Entry = FileSystem.FindEntry(Name);
+            Result.Latencies.push_back(Now() - Start);
+            if(!Entry) break;
+        }
+        Result.Syscalls = Syscalls() - SyscallStart - SyscallOverhead;
+        ResultsOut->push_back(Result);
+
+        Result = Result_t();
+        Result.Name = "ReadEntry";
+        SyscallStart = Syscalls();
+        for(unsigned int Target : Targets) {
+            FileName(Target, Name);
+            FAT::DirectoryEntry_t *Entry = FileSystem.FindEntry(Name);
+            if(!Entry) continue;
+            // ReadEntry copies whole clusters so the buffer is rounded up
+            void *Buffer = malloc((Entry->Size + ClusterBytes - 1) / ClusterBytes * ClusterBytes + 1);
+            if(!Buffer) break;
+            Start = Now();
+            bool Success = FileSystem.ReadEntry(Entry, Buffer);
+            Result.Latencies.push_back(Now() - Start);
+            free(Buffer);
+            if(!Success) break;
+            Result.Bytes += Entry->Size;
+        }
+        Result.Syscalls = Syscalls() - SyscallStart - SyscallOverhead;
+        ResultsOut->push_back(Result);
+
+        // CreateEntry and DeleteEntry are timed as pairs so the disk is the same for every repetition
+        Result_t Create, Delete;
+        Create.Name = "CreateEntry";
+        Delete.Name = "DeleteEntry";
+        FILE *HostFile = fopen(HostFileName, "rb");
+        for(unsigned int i = 0; HostFile && i < Repetitions; i++) {
+            SyscallStart = Syscalls();
+            Start = Now();
+            bool Success = FileSystem.CreateEntry("BENCH   BIN", FAT::A_ARCHIVE, HostFile);
+            Create.Latencies.push_back(Now() - Start);
+            Create.Syscalls += Syscalls() - SyscallStart - SyscallOverhead;
+            if(!Success) break;
+            FAT::DirectoryEntry_t *Entry = FileSystem.FindEntry("BENCH   BIN");
+            Create.Bytes += Entry->Size;
+
+            SyscallStart = Syscalls();
+            Start = Now();
+            Success = FileSystem.DeleteEntry(Entry);
+            Delete.Latencies.push_back(Now() - Start);
+            Delete.Syscalls += Syscalls() - SyscallStart - SyscallOverhead;
+            if(!Success) break;
+        }
+        if(HostFile) fclose(HostFile);
+        ResultsOut->push_back(Create);
+        ResultsOut->push_back(Delete);
+
+        Result = Result_t();
+        Result.Name = "NextFreeCluster";
+        SyscallStart = Syscalls();
+        for(unsigned int i = 0; i < FREE_CLUSTER_SEARCHES; i++) {
+            Start = Now();
+            FileSystem.NextFreeCluster();
+            Result.Latencies.push_back(Now() - Start);
+        }
+        Result.Syscalls = Syscalls() - SyscallStart - SyscallOverhead;
+        ResultsOut->push_back(Result);
+
+        FileSystem.Clean();
+        delete Image;
+        return true;
+    }
+
+    /// @brief write the results of one operation as a JSON object
+    void PrintResult(FILE *Output, Result_t *Result, bool Last) {
+        std::sort(Result->Latencies.begin(), Result->Latencies.end());
+        double Total = 0;
+        for(double Latency : Result->Latencies) Total += Latency;
+        size_t Count = Result->Latencies.size();
+        fprintf(Output, "        { \"name\": \"%s\", \"count\": %zu, \"seconds\": %.9f, \"ops_per_s\": %.1f, \"mb_per_s\": %.2f, ",
+                Result->Name, Count, Total, Total > 0 ? Count / Total : 0, Total > 0 ? Result->Bytes / Total / 1e6 : 0);
+        fprintf(Output, "\"latency_us\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f }, ",
+                Percentile(Result->Latencies, 50) * 1e6, Percentile(Result->Latencies, 90) * 1e6, Percentile(Result->Latencies, 99) * 1e6,
+                Count ? Result->Latencies.back() * 1e6 : 0);
+        fprintf(Output, "\"syscalls\": %lld, \"syscalls_per_op\": %.2f }%s\n", Result->Syscalls, Count ? (double)Result->Syscalls / Count : 0, Last ? "" : ",");
+    }
+
+}                           // contains the synthetic image builder and timers for scim_bench
+}
+
+int main(int argc, char **argv) {
+
+    const char *WorkingDirectory = "/tmp", *OutputFileName = NULL;
+    unsigned int Repetitions = scim::Bench::DEFAULT_REPETITIONS;
+    for(int i = 1; i < argc; i++) {
+        if(i + 1 < argc && (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--directory"))) WorkingDirectory = argv[++i];
+        else if(i + 1 < argc && (!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output"))) OutputFileName = argv[++i];
+        else if(i + 1 < argc && (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--repetitions")) && atoi(argv[i + 1]) > 0) Repetitions = atoi(argv[++i]);
+        else {
+            std::cerr << "SCIM Bench: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+            return -2;
+        }
+    }
+
+    FILE *Output = stdout;
+    if(OutputFileName) {
+        Output = fopen(OutputFileName, "w");
+        if(!Output) {
+            std::cerr << "SCIM Bench: Error - Could not open the output file\n";
+            return -20;
+        }
+    }
+
+    std::string ImageFileName = std::string(WorkingDirectory) + "/scim_bench.img";
+    std::string HostFileName = std::string(WorkingDirectory) + "/scim_bench.host";
+
+    long long Calibration = scim::Bench::Syscalls();
+    scim::Bench::SyscallOverhead = scim::Bench::Syscalls() - Calibration;
+
+    fprintf(Output, "{\n  \"tool\": \"scim_bench\",\n  \"version\": \"Alpha 1.4\",\n  \"timestamp\": %lld,\n  \"repetitions\": %u,\n  \"scenarios\": [\n",
+            (long long)time(0), Repetitions);
+    int ReturnCode = 0;
+    bool FirstScenario = true;
+    for(int p = 0; !ReturnCode && scim::Bench::Profiles[p]; p++) {
+        const scim::Format::Profile_t *Profile = scim::Format::FindProfile(scim::Bench::Profiles[p]);
+        scim::qword ImageBytes = (scim::qword)Profile->TotalSectors * Profile->BytesPerSector;
+
+        // the host file is small enough to fit on the fullest disk
+        size_t HostFileSize = scim::min(scim::Bench::MAX_HOST_FILE, ImageBytes / 32);
+        FILE *HostFile = fopen(HostFileName.c_str(), "wb");
+        for(size_t i = 0; HostFile && i < HostFileSize; i++) fputc(rand() & 0xFF, HostFile);
+        if(!HostFile || fclose(HostFile)) {
+            std::cerr << "SCIM Bench: Error - Could not create the host file\n";
+            ReturnCode = -13;
+            break;
+        }
+
+        for(int l = 0; scim::Bench::Layouts[l].Name; l++) {
+            const scim::Bench::Layout_t *Layout = &scim::Bench::Layouts[l];
+            std::vector<unsigned int> Files, Targets;
+            std::vector<scim::Bench::Result_t> Results;
+            if(scim::Format::Run(ImageFileName.c_str(), Profile->Name, NULL, NULL) ||
+               !scim::Bench::Fill(ImageFileName.c_str(), Layout, &Files, &Targets) ||
+               !scim::Bench::Measure(ImageFileName.c_str(), HostFileName.c_str(), Files, Targets, Repetitions, &Results)) {
+                std::cerr << "SCIM Bench: Error - Scenario " << Profile->Name << "/" << Layout->Name << " failed\n";
+                ReturnCode = -19;
+                break;
+            }
+            fprintf(Output, "%s    {\n      \"profile\": \"%s\",\n      \"type\": %d,\n      \"layout\": \"%s\",\n      \"image_bytes\": %llu,\n",
+                    FirstScenario ? "" : ",\n", Profile->Name, Profile->Type, Layout->Name, ImageBytes);
+            fprintf(Output, "      \"files\": %zu,\n      \"fragmented\": %s,\n      \"host_file_bytes\": %zu,\n      \"operations\": [\n",
+                    Files.size(), Layout->Fragmented ? "true" : "false", HostFileSize);
+            for(size_t i = 0; i < Results.size(); i++)
+                scim::Bench::PrintResult(Output, &Results[i], i + 1 == Results.size());
+            fprintf(Output, "      ]\n    }");
+            FirstScenario = false;
+        }
+    }
+    fprintf(Output, "\n  ]\n}\n");
+
+    if(Output != stdout) fclose(Output);
+    unlink(ImageFileName.c_str());
+    unlink(HostFileName.c_str());
+    return ReturnCode;
+
+}
@@ -0,0 +1,182 @@
+// check.hpp
+//
+// check mode for SCIM, which validates the boot record and every cluster chain on a disk image and can repair what it finds
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Check {
+
+    enum CheckInfo {
+        MIN_BYTES_PER_SECTOR = 512,
+        MAX_BYTES_PER_SECTOR = 4096,
+        MAX_SECTORS_PER_CLUSTER = 128,
+        MEDIA_FLOPPY = 0xF0,                            // media descriptors below this one were never used
+        MEDIA_FIXED = 0xF8,                             // media descriptors from here up are all valid
+        BOOT_SIGNATURE_OFFSET = 510,
+    };
+
+    /// @brief check that a number is a power of 2
+    /// @param Value number to check
+    /// @return true if Value is a power of 2, false otherwise (including for 0)
+    bool IsPowerOf2(scim::dword Value) {
+        return Value && !(Value & (Value - 1));
+    }
+
+    /// @brief check the geometry in the boot record before anything trusts it. Problems that would stop the disk from being read are
+    /// errors, and anything that is only unusual is a warning. Each one is printed to stdout
+    /// @param ImageDevice disk image to check
+    /// @return number of errors found, or -1 if the boot sector couldn't be read
+    int CheckBootRecord(Device::BlockDevice *ImageDevice) {
+        scim::byte BootSector[MIN_BYTES_PER_SECTOR];
+        if(!ImageDevice->Read(0, sizeof(BootSector), BootSector)) return -1;
+        FAT::BootRecord_t Record;
+        memcpy(&Record, BootSector + FAT::BPB_OFFSET, sizeof(Record));
+        FAT::BiosParameterBlock_t *BPB = &Record.BPB;
+        int Errors = 0;
+
+        if(BPB->BytesPerSector < MIN_BYTES_PER_SECTOR || BPB->BytesPerSector > MAX_BYTES_PER_SECTOR || !IsPowerOf2(BPB->BytesPerSector)) {
+            printf("Boot record: error - %u bytes per sector isn't a power of 2 from %u to %u\n", BPB->BytesPerSector, MIN_BYTES_PER_SECTOR, MAX_BYTES_PER_SECTOR);
+            Errors++;
+        }
+        if(BPB->SectorsPerCluster > MAX_SECTORS_PER_CLUSTER || !IsPowerOf2(BPB->SectorsPerCluster)) {
+            printf("Boot record: error - %u sectors per cluster isn't a power of 2 from 1 to %u\n", BPB->SectorsPerCluster, MAX_SECTORS_PER_CLUSTER);
+            Errors++;
+        }
+        if(!BPB->ReservedSectors) {
+            printf("Boot record: error - there are no reserved sectors so the FAT would overwrite the boot sector\n");
+            Errors++;
+        }
+        if(!BPB->TotalFATs) {
+            printf("Boot record: error - there are no FATs\n");
+            Errors++;
+        }
+        scim::dword TotalSectors = BPB->TotalSectors ? BPB->TotalSectors : BPB->LargeSectors;
+        scim::dword FATSectors = BPB->SectorsPerFAT ? BPB->SectorsPerFAT : Record.EBPB32.SectorsPerFAT;
+        if(!TotalSectors) {
+            printf("Boot record: error - the disk is 0 sectors long\n");
+            Errors++;
+        }
+        if(!FATSectors) {
+            printf("Boot record: error - the FAT is 0 sectors long\n");
+            Errors++;
+        }
+        if(BPB->MediaDescriptor != MEDIA_FLOPPY && BPB->MediaDescriptor < MEDIA_FIXED)
+            printf("Boot record: warning - 0x%02X isn't a valid media descriptor\n", BPB->MediaDescriptor);
+        if(BootSector[BOOT_SIGNATURE_OFFSET] != 0x55 || BootSector[BOOT_SIGNATURE_OFFSET + 1] != 0xAA)
+            printf("Boot record: warning - the boot sector doesn't end with the 0x55 0xAA boot signature\n");
+        // everything after this divides by the values checked above
+        if(Errors) return Errors;
+
+        if(BPB->RootDirectoryEntries * sizeof(FAT::DirectoryEntry_t) % BPB->BytesPerSector)
+            printf("Boot record: warning - %u root directory entries don't fill a whole number of sectors\n", BPB->RootDirectoryEntries);
+        if((scim::qword)TotalSectors * BPB->BytesPerSector > ImageDevice->Size()) {
+            printf("Boot record: error - the disk is %llu bytes long but the image is only %llu bytes\n",
+                   (unsigned long long)TotalSectors * BPB->BytesPerSector, (unsigned long long)ImageDevice->Size());
+            Errors++;
+        }
+        scim::qword RootDirectorySectors = (BPB->RootDirectoryEntries * sizeof(FAT::DirectoryEntry_t) + BPB->BytesPerSector - 1) / BPB->BytesPerSector;
+        scim::qword DataSectionLBA = BPB->ReservedSectors + (scim::qword)BPB->TotalFATs * FATSectors + RootDirectorySectors;
+        if(DataSectionLBA >= TotalSectors) {
+            printf("Boot record: error - the reserved sectors, FATs, and root directory take up the whole disk\n");
+            return Errors + 1;
+        }
+
+        // the same rules FAT::Disk.Initialise uses to pick the type of FAT
+        scim::dword DataClusters = (TotalSectors - DataSectionLBA) / BPB->SectorsPerCluster;
+        scim::dword EntryBits = DataClusters < FAT::FAT12_MAX_CLUSTERS ? FAT12::Width::BITS :
+                                DataClusters < FAT::FAT16_MAX_CLUSTERS ? FAT16::Width::BITS : FAT32::Width::BITS;
+        if(EntryBits == FAT32::Width::BITS && BPB->RootDirectoryEntries) {
+            printf("Boot record: error - the disk is big enough to be FAT32 but has a fixed size root directory\n");
+            Errors++;
+        }
+        if(EntryBits != FAT32::Width::BITS && !BPB->RootDirectoryEntries) {
+            printf("Boot record: error - the disk is too small to be FAT32 but doesn't have a root directory\n");
+            Errors++;
+        }
+        scim::qword FATEntries = (scim::qword)FATSectors * BPB->BytesPerSector * 8 / EntryBits;
+        if(FATEntries < (scim::qword)DataClusters + FAT::FIRST_AVAILABLE_CLUSTER)
+            printf("Boot record: warning - the FAT only has room for %llu of the %u data clusters, so the rest of the disk can't be used\n",
+                   FATEntries > FAT::FIRST_AVAILABLE_CLUSTER ? FATEntries - FAT::FIRST_AVAILABLE_CLUSTER : 0ULL, DataClusters);
+        return Errors;
+    }
+
+    /// @brief prints a line describing a problem FAT::Disk.Check found to stdout
+    /// @param Problem problem to describe
+    void PrintProblem(const FAT::Problem_t *Problem) {
+        switch(Problem->Type) {
+            case FAT::CP_CROSS_LINK:
+                printf("%s: cross-linked at cluster %u, which already belongs to another entry, after %u clusters\n", Problem->Name, Problem->Cluster, Problem->Length);
+                break;
+            case FAT::CP_LOOP:
+                printf("%s: chain loops back to cluster %u after %u clusters\n", Problem->Name, Problem->Cluster, Problem->Length);
+                break;
+            case FAT::CP_BAD_REFERENCE:
+                printf("%s: chain runs into cluster %u, which is free, bad, or outside of the FAT, after %u clusters\n", Problem->Name, Problem->Cluster, Problem->Length);
+                break;
+            case FAT::CP_SIZE_MISMATCH:
+                printf("%s: size is %llu bytes but the chain has %u clusters\n", Problem->Name, (unsigned long long)Problem->Size, Problem->Length);
+                break;
+            case FAT::CP_LOST_CHAIN:
+                printf("lost chain of %u clusters starting at cluster %u\n", Problem->Length, Problem->Cluster);
+                break;
+            case FAT::CP_FAT_MISMATCH:
+                printf("FAT copy %u differs from the FAT that was read in %u sectors\n", Problem->Cluster, Problem->Length);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /// @brief checks the boot record and every cluster chain on a disk image and prints what was found
+    /// @param ImageDevice disk image to check
+    /// @param Repair true to fix whatever problems are found in the cluster chains. The boot record is never changed
+    /// @return 0 if the disk image is fine or was repaired, or one of the SCIM error codes otherwise
+    int Run(Device::BlockDevice *ImageDevice, bool Repair) {
+        int BootRecordErrors = CheckBootRecord(ImageDevice);
+        if(BootRecordErrors < 0) {
+            std::cerr << "SCIM: Error - Could not read the boot sector\n";
+            return -38;
+        }
+        // the chains can't be found without a usable boot record
+        if(BootRecordErrors) {
+            printf("%d boot record errors\n", BootRecordErrors);
+            return -37;
+        }
+
+        FAT::Disk FileSystem;
+        if(!FileSystem.Initialise(ImageDevice)) {
+            FileSystem.Clean();
+            std::cerr << "SCIM: Error - Could not initialise the file system\n";
+            return -6;
+        }
+
+        FAT::CheckReport_t Report;
+        bool Success = FileSystem.Check(&Report, Repair);
+        for(scim::dword i = 0; i < Report.ProblemCount; i++) PrintProblem(&Report.Problems[i]);
+        free(Report.Problems);
+        FileSystem.Clean();
+        if(!Success) {
+            std::cerr << "SCIM: Error - Could not " << (Repair ? "repair" : "check") << " the disk image\n";
+            return -38;
+        }
+
+        printf("%u files, %u directories, %u used clusters, %u lost clusters, %u bad clusters, %u problems\n",
+               Report.Files, Report.Directories, Report.UsedClusters, Report.LostClusters, Report.BadClusters, Report.ProblemCount);
+        if(!Report.ProblemCount) return 0;
+        if(Repair) {
+            printf("Repaired\n");
+            return 0;
+        }
+        return -37;
+    }
+
+}                           // contains check mode
@@ -0,0 +1,58 @@
+// defrag.hpp
+//
+// defrag mode for SCIM, which moves the files in every directory into single extents towards the start of the data section
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Defrag {
+
+    /// @brief prints a line describing how fragmented a disk is to stdout
+    /// @param Label what the measurement is of, such as "Before"
+    /// @param Report measurements from FAT::Disk.MeasureFragmentation
+    void PrintReport(const char *Label, FAT::Fragmentation_t *Report) {
+        printf("%s: %u files, %u fragmented (%.1f%%), %u extents (%.2f per file), %u free clusters in %u runs, largest free run %u clusters\n",
+               Label, Report->Files, Report->FragmentedFiles, Report->Files ? 100.0 * Report->FragmentedFiles / Report->Files : 0.0,
+               Report->Extents, Report->Files ? (double)Report->Extents / Report->Files : 0.0,
+               Report->FreeClusters, Report->FreeRuns, Report->LargestFreeRun);
+    }
+
+    /// @brief defragments a disk and reports how fragmented it was before and after
+    /// @param FileSystem disk to defragment. Must have been initialised
+    /// @param FirstName file to put at the start of the data section in "NAME    EXT" format, or NULL to keep directory order
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int Run(FAT::Disk *FileSystem, const char *FirstName) {
+        FAT::Fragmentation_t Report;
+        if(!FileSystem->MeasureFragmentation(&Report)) {
+            std::cerr << "SCIM: Error - The disk image has a broken cluster chain\n";
+            return -31;
+        }
+        PrintReport("Before", &Report);
+
+        if(FirstName) {
+            FAT::DirectoryEntry_t *FirstEntry = FileSystem->FindEntry(FirstName);
+            if(!FirstEntry || (FirstEntry->Attributes & FAT::A_DIRECTORY)) {
+                std::cerr << "SCIM: Error - Could not find the file entry\n";
+                return -8;
+            }
+        }
+
+        if(!FileSystem->Defragment(FirstName)) {
+            std::cerr << "SCIM: Error - Could not defragment the disk image\n";
+            return -32;
+        }
+
+        FileSystem->MeasureFragmentation(&Report);
+        PrintReport("After", &Report);
+        return 0;
+    }
+
+}                           // contains the reporting for defrag mode
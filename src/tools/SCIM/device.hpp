@@ -0,0 +1,625 @@
+// device.hpp
+//
+// block device layer that sits underneath the FAT drivers in SCIM
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Device {
+
+    /// @brief generic interface for anything that can hold a disk image. All offsets are measured in bytes from the start of the image
+    class BlockDevice {
+
+        public:
+
+            virtual ~BlockDevice() {}
+
+            /// @brief copy some data out of the device
+            /// @param Offset byte offset to start reading from
+            /// @param Length number of bytes to read
+            /// @param BufferOut where the data will be stored
+            /// @return true on success, false on failure
+            virtual bool Read(scim::qword Offset, size_t Length, void *BufferOut) = 0;
+
+            /// @brief copy some data into the device
+            /// @param Offset byte offset to start writing to
+            /// @param Length number of bytes to write
+            /// @param Buffer data to write
+            /// @return true on success, false on failure
+            virtual bool Write(scim::qword Offset, size_t Length, const void *Buffer) = 0;
+
+            /// @brief get a pointer straight into the storage of the device so it can be used without copying it first
+            /// @param Offset byte offset of the data
+            /// @param Length number of bytes that will be accessed through the pointer
+            /// @return pointer to the data on success, NULL if the device can't be addressed directly or the range is out of bounds
+            virtual scim::byte *Map(scim::qword Offset, size_t Length) { return NULL; }
+
+            /// @brief get the host file descriptor of the image so data can be copied in and out of it inside the kernel. Anything
+            /// the device has buffered is flushed first so the file descriptor and the device agree
+            /// @return file descriptor on success, -1 if the device isn't backed by a single host file
+            virtual int GetFileDescriptor() { return -1; }
+
+            /// @brief make sure everything that was written to the device has reached the image file
+            /// @return true on success, false on failure
+            virtual bool Sync() { return true; }
+
+            /// @return size of the device in bytes
+            virtual scim::qword Size() = 0;
+
+    };
+
+    /// @brief device that maps the whole image into memory. Reads and writes are just memory copies and the FAT drivers can point straight into the image
+    class MappedDevice : public BlockDevice {
+
+        public:
+
+            /// @brief map an image file into memory
+            /// @param FileName path to the image file
+            /// @return true on success, false if the file can't be mapped
+            bool Open(const char *FileName) {
+                FileDescriptor = open(FileName, O_RDWR);
+                if(FileDescriptor < 0) return false;
+                struct stat FileInfo;
+                // mmap can't map empty files or things like pipes so those are left to the stream device
+                if(fstat(FileDescriptor, &FileInfo) < 0 || !S_ISREG(FileInfo.st_mode) || FileInfo.st_size == 0) {
+                    Close();
+                    return false;
+                }
+                MappingSize = FileInfo.st_size;
+                void *Mapping = mmap(NULL, MappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, FileDescriptor, 0);
+                if(Mapping == MAP_FAILED) {
+                    Close();
+                    return false;
+                }
+                Base = (scim::byte *)Mapping;
+                return true;
+            }
+
+            /// @brief unmap the image and close the file. Safe to call more than once
+            void Close() {
+                if(Base) munmap(Base, MappingSize);
+                if(FileDescriptor >= 0) close(FileDescriptor);
+                Base = NULL;
+                FileDescriptor = -1;
+                MappingSize = 0;
+            }
+
+            ~MappedDevice() {
+                Close();
+            }
+
+            bool Read(scim::qword Offset, size_t Length, void *BufferOut) {
+                scim::byte *Source = Map(Offset, Length);
+                if(!Source) return false;
+                memcpy(BufferOut, Source, Length);
+                return true;
+            }
+
+            bool Write(scim::qword Offset, size_t Length, const void *Buffer) {
+                scim::byte *Destination = Map(Offset, Length);
+                if(!Destination) return false;
+                // the FAT drivers write their metadata in place so the data might already be where it needs to be
+                if(Destination != Buffer) memmove(Destination, Buffer, Length);
+                return true;
+            }
+
+            scim::byte *Map(scim::qword Offset, size_t Length) {
+                if(!Base || Offset > MappingSize || Length > MappingSize - Offset) return NULL;
+                return Base + Offset;
+            }
+
+            bool Sync() {
+                if(!Base) return false;
+                SCIM_COUNT(C_SYSCALLS, 1);
+                return msync(Base, MappingSize, MS_SYNC) == 0;
+            }
+
+            // the mapping is MAP_SHARED so it shares the page cache with the file and never needs flushing
+            int GetFileDescriptor() {
+                return FileDescriptor;
+            }
+
+            scim::qword Size() {
+                return MappingSize;
+            }
+
+        private:
+
+            int FileDescriptor = -1;
+            scim::byte *Base = NULL;
+            scim::qword MappingSize = 0;
+
+    };
+
+    /// @brief device that goes through a stdio stream. Slower than MappedDevice but works on anything fopen can open.
+    /// GetFileDescriptor isn't supported because stdio could hand back stale buffered data after the kernel copies into the file
+    class StreamDevice : public BlockDevice {
+
+        public:
+
+            /// @brief open an image file for reading and writing in binary mode
+            /// @param FileName path to the image file
+            /// @return true on success, false on failure
+            bool Open(const char *FileName) {
+                Stream = fopen(FileName, "rb+");
+                return Stream != NULL;
+            }
+
+            /// @brief close the stream. Safe to call more than once
+            void Close() {
+                if(Stream) fclose(Stream);
+                Stream = NULL;
+            }
+
+            ~StreamDevice() {
+                Close();
+            }
+
+            // the seek and the transfer have to happen together so the stream is locked in case more than one thread is using it
+            bool Read(scim::qword Offset, size_t Length, void *BufferOut) {
+                std::lock_guard<std::mutex> Guard(Lock);
+                SCIM_COUNT(C_SEEKS, 1);
+                SCIM_COUNT(C_SYSCALLS, 2);
+                if(!Stream || fseeko(Stream, Offset, SEEK_SET) < 0) return false;
+                return fread(BufferOut, 1, Length, Stream) == Length;
+            }
+
+            bool Write(scim::qword Offset, size_t Length, const void *Buffer) {
+                std::lock_guard<std::mutex> Guard(Lock);
+                SCIM_COUNT(C_SEEKS, 1);
+                SCIM_COUNT(C_SYSCALLS, 2);
+                if(!Stream || fseeko(Stream, Offset, SEEK_SET) < 0) return false;
+                return fwrite(Buffer, 1, Length, Stream) == Length;
+            }
+
+            bool Sync() {
+                if(!Stream) return false;
+                return fflush(Stream) == 0;
+            }
+
+            scim::qword Size() {
+                std::lock_guard<std::mutex> Guard(Lock);
+                if(!Stream || fseeko(Stream, 0, SEEK_END) < 0) return 0;
+                return ftello(Stream);
+            }
+
+        private:
+
+            FILE *Stream = NULL;
+            std::mutex Lock;
+
+    };
+
+    enum CopyInfo {
+        CURRENT_POSITION = -1,                          // pass as an offset to KernelCopy to use and move the file position instead. Needed for pipes
+    };
+
+    /// @brief copy data between two host files without it passing through user space. copy_file_range is tried first, which
+    /// lets the filesystem share the data (reflink) if it supports it. sendfile is used if that doesn't work, such as when
+    /// the destination is a pipe
+    /// @param SourceFileDescriptor file to copy from
+    /// @param SourceOffset byte offset in the source file, or CURRENT_POSITION
+    /// @param DestinationFileDescriptor file to copy to
+    /// @param DestinationOffset byte offset in the destination file, or CURRENT_POSITION
+    /// @param Length number of bytes to copy
+    /// @return number of bytes that were copied. If this is less than Length then the kernel couldn't copy between the files
+    /// and the caller should copy the rest itself
+    inline size_t KernelCopy(int SourceFileDescriptor, long long SourceOffset, int DestinationFileDescriptor, long long DestinationOffset, size_t Length) {
+        if(SourceFileDescriptor < 0 || DestinationFileDescriptor < 0) return 0;
+        loff_t SourcePosition = SourceOffset, DestinationPosition = DestinationOffset;
+        size_t Copied = 0;
+        while(Copied < Length) {
+            ssize_t Result = copy_file_range(SourceFileDescriptor, SourceOffset == CURRENT_POSITION ? NULL : &SourcePosition,
+                                             DestinationFileDescriptor, DestinationOffset == CURRENT_POSITION ? NULL : &DestinationPosition,
+                                             Length - Copied, 0);
+            SCIM_COUNT(C_SYSCALLS, 1);
+            if(Result < 0 && errno == EINTR) continue;
+            if(Result <= 0) break;
+            Copied += Result;
+        }
+
+        // sendfile can only write to the current position of the destination so it has to be moved there first
+        if(Copied < Length && DestinationOffset != CURRENT_POSITION) {
+            SCIM_COUNT(C_SEEKS, 1);
+            SCIM_COUNT(C_SYSCALLS, 1);
+        }
+        if(Copied < Length && DestinationOffset != CURRENT_POSITION && lseek(DestinationFileDescriptor, DestinationPosition, SEEK_SET) < 0)
+            return Copied;
+        while(Copied < Length) {
+            ssize_t Result = sendfile(DestinationFileDescriptor, SourceFileDescriptor, SourceOffset == CURRENT_POSITION ? NULL : &SourcePosition, Length - Copied);
+            SCIM_COUNT(C_SYSCALLS, 1);
+            if(Result < 0 && errno == EINTR) continue;
+            if(Result <= 0) break;
+            Copied += Result;
+        }
+        return Copied;
+    }
+
+    /// @brief copy the parts of a host file that hold data, leaving the holes as holes. The kernel does the copying, and some
+    /// filesystems share the data instead of copying it
+    /// @param Source file to copy from
+    /// @param Destination file to copy to. Must already be Size bytes long and read as zeroes
+    /// @param Size size of the source file in bytes
+    /// @return true on success, false on failure
+    inline bool SparseCopy(int Source, int Destination, scim::qword Size) {
+        off_t Data = 0;
+        while((scim::qword)Data < Size) {
+            off_t Hole;
+            off_t NextData = lseek(Source, Data, SEEK_DATA);
+            SCIM_COUNT(C_SYSCALLS, 1);
+            if(NextData < 0 && errno == ENXIO) return true;            // nothing but a hole from here to the end
+            // filesystems that can't find holes get everything copied
+            if(NextData < 0) Hole = Size;
+            else {
+                Data = NextData;
+                Hole = lseek(Source, Data, SEEK_HOLE);
+                SCIM_COUNT(C_SYSCALLS, 1);
+                if(Hole < 0) Hole = Size;
+            }
+            size_t Length = Hole - Data;
+            if(KernelCopy(Source, Data, Destination, Data, Length) < Length) return false;
+            SCIM_COUNT(C_BYTES_COPIED, Length);
+            Data = Hole;
+        }
+        return true;
+    }
+
+    /// @brief make a copy of a host file. A reflink is tried first, which shares every block with the source until one of them
+    /// is written, so it is instant however big the file is. Filesystems that don't support them get a sparse copy instead
+    /// @param Source file to copy from
+    /// @param DestinationPath file to create. An existing file is overwritten unless it is the source
+    /// @param ReflinkedOut set if the copy is a reflink
+    /// @return file descriptor of the copy opened for reading and writing, which the caller has to close. -1 on failure
+    inline int CloneFile(int Source, const char *DestinationPath, bool *ReflinkedOut) {
+        *ReflinkedOut = false;
+        struct stat SourceInfo, DestinationInfo;
+        if(fstat(Source, &SourceInfo) < 0) return -1;
+        int FileDescriptor = open(DestinationPath, O_RDWR | O_CREAT, 0644);
+        if(FileDescriptor < 0) return -1;
+        bool Success = fstat(FileDescriptor, &DestinationInfo) == 0 &&
+                       (DestinationInfo.st_dev != SourceInfo.st_dev || DestinationInfo.st_ino != SourceInfo.st_ino);
+        // the file is emptied only once it is known not to be the source
+        Success = Success && ftruncate(FileDescriptor, 0) == 0;
+        *ReflinkedOut = Success && ioctl(FileDescriptor, FICLONE, Source) == 0;
+        SCIM_COUNT(C_SYSCALLS, 1);
+        if(Success && !*ReflinkedOut)
+            Success = ftruncate(FileDescriptor, SourceInfo.st_size) == 0 && SparseCopy(Source, FileDescriptor, SourceInfo.st_size);
+        if(Success) return FileDescriptor;
+        close(FileDescriptor);
+        return -1;
+    }
+
+    enum OverlayInfo {
+        DELTA_SECTOR_SIZE = 512,                        // sectors are the unit of copy on write no matter what the filesystem uses
+        DELTA_RECORD_SIZE = 8 + DELTA_SECTOR_SIZE,      // sector number followed by the sector
+        DELTA_BATCH_RECORDS = 128,                      // new sectors are appended this many at a time
+        DELTA_HASH_CHUNK = 0x100000,                    // how much of the base is read at a time when it is hashed (1MiB)
+    };
+
+    typedef struct DeltaHeader_t {
+        char Magic[8];                                  // "SCIMDLT1"
+        scim::dword SectorSize;                         // always DELTA_SECTOR_SIZE, here so the format can change later
+        scim::qword BaseHash;                           // hash of every byte and the size of the base image the delta was made
+        scim::qword BaseSize;                           // against, so it isn't put on top of the wrong image or one that has changed since
+    } __attribute__((packed)) DeltaHeader_t;            // start of a delta file. The records follow straight after it
+
+    /// @brief device that leaves a base image untouched and puts every write in a separate delta file. The delta is a log of
+    /// sector records with an index in memory, so it only takes up as much space as the sectors that changed and lots of
+    /// deltas can share one base image
+    class OverlayDevice : public BlockDevice {
+
+        public:
+
+            /// @brief open a base image read only with a delta on top of it
+            /// @param BaseFileName path to the base image
+            /// @param DeltaFileName path to the delta file. It is created if it doesn't exist
+            /// @param Truncate empty the delta first instead of carrying on from what is already in it
+            /// @return true on success, false if either file can't be opened or the delta is for a different base. The whole base
+            /// is read once to hash it, so a base that changed anywhere since the delta was made is caught
+            bool Open(const char *BaseFileName, const char *DeltaFileName, bool Truncate = false) {
+                Base = open(BaseFileName, O_RDONLY);
+                Delta = open(DeltaFileName, O_RDWR | O_CREAT | (Truncate ? O_TRUNC : 0), 0644);
+                struct stat BaseInfo, DeltaInfo;
+                if(Base < 0 || Delta < 0 || fstat(Base, &BaseInfo) < 0 || fstat(Delta, &DeltaInfo) < 0 || !S_ISREG(BaseInfo.st_mode) ||
+                   (BaseInfo.st_dev == DeltaInfo.st_dev && BaseInfo.st_ino == DeltaInfo.st_ino)) {
+                    Close();
+                    return false;
+                }
+                BaseSize = BaseInfo.st_size;
+                scim::qword BaseHash;
+                if(!HashBase(&BaseHash)) {
+                    Close();
+                    return false;
+                }
+                DeltaHeader_t Header;
+                if(DeltaInfo.st_size == 0) {
+                    memcpy(Header.Magic, "SCIMDLT1", 8);
+                    Header.SectorSize = DELTA_SECTOR_SIZE;
+                    Header.BaseHash = BaseHash;
+                    Header.BaseSize = BaseSize;
+                    if(!scim::WriteAllAt(Delta, &Header, sizeof(Header), 0)) {
+                        Close();
+                        return false;
+                    }
+                    DeltaSize = sizeof(Header);
+                    return true;
+                }
+                if(!scim::ReadAllAt(Delta, &Header, sizeof(Header), 0) || memcmp(Header.Magic, "SCIMDLT1", 8) ||
+                   Header.SectorSize != DELTA_SECTOR_SIZE || Header.BaseHash != BaseHash || Header.BaseSize != BaseSize || !LoadIndex(DeltaInfo.st_size)) {
+                    Close();
+                    return false;
+                }
+                return true;
+            }
+
+            /// @brief close both files and free the index. Safe to call more than once
+            void Close() {
+                if(Base >= 0) close(Base);
+                if(Delta >= 0) close(Delta);
+                free(Slots);
+                free(Batch);
+                Base = Delta = -1;
+                Slots = NULL;
+                Batch = NULL;
+                SlotCount = UsedSlots = 0;
+                BaseSize = DeltaSize = 0;
+            }
+
+            ~OverlayDevice() {
+                Close();
+            }
+
+            bool Read(scim::qword Offset, size_t Length, void *BufferOut) {
+                std::lock_guard<std::mutex> Guard(Lock);
+                if(Base < 0 || Offset > BaseSize || Length > BaseSize - Offset) return false;
+                scim::byte *Out = (scim::byte *)BufferOut;
+                while(Length) {
+                    size_t InSector = Offset % DELTA_SECTOR_SIZE;
+                    size_t Chunk = scim::min(DELTA_SECTOR_SIZE - InSector, Length);
+                    scim::qword Record = Find(Offset / DELTA_SECTOR_SIZE);
+                    if(Record) {
+                        if(!scim::ReadAllAt(Delta, Out, Chunk, Record + InSector)) return false;
+                    }
+                    else {
+                        // runs of sectors that aren't in the delta come from the base in one read
+                        while(Chunk < Length && !Find((Offset + Chunk) / DELTA_SECTOR_SIZE))
+                            Chunk += scim::min(DELTA_SECTOR_SIZE, Length - Chunk);
+                        if(!scim::ReadAllAt(Base, Out, Chunk, Offset)) return false;
+                    }
+                    Out += Chunk;
+                    Offset += Chunk;
+                    Length -= Chunk;
+                }
+                return true;
+            }
+
+            bool Write(scim::qword Offset, size_t Length, const void *Buffer) {
+                std::lock_guard<std::mutex> Guard(Lock);
+                if(Base < 0 || Offset > BaseSize || Length > BaseSize - Offset) return false;
+                const scim::byte *In = (const scim::byte *)Buffer;
+                size_t Batched = 0;
+                if(!Batch && !(Batch = (scim::byte *)malloc(DELTA_BATCH_RECORDS * DELTA_RECORD_SIZE))) return false;
+                while(Length) {
+                    scim::qword Sector = Offset / DELTA_SECTOR_SIZE;
+                    size_t InSector = Offset % DELTA_SECTOR_SIZE;
+                    size_t Chunk = scim::min(DELTA_SECTOR_SIZE - InSector, Length);
+                    scim::qword Record = Find(Sector);
+                    if(Record) {
+                        if(!scim::WriteAllAt(Delta, In, Chunk, Record + InSector)) return false;
+                    }
+                    else {
+                        // new sectors are built up in the batch and appended together. Parts of a sector that aren't being
+                        // written keep what the base has, and anything past the end of the base reads as zeroes
+                        scim::byte *Entry = Batch + Batched * DELTA_RECORD_SIZE;
+                        memcpy(Entry, &Sector, 8);
+                        if(Chunk < DELTA_SECTOR_SIZE) {
+                            size_t BaseLength = scim::min(DELTA_SECTOR_SIZE, BaseSize - Sector * DELTA_SECTOR_SIZE);
+                            memset(Entry + 8 + BaseLength, 0, DELTA_SECTOR_SIZE - BaseLength);
+                            if(!scim::ReadAllAt(Base, Entry + 8, BaseLength, Sector * DELTA_SECTOR_SIZE)) return false;
+                        }
+                        memcpy(Entry + 8 + InSector, In, Chunk);
+                        if(++Batched == DELTA_BATCH_RECORDS && !FlushBatch(&Batched)) return false;
+                    }
+                    In += Chunk;
+                    Offset += Chunk;
+                    Length -= Chunk;
+                }
+                return FlushBatch(&Batched);
+            }
+
+            bool Sync() {
+                if(Delta < 0) return false;
+                SCIM_COUNT(C_SYSCALLS, 1);
+                return fsync(Delta) == 0;
+            }
+
+            scim::qword Size() {
+                return BaseSize;
+            }
+
+            /// @return number of sectors held in the delta
+            scim::qword SectorCount() {
+                std::lock_guard<std::mutex> Guard(Lock);
+                return UsedSlots;
+            }
+
+            /// @brief write every sector in the delta into a host file at the same offset it has in the image. Committing a delta
+            /// is a copy of the base with this done to it
+            /// @param FileDescriptor file to write the sectors to
+            /// @return true on success, false on failure
+            bool ApplyTo(int FileDescriptor) {
+                std::lock_guard<std::mutex> Guard(Lock);
+                scim::byte Sector[DELTA_SECTOR_SIZE];
+                for(size_t i = 0; i < SlotCount; i++) {
+                    if(!Slots[i].Record) continue;
+                    scim::qword Offset = Slots[i].Sector * DELTA_SECTOR_SIZE;
+                    size_t Length = scim::min(DELTA_SECTOR_SIZE, BaseSize - Offset);
+                    if(!scim::ReadAllAt(Delta, Sector, Length, Slots[i].Record) || !scim::WriteAllAt(FileDescriptor, Sector, Length, Offset))
+                        return false;
+                }
+                return true;
+            }
+
+        private:
+
+            typedef struct Slot_t {
+                scim::qword Sector;
+                scim::qword Record;                     // offset of the sector's data in the delta, 0 if the slot is empty
+            } Slot_t;
+
+            int Base = -1, Delta = -1;
+            scim::qword BaseSize = 0;
+            scim::qword DeltaSize = 0;                  // where the next record goes
+            Slot_t *Slots = NULL;                       // open addressed hash table from sector number to record
+            size_t SlotCount = 0;                       // always a power of 2
+            size_t UsedSlots = 0;
+            scim::byte *Batch = NULL;
+            std::mutex Lock;
+
+            size_t Hash(scim::qword Sector) {
+                return (Sector * 0x9E3779B97F4A7C15ULL) >> 17;
+            }
+
+            scim::qword Find(scim::qword Sector) {
+                if(!SlotCount) return 0;
+                for(size_t i = Hash(Sector) & (SlotCount - 1); Slots[i].Record; i = (i + 1) & (SlotCount - 1))
+                    if(Slots[i].Sector == Sector) return Slots[i].Record;
+                return 0;
+            }
+
+            /// @brief hash the whole base image, DELTA_HASH_CHUNK bytes at a time
+            /// @param HashOut where the hash is stored
+            /// @return true on success, false if the base can't be read or there isn't enough memory
+            bool HashBase(scim::qword *HashOut) {
+                scim::byte *Buffer = (scim::byte *)malloc(DELTA_HASH_CHUNK);
+                if(!Buffer) return false;
+                SCIM_TIME_DETAIL(P_DATA_COPY, "Hash base");
+                scim::Hash_t Hash;
+                bool Success = true;
+                for(scim::qword Offset = 0; Success && Offset < BaseSize; Offset += DELTA_HASH_CHUNK) {
+                    size_t Length = scim::min(DELTA_HASH_CHUNK, BaseSize - Offset);
+                    Success = scim::ReadAllAt(Base, Buffer, Length, Offset);
+                    Hash.Update(Buffer, Length);
+                }
+                free(Buffer);
+                *HashOut = Hash.Finish();
+                return Success;
+            }
+
+            /// @brief make sure the index can take some more sectors without having to grow. The table doubles whenever it would
+            /// get more than half full
+            /// @param Extra number of sectors that are about to be added
+            /// @return true on success, false if there isn't enough memory
+            bool Reserve(size_t Extra) {
+                size_t NewCount = SlotCount ? SlotCount : 1024;
+                while((UsedSlots + Extra) * 2 > NewCount) NewCount *= 2;
+                if(NewCount == SlotCount) return true;
+                Slot_t *NewSlots = (Slot_t *)calloc(NewCount, sizeof(Slot_t));
+                if(!NewSlots) return false;
+                for(size_t i = 0; i < SlotCount; i++) {
+                    if(!Slots[i].Record) continue;
+                    size_t j = Hash(Slots[i].Sector) & (NewCount - 1);
+                    while(NewSlots[j].Record) j = (j + 1) & (NewCount - 1);
+                    NewSlots[j] = Slots[i];
+                }
+                free(Slots);
+                Slots = NewSlots;
+                SlotCount = NewCount;
+                return true;
+            }
+
+            /// @brief add a sector to the index or move it to a new record
+            bool Insert(scim::qword Sector, scim::qword Record) {
+                if(!Reserve(1)) return false;
+                size_t i = Hash(Sector) & (SlotCount - 1);
+                while(Slots[i].Record && Slots[i].Sector != Sector) i = (i + 1) & (SlotCount - 1);
+                if(!Slots[i].Record) UsedSlots++;
+                Slots[i].Sector = Sector;
+                Slots[i].Record = Record;
+                return true;
+            }
+
+            /// @brief append the records waiting in the batch to the delta, then add them to the index, so the index only ever points
+            /// at records that are in the delta. If the append fails the delta is cut back to where it was so a half written batch
+            /// isn't picked up the next time it is opened
+            bool FlushBatch(size_t *Batched) {
+                if(!*Batched) return true;
+                // room is made in the index first so nothing can fail once the records are in the delta
+                if(!Reserve(*Batched)) return false;
+                if(!scim::WriteAllAt(Delta, Batch, *Batched * DELTA_RECORD_SIZE, DeltaSize)) {
+                    // the append has already failed, so there is nothing more to do if cutting it off fails as well
+                    SCIM_COUNT(C_SYSCALLS, 1);
+                    [[maybe_unused]] int Result = ftruncate(Delta, DeltaSize);
+                    return false;
+                }
+                for(size_t i = 0; i < *Batched; i++) {
+                    scim::qword Sector;
+                    memcpy(&Sector, Batch + i * DELTA_RECORD_SIZE, 8);
+                    Insert(Sector, DeltaSize + i * DELTA_RECORD_SIZE + 8);
+                }
+                DeltaSize += *Batched * DELTA_RECORD_SIZE;
+                *Batched = 0;
+                return true;
+            }
+
+            /// @brief build the index from the records already in the delta. A sector that appears more than once uses its last
+            /// record, and a record cut short at the end of the file is ignored and written over by the next append
+            bool LoadIndex(scim::qword FileSize) {
+                scim::byte *Buffer = (scim::byte *)malloc(DELTA_BATCH_RECORDS * DELTA_RECORD_SIZE);
+                if(!Buffer) return false;
+                scim::qword RecordCount = (FileSize - sizeof(DeltaHeader_t)) / DELTA_RECORD_SIZE;
+                scim::qword Offset = sizeof(DeltaHeader_t);
+                bool Success = true;
+                for(scim::qword Done = 0; Success && Done < RecordCount;) {
+                    size_t Count = scim::min(DELTA_BATCH_RECORDS, RecordCount - Done);
+                    Success = scim::ReadAllAt(Delta, Buffer, Count * DELTA_RECORD_SIZE, Offset);
+                    for(size_t i = 0; Success && i < Count; i++) {
+                        scim::qword Sector;
+                        memcpy(&Sector, Buffer + i * DELTA_RECORD_SIZE, 8);
+                        Success = Sector * DELTA_SECTOR_SIZE < BaseSize && Insert(Sector, Offset + i * DELTA_RECORD_SIZE + 8);
+                    }
+                    Done += Count;
+                    Offset += Count * DELTA_RECORD_SIZE;
+                }
+                free(Buffer);
+                DeltaSize = Offset;
+                return Success;
+            }
+
+    };
+
+    /// @brief open a disk image with the fastest device that supports it. Images that can't be mapped fall back to a stdio stream
+    /// @param FileName path to the image file
+    /// @return pointer to the device on success which should be deleted when it's no longer needed, NULL on failure
+    inline BlockDevice *Open(const char *FileName) {
+        MappedDevice *Mapped = new MappedDevice;
+        if(Mapped->Open(FileName)) return Mapped;
+        delete Mapped;
+
+        StreamDevice *Stream = new StreamDevice;
+        if(Stream->Open(FileName)) return Stream;
+        delete Stream;
+
+        return NULL;
+    }
+
+    /// @brief open a base image with a delta file on top of it
+    /// @param BaseFileName path to the base image, which is never written to
+    /// @param DeltaFileName path to the delta file. It is created if it doesn't exist
+    /// @return pointer to the device on success which should be deleted when it's no longer needed, NULL on failure
+    inline BlockDevice *OpenOverlay(const char *BaseFileName, const char *DeltaFileName) {
+        OverlayDevice *Overlay = new OverlayDevice;
+        if(Overlay->Open(BaseFileName, DeltaFileName)) return Overlay;
+        delete Overlay;
+        return NULL;
+    }
+
+}                           // contains the storage backends that disk images can be accessed through
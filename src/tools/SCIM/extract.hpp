@@ -0,0 +1,224 @@
+// extract.hpp
+//
+// extract mode for SCIM, which copies every file in the root directory of a disk image out to a host directory
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Extract {
+
+    typedef struct File_t {
+        char *HostPath;                                 // path of the host file being written. malloced
+        int FileDescriptor;
+    } File_t;
+
+    typedef struct Piece_t {
+        scim::qword ImageOffset;                        // where the data is on the disk image
+        scim::qword FileOffset;                         // where the data goes in the host file
+        size_t Length;                                  // no more than FAT::MAX_TRANSFER_SIZE
+        size_t File;                                    // index of the host file in the file list
+    } Piece_t;              // part of a file that is in one place on the disk image
+
+    typedef struct Batch_t {
+        size_t FirstPiece;                              // index of the first piece in the sorted piece list
+        size_t PieceCount;
+        scim::qword ImageOffset;                        // where the first piece is on the disk image
+        size_t Length;                                  // bytes covered by every piece in the batch. No more than FAT::MAX_TRANSFER_SIZE
+    } Batch_t;              // pieces that come one after the other on the disk image so they can be read in one transfer
+
+    /// @brief reads each batch from the disk image and writes its pieces to their host files. Several of these run at once, each
+    /// picking up the next batch that nobody has taken yet, so the disk image is still read from start to end
+    /// @param ImageDevice disk image to read from
+    /// @param Batches list of every batch in disk image order
+    /// @param BatchCount number of batches in the list
+    /// @param Pieces list of every piece sorted by where it is on the disk image
+    /// @param Files list of every host file being written
+    /// @param NextBatch index of the next batch that hasn't been taken. Shared between all the workers
+    /// @param Failed set if any batch fails so the other workers can stop early
+    void Worker(Device::BlockDevice *ImageDevice, const Batch_t *Batches, size_t BatchCount, const Piece_t *Pieces, const File_t *Files,
+                std::atomic<size_t> *NextBatch, std::atomic<bool> *Failed) {
+        scim::byte *Buffer = NULL;          // only needed if the device can't be mapped
+        for(size_t i = (*NextBatch)++; i < BatchCount && !*Failed; i = (*NextBatch)++) {
+            const Batch_t *Batch = &Batches[i];
+            const scim::byte *BatchData = ImageDevice->Map(Batch->ImageOffset, Batch->Length);
+            if(!BatchData) {
+                if(!Buffer) Buffer = (scim::byte *)malloc(FAT::MAX_TRANSFER_SIZE);
+                if(!Buffer || !ImageDevice->Read(Batch->ImageOffset, Batch->Length, Buffer)) {
+                    std::cerr << "SCIM: Error - Could not read the disk image\n";
+                    *Failed = true;
+                    break;
+                }
+                BatchData = Buffer;
+            }
+            SCIM_COUNT(C_BYTES_COPIED, Batch->Length);
+            for(size_t j = Batch->FirstPiece; j < Batch->FirstPiece + Batch->PieceCount; j++) {
+                if(scim::WriteAllAt(Files[Pieces[j].File].FileDescriptor, BatchData + (Pieces[j].ImageOffset - Batch->ImageOffset), Pieces[j].Length, Pieces[j].FileOffset))
+                    continue;
+                std::cerr << "SCIM: Error - Could not write \"" << Files[Pieces[j].File].HostPath << "\"\n";
+                *Failed = true;
+                break;
+            }
+        }
+        free(Buffer);
+    }
+
+    /// @brief copies every file in the root directory of a disk, or every file whose name matches a pattern, into a host directory.
+    /// The extents of every file are gathered first and sorted by where they are on the disk image, then a pool of threads reads
+    /// them in that order in transfers of up to FAT::MAX_TRANSFER_SIZE and writes each piece straight to its place in its host file.
+    /// Each host file ends up exactly as long as the size in its entry
+    /// @param FileSystem disk to extract from. Must have been initialised
+    /// @param ImageDevice disk image the disk was initialised with
+    /// @param HostDirectory path of the host directory. Created if it doesn't exist
+    /// @param Pattern shell pattern such as "*.BIN" that the host file names have to match, or NULL for every file. Not case sensitive
+    /// @param ThreadCount number of threads copying file data. 0 uses one thread per CPU
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int Run(FAT::Disk *FileSystem, Device::BlockDevice *ImageDevice, const char *HostDirectory, const char *Pattern, unsigned int ThreadCount) {
+        if(mkdir(HostDirectory, 0755) < 0 && errno != EEXIST) {
+            std::cerr << "SCIM: Error - Could not create the host directory\n";
+            return -21;
+        }
+        // every host file stays open until its data has been written, so the open file limit is raised as far as it goes
+        struct rlimit FileLimit;
+        if(!getrlimit(RLIMIT_NOFILE, &FileLimit)) {
+            FileLimit.rlim_cur = FileLimit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &FileLimit);
+        }
+
+        // planning phase: every extent of every file is split into pieces
+        size_t ClusterBytes = FileSystem->FS_Info.BPB.BytesPerSector * FileSystem->FS_Info.BPB.SectorsPerCluster;
+        std::span<FAT::DirectoryEntry_t> RootEntries = FileSystem->RootEntries();
+        File_t *Files = (File_t *)calloc(RootEntries.size() ? RootEntries.size() : 1, sizeof(File_t));
+        Piece_t *Pieces = NULL;
+        size_t FileCount = 0, PieceCount = 0, PieceCapacity = 0;
+        int ReturnCode = 0;
+        if(!Files) ReturnCode = -22;
+        for(size_t i = 0; !ReturnCode && i < RootEntries.size(); i++) {
+            FAT::DirectoryEntry_t *Entry = &RootEntries[i];
+            if(Entry->Name[0] == FAT::N_END) break;
+            if(Entry->Name[0] == FAT::N_ENTRYFREE || (Entry->Attributes & (FAT::A_VOLUME_NAME | FAT::A_DIRECTORY))) continue;
+            char HostName[13];
+            if(!FAT::FatName2HostName(Entry->Name, HostName)) {
+                char EntryName[12];
+                memcpy(EntryName, Entry->Name, 11);
+                EntryName[11] = '\0';
+                std::cerr << "SCIM: Warning - Skipping \"" << EntryName << "\" because it can't be a host file name\n";
+                continue;
+            }
+            if(Pattern && fnmatch(Pattern, HostName, FNM_CASEFOLD)) continue;
+
+            char *HostPath = (char *)malloc(strlen(HostDirectory) + strlen(HostName) + 2);
+            if(!HostPath) {
+                ReturnCode = -22;
+                break;
+            }
+            sprintf(HostPath, "%s/%s", HostDirectory, HostName);
+            int FileDescriptor = open(HostPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(FileDescriptor < 0) {
+                std::cerr << "SCIM: Error - Could not create \"" << HostPath << "\"\n";
+                free(HostPath);
+                ReturnCode = -20;
+                break;
+            }
+            Files[FileCount].HostPath = HostPath;
+            Files[FileCount].FileDescriptor = FileDescriptor;
+            FileCount++;
+
+            // the last extent is cut off at the end of the file
+            scim::qword Remaining = Entry->Size, FileOffset = 0;
+            FAT::Disk::ExtentIterator Extents(FileSystem, FileSystem->FirstCluster(Entry));
+            FAT::Extent_t Extent;
+            while(!ReturnCode && Remaining && Extents.Next(&Extent)) {
+                scim::qword ImageOffset = FileSystem->ClusterOffset(Extent.FirstCluster);
+                size_t ExtentBytes = scim::min((size_t)Extent.Length * ClusterBytes, Remaining);
+                for(size_t Done = 0; Done < ExtentBytes;) {
+                    if(PieceCount == PieceCapacity) {
+                        PieceCapacity = PieceCapacity ? PieceCapacity * 2 : 256;
+                        Piece_t *Resized = (Piece_t *)realloc(Pieces, PieceCapacity * sizeof(Piece_t));
+                        if(!Resized) {
+                            ReturnCode = -22;
+                            break;
+                        }
+                        Pieces = Resized;
+                    }
+                    Pieces[PieceCount].ImageOffset = ImageOffset + Done;
+                    Pieces[PieceCount].FileOffset = FileOffset;
+                    Pieces[PieceCount].Length = scim::min(FAT::MAX_TRANSFER_SIZE, ExtentBytes - Done);
+                    Pieces[PieceCount].File = FileCount - 1;
+                    Done += Pieces[PieceCount].Length;
+                    FileOffset += Pieces[PieceCount].Length;
+                    PieceCount++;
+                }
+                Remaining -= ExtentBytes;
+            }
+            if(!ReturnCode && (Remaining || Extents.Error)) {
+                std::cerr << "SCIM: Error - \"" << HostName << "\" has a broken cluster chain\n";
+                ReturnCode = -31;
+            }
+        }
+
+        // sorting the pieces by where they are on the disk image means it is read in one forward sweep, and pieces that follow on
+        // from each other can be merged into one transfer even if they belong to different files
+        Batch_t *Batches = NULL;
+        size_t BatchCount = 0;
+        if(!ReturnCode && PieceCount) {
+            qsort(Pieces, PieceCount, sizeof(Piece_t), [](const void *a, const void *b) {
+                scim::qword OffsetA = ((const Piece_t *)a)->ImageOffset, OffsetB = ((const Piece_t *)b)->ImageOffset;
+                return OffsetA < OffsetB ? -1 : OffsetA > OffsetB ? 1 : 0;
+            });
+            Batches = (Batch_t *)malloc(PieceCount * sizeof(Batch_t));
+            if(!Batches) ReturnCode = -22;
+            for(size_t i = 0; !ReturnCode && i < PieceCount; i++) {
+                Batch_t *Last = BatchCount ? &Batches[BatchCount - 1] : NULL;
+                if(Last && Last->ImageOffset + Last->Length == Pieces[i].ImageOffset && Last->Length + Pieces[i].Length <= FAT::MAX_TRANSFER_SIZE) {
+                    Last->PieceCount++;
+                    Last->Length += Pieces[i].Length;
+                    continue;
+                }
+                Batches[BatchCount].FirstPiece = i;
+                Batches[BatchCount].PieceCount = 1;
+                Batches[BatchCount].ImageOffset = Pieces[i].ImageOffset;
+                Batches[BatchCount].Length = Pieces[i].Length;
+                BatchCount++;
+            }
+        }
+
+        // data phase: each batch is read once and its pieces are written to their host files in parallel
+        if(!ReturnCode && BatchCount) {
+            SCIM_TIME_DETAIL(P_DATA_COPY, "Extract");
+            if(!ThreadCount) ThreadCount = std::thread::hardware_concurrency();
+            if(!ThreadCount) ThreadCount = 1;
+            if(ThreadCount > BatchCount) ThreadCount = BatchCount;
+
+            std::atomic<size_t> NextBatch(0);
+            std::atomic<bool> Failed(false);
+            std::thread *Workers = new std::thread[ThreadCount];
+            for(unsigned int i = 0; i < ThreadCount; i++)
+                Workers[i] = std::thread(Worker, ImageDevice, Batches, BatchCount, Pieces, Files, &NextBatch, &Failed);
+            for(unsigned int i = 0; i < ThreadCount; i++)
+                Workers[i].join();
+            delete[] Workers;
+            if(Failed) ReturnCode = -24;
+        }
+
+        for(size_t i = 0; i < FileCount; i++) {
+            if(close(Files[i].FileDescriptor) < 0 && !ReturnCode) {
+                std::cerr << "SCIM: Error - Could not write \"" << Files[i].HostPath << "\"\n";
+                ReturnCode = -24;
+            }
+            free(Files[i].HostPath);
+        }
+        free(Files);
+        free(Pieces);
+        free(Batches);
+        return ReturnCode;
+    }
+
+}                           // contains the planner and worker pool for extract mode
@@ -2,10 +2,10 @@
 //
 // utilites and functions for FAT formatted disks
 // This file was written as part of the Sawcon Image Manipulator
-// This version of the header was written for SCIM Alpha 1.3
+// This version of the header was written for SCIM Alpha 1.4
 //
 // Written: Sunday 13th August 2023
-// Last Updated: Sunday 17th September 2023
+// Last Updated: Saturday 17th October 2026
 //
 // Written by Gabriel Jickells
 
@@ -49,7 +49,7 @@ namespace FAT {
     enum offsets {
         BPB_OFFSET = 0,
         EBPB_OFFSET = 36,
-    } offsets;
+    };
 
     typedef struct DirectoryEntry_t {
         char Name[11];                                  // stored in "NAME    EXT" format
@@ -81,13 +81,61 @@ namespace FAT {
         A_VOLUME_NAME = 0b00001000,                     // means the entry specifies the name of the disk
         A_DIRECTORY =   0b00010000,                     // means the entry is a sub-directory
         A_ARCHIVE =     0b00100000,                     // means the entry is a file
+        A_LONG_NAME =   0b00001111,                     // every attribute up to A_VOLUME_NAME at once marks part of a long file name rather than a file
     };
 
-    scim::word localtime2FatTime(tm *LocalTime) {
+    /// @brief converts a host file name such as "stage2.bin" into a directory entry name in "NAME    EXT" format
+    /// @param HostName host file name without any directories in it
+    /// @param NameOut where the 11 character name is stored. Must have space for 12 characters including the null terminator
+    /// @return true on success, false if the name doesn't fit in 8.3 format or uses characters FAT doesn't allow
+    inline bool HostName2FatName(const char *HostName, char *NameOut) {
+        memset(NameOut, ' ', 11);
+        NameOut[11] = '\0';
+        const char *Extension = strrchr(HostName, '.');
+        // names like ".config" don't have a base name so the dot is treated as part of the name, which then gets rejected
+        if(Extension == HostName) Extension = NULL;
+        size_t BaseLength = Extension ? (size_t)(Extension - HostName) : strlen(HostName);
+        size_t ExtensionLength = Extension ? strlen(Extension + 1) : 0;
+        if(!BaseLength || BaseLength > 8 || ExtensionLength > 3) return false;
+        for(size_t i = 0; i < BaseLength + ExtensionLength; i++) {
+            char Character = i < BaseLength ? HostName[i] : Extension[1 + i - BaseLength];
+            if((unsigned char)Character < 0x20 || strchr("\"*+,./:;<=>?[\\]| ", Character)) return false;
+            Character = toupper((unsigned char)Character);
+            if(i < BaseLength) NameOut[i] = Character;
+            else NameOut[8 + i - BaseLength] = Character;
+        }
+        // 0xe5 at the start of a name marks a free entry so it is stored as 0x05 instead
+        if(NameOut[0] == FAT::N_ENTRYFREE) NameOut[0] = FAT::N_SIGMALOW;
+        return true;
+    }
+
+    /// @brief converts a directory entry name in "NAME    EXT" format into a host file name such as "STAGE2.BIN"
+    /// @param Name 11 character name from a directory entry
+    /// @param HostNameOut where the host name is stored. Must have space for 13 characters including the null terminator
+    /// @return true on success, false if the name has a character in it that can't be in a host file name
+    inline bool FatName2HostName(const char *Name, char *HostNameOut) {
+        size_t Length = 0;
+        for(size_t i = 0; i < 11; i++) {
+            if(i == 8) {
+                // names without an extension don't get a dot
+                if(!memcmp(Name + 8, "   ", 3)) break;
+                HostNameOut[Length++] = '.';
+            }
+            if(Name[i] == ' ') continue;
+            if(!Name[i] || Name[i] == '/') return false;
+            HostNameOut[Length++] = Name[i];
+        }
+        HostNameOut[Length] = '\0';
+        // 0x05 at the start of a name is really 0xe5
+        if(HostNameOut[0] == FAT::N_SIGMALOW) HostNameOut[0] = (char)0xe5;
+        return Length && HostNameOut[0] != '.';
+    }
+
+    inline scim::word localtime2FatTime(tm *LocalTime) {
         return (LocalTime->tm_hour << 11) | (LocalTime->tm_min << 5) | (LocalTime->tm_sec >> 1);
     }
 
-    scim::word localtime2FatDate(tm *LocalTime) {
+    inline scim::word localtime2FatDate(tm *LocalTime) {
         // tm_year starts at 1900 but FAT year starts at 1980
         // tm_mon starts at 0 but FAT month starts at 1
         return ((LocalTime->tm_year - 80) << 9) | ((LocalTime->tm_mon + 1) << 5) | (LocalTime->tm_mday);
@@ -96,13 +144,13 @@ namespace FAT {
 }                           // contains FAT information standard for FAT12/16/32. Shouldn't be used for exFAT or vFAT
 
 namespace FAT12 {
-    
+
     enum ClusterInfo {
         FIRST_AVAILABLE_CLUSTER = 0x02,                 // cluster numbers start at 2
         BAD_CLUSTER = 0xff7,
         LAST_CLUSTER = 0xff8,
-    } ClusterInfo;          // some cluster numbers are reserved for different purposes than indexing data on a disk
-    
+    };                      // some cluster numbers are reserved for different purposes than indexing data on a disk
+
     typedef struct ExtendedBiosParameterBlock_t {
         scim::byte DriveNumber;
         scim::byte _reserved;                           // used for windows NT flags. Not that important for a generic driver but should probably be kept in mind
@@ -112,312 +160,2512 @@ namespace FAT12 {
         char SystemID[8];                               // usually contains "FAT12   " but this isn't standard so shouldn't be used for anything driver related
     } __attribute__((packed)) ExtendedBiosParameterBlock_t; // __attribute__((packed)) tells the compiler not to add any padding bytes. Usually this is done so null terminated arrays like strings end where they're supposed to. This is not the case in the BPB where every byte counts
 
+    /// @brief describes 12 bit FAT entries to the FAT::Disk templates so the entry size and markers are known at compile time
+    struct Width {
+        static constexpr scim::dword BITS = 12;
+        static constexpr scim::dword BAD = BAD_CLUSTER;
+        static constexpr scim::dword END = LAST_CLUSTER;
+
+        static scim::dword Get(const scim::byte *Table, scim::dword Cluster) {
+            // computers don't natively support uint12 arrays so some bit fiddling is required to get the right value
+            scim::word Packed = Table[Cluster * 3 / 2] | (Table[Cluster * 3 / 2 + 1] << 8);
+            return (Cluster & 1) ? Packed >> 4 : Packed & 0xFFF;
+        }
+
+        // two entries share the byte in the middle so the nibble that belongs to the neighbouring entry is kept
+        static void Set(scim::byte *Table, scim::dword Cluster, scim::dword Value) {
+            scim::byte *Packed = Table + Cluster * 3 / 2;
+            if(Cluster & 1) {
+                Packed[0] = (Packed[0] & 0x0F) | ((Value & 0x00F) << 4);
+                Packed[1] = Value >> 4;
+            }
+            else {
+                Packed[0] = Value & 0xFF;
+                Packed[1] = (Packed[1] & 0xF0) | ((Value >> 8) & 0x0F);
+            }
+        }
+    };
+
+}                           // contains FAT and cluster information exclusive to FAT12
+
+namespace FAT16 {
+
+    enum ClusterInfo {
+        BAD_CLUSTER = 0xfff7,
+        LAST_CLUSTER = 0xfff8,
+    };
+
+    // FAT16 uses the same EBPB as FAT12
+
+    /// @brief describes 16 bit FAT entries to the FAT::Disk templates
+    struct Width {
+        static constexpr scim::dword BITS = 16;
+        static constexpr scim::dword BAD = BAD_CLUSTER;
+        static constexpr scim::dword END = LAST_CLUSTER;
+
+        static scim::dword Get(const scim::byte *Table, scim::dword Cluster) {
+            scim::word Value;
+            memcpy(&Value, Table + Cluster * 2, sizeof(Value));
+            return Value;
+        }
+
+        static void Set(scim::byte *Table, scim::dword Cluster, scim::dword Value) {
+            scim::word Packed = Value;
+            memcpy(Table + Cluster * 2, &Packed, sizeof(Packed));
+        }
+    };
+
+}                           // contains cluster information exclusive to FAT16
+
+namespace FAT32 {
+
+    enum ClusterInfo {
+        BAD_CLUSTER = 0x0ffffff7,
+        LAST_CLUSTER = 0x0ffffff8,
+        CLUSTER_MASK = 0x0fffffff,                      // FAT32 entries are really 28 bits. The top 4 bits are reserved and have to be kept as they are
+    };
+
+    enum FATFlags {
+        F_ACTIVE_FAT = 0x000f,                          // which FAT is in use when mirroring is turned off
+        F_NO_MIRROR = 0x0080,                           // set if only the active FAT is kept up to date
+    };
+
+    typedef struct ExtendedBiosParameterBlock_t {
+        scim::dword SectorsPerFAT;                      // used instead of BPB.SectorsPerFAT, which is always 0 on FAT32
+        scim::word Flags;                               // FATFlags
+        scim::word Version;                             // should be 0
+        scim::dword RootCluster;                        // first cluster of the root directory. On FAT32 the root directory is a cluster chain like any other file
+        scim::word FSInfoSector;                        // LBA of the FSInfo sector, which keeps track of how many clusters are free
+        scim::word BackupBootSector;                    // LBA of a copy of the boot sector
+        scim::byte _reserved[12];
+        scim::byte DriveNumber;
+        scim::byte _reservedNT;                         // used for windows NT flags
+        scim::byte Signature;                           // must be either 0x28 or 0x29
+        scim::byte SerialID[4];
+        char VolumeLabel[11];
+        char SystemID[8];                               // usually contains "FAT32   " but this isn't standard either
+    } __attribute__((packed)) ExtendedBiosParameterBlock_t;
+
+    typedef struct FSInfo_t {
+        scim::dword LeadSignature;                      // FSINFO_LEAD_SIGNATURE
+        scim::byte _reserved[480];
+        scim::dword StructSignature;                    // FSINFO_STRUCT_SIGNATURE
+        scim::dword FreeCount;                          // number of free clusters. 0xffffffff if it isn't known
+        scim::dword NextFree;                           // where drivers should start looking for free clusters. 0xffffffff if it isn't known
+        scim::byte _reserved2[12];
+        scim::dword TrailSignature;                     // FSINFO_TRAIL_SIGNATURE
+    } __attribute__((packed)) FSInfo_t;
+
+    enum FSInfoSignatures {
+        FSINFO_LEAD_SIGNATURE = 0x41615252,
+        FSINFO_STRUCT_SIGNATURE = 0x61417272,
+        FSINFO_TRAIL_SIGNATURE = 0xaa550000,
+    };
+
+    /// @brief describes 32 bit FAT entries to the FAT::Disk templates
+    struct Width {
+        static constexpr scim::dword BITS = 32;
+        static constexpr scim::dword BAD = BAD_CLUSTER;
+        static constexpr scim::dword END = LAST_CLUSTER;
+
+        static scim::dword Get(const scim::byte *Table, scim::dword Cluster) {
+            scim::dword Value;
+            memcpy(&Value, Table + Cluster * 4, sizeof(Value));
+            return Value & CLUSTER_MASK;
+        }
+
+        static void Set(scim::byte *Table, scim::dword Cluster, scim::dword Value) {
+            scim::dword Packed;
+            memcpy(&Packed, Table + Cluster * 4, sizeof(Packed));
+            Packed = (Packed & ~(scim::dword)CLUSTER_MASK) | (Value & CLUSTER_MASK);
+            memcpy(Table + Cluster * 4, &Packed, sizeof(Packed));
+        }
+    };
+
+}                           // contains FAT and cluster information exclusive to FAT32
+
+namespace FAT {
+
+    enum FAT_TYPE {
+        T_FAT12 = 12,
+        T_FAT16 = 16,
+        T_FAT32 = 32,
+    };
+
+    // the type of FAT is decided by how many data clusters the disk has and nothing else. These are the limits Microsoft uses
+    enum TypeLimits {
+        FAT12_MAX_CLUSTERS = 4085,                      // anything with fewer data clusters than this is FAT12
+        FAT16_MAX_CLUSTERS = 65525,                     // anything else with fewer data clusters than this is FAT16
+    };
+
+    // ClusterTable uses the same markers whatever the type of FAT so the code that follows chains doesn't need to know the type
+    enum ClusterInfo {
+        FIRST_AVAILABLE_CLUSTER = 0x02,                 // cluster numbers start at 2
+        CHAIN_BAD = FAT32::BAD_CLUSTER,                 // any width's bad cluster marker is decoded into this
+        CHAIN_END = FAT32::LAST_CLUSTER,                // any width's end of chain markers are decoded into this
+    };
+
     typedef struct BootRecord_t {
         FAT::BiosParameterBlock_t BPB;
-        ExtendedBiosParameterBlock_t EBPB;
+        union {
+            FAT12::ExtendedBiosParameterBlock_t EBPB;   // FAT12 and FAT16
+            FAT32::ExtendedBiosParameterBlock_t EBPB32; // FAT32
+        } __attribute__((packed));
     } __attribute__((packed)) BootRecord_t;
 
+    typedef struct Extent_t {
+        scim::dword FirstCluster;                       // first cluster of the run
+        scim::dword Length;                             // number of consecutive clusters in the run, including FirstCluster
+    } Extent_t;             // a run of physically consecutive clusters in a cluster chain. These can be read or written in a single transfer
+
+    typedef struct Fragmentation_t {
+        scim::dword Files;                              // entries in every directory that aren't sub-directories and have a cluster chain
+        scim::dword FragmentedFiles;                    // files whose chain is split into more than one extent
+        scim::dword Extents;                            // extents in every file chain added together
+        scim::dword FreeClusters;
+        scim::dword FreeRuns;                           // runs of consecutive free clusters
+        scim::dword LargestFreeRun;                     // length of the longest run of free clusters
+    } Fragmentation_t;      // how scattered the files and free space on a disk are
+
+    enum TransferInfo {
+        MAX_TRANSFER_SIZE = 0x100000,                   // largest bounce buffer extract uses when an extent can't be mapped (1MiB)
+        STREAM_BUFFER_SIZE = 0x10000,                   // size of the stack buffer the Disk uses to move file data when the device can't be mapped (64KiB)
+    };
+
+    enum CHECK_PROBLEMS {
+        CP_CROSS_LINK = 0,                              // a chain runs into a cluster that belongs to an entry that was checked earlier
+        CP_LOOP,                                        // a chain runs back into one of its own clusters
+        CP_BAD_REFERENCE,                               // a chain runs into a free cluster, a bad cluster, or a cluster number outside of the FAT
+        CP_SIZE_MISMATCH,                               // a file has more or fewer clusters than its size needs
+        CP_LOST_CHAIN,                                  // a chain of used clusters that no entry points to
+        CP_FAT_MISMATCH,                                // a FAT copy doesn't match the FAT that gets read
+        CP_COUNT,
+    };
+
+    enum CheckInfo {
+        MAX_DIRECTORY_DEPTH = 128,                      // paths can't be longer than 260 characters so no real disk has sub-directories nested deeper than this
+        LOST_OWNER = 0xFFFFFFFF,                        // owner given to lost clusters once their chain has been reported. Chain numbers never get this high
+    };
+
+    enum DirectoryInfo {
+        NO_ENTRY = 0xFFFFFFFF,                          // entry index returned when a name isn't in a directory
+        MAX_PATH_COMPONENT = 12,                        // longest host name that fits in 8.3 format, such as "KERNEL.BIN"
+    };
+
+    typedef struct Problem_t {
+        CHECK_PROBLEMS Type;
+        char Name[12];                                  // entry the problem was found in as a NUL terminated "NAME    EXT". Empty for lost chains and FAT copies
+        scim::dword Cluster;                            // cluster the problem was found at, the first cluster of a lost chain, or the FAT copy number for CP_FAT_MISMATCH
+        scim::dword Length;                             // clusters in the chain before the problem, or the number of sectors that differ for CP_FAT_MISMATCH
+        scim::qword Size;                               // size in the entry for CP_SIZE_MISMATCH
+    } Problem_t;
+
+    typedef struct CheckReport_t {
+        scim::dword Files;
+        scim::dword Directories;                        // sub-directories. The root directory isn't counted
+        scim::dword UsedClusters;                       // clusters that belong to an entry or a FAT32 root directory
+        scim::dword LostClusters;
+        scim::dword BadClusters;                        // clusters marked as bad in the FAT. These are only a problem if a chain runs into one
+        scim::dword Counts[CP_COUNT];                   // number of problems of each type
+        Problem_t *Problems;                            // every problem in the order it was found. Must be freed by the caller
+        scim::dword ProblemCount;
+    } CheckReport_t;        // everything FAT::Disk.Check found
+
+}                           // contains the types shared by FAT12, FAT16, and FAT32
+
+// the geometry profiles only need the definitions above, and Disk takes the layout of a disk formatted with one of them from
+// the table worked out at compile time
+#include "geometry.hpp"
+
+namespace FAT {
+
+    /// @brief driver for FAT12, FAT16, and FAT32 disks. The FAT is decoded into ClusterTable by a loop that is specialised for
+    /// each entry width at compile time, so everything after that works the same way on every type of FAT. A Disk owns its
+    /// metadata, so it can be moved but not copied, and everything it holds is freed when it is destroyed
     class Disk {
-        
+
         public:
 
             BootRecord_t FS_Info;
-            FAT::DirectoryEntry_t *RootDirectory = NULL;
-            scim::byte *FileAllocationTable = NULL;
+            FAT_TYPE Type = T_FAT12;                            // picked by Initialise from the layout in the BPB
 
-            /// @brief Sets the FS_Info, RootDirectory, and FileAllocationTable variables to 
-            /// values suited for handling the disk image
-            /// @param Image disk image to set the values for
-            /// @return true on success, false on failure
-            bool Initialise(FILE *Image) {
+            Disk() = default;
 
-                // read the bootrecord and store its values in FS_Info
-                if(!ReadBootRecord(Image)) return false;
+            Disk(const Disk &) = delete;
+            Disk &operator=(const Disk &) = delete;
 
-                // read the root directory and store a pointer to its data in RootDirectory
-                if(!ReadRootDirectory(Image)) return false;
+            /// @brief take over everything another disk has open. The other disk is left as if Clean had been called
+            Disk(Disk &&Other) noexcept {
+                Adopt(&Other);
+            }
 
-                // read the FAT and store a pointer to its data in FileAllocationTable
-                if(!ReadFAT(Image)) return false;
+            Disk &operator=(Disk &&Other) noexcept {
+                if(this != &Other) {
+                    Clean();
+                    Adopt(&Other);
+                }
+                return *this;
+            }
 
-                return true;
+            ~Disk() {
+                Clean();
+            }
+
+            /// @brief Sets up FS_Info, the root directory, and the FAT for handling the disk image. Everything whose size is known
+            /// from the BPB is put in one arena. If the device can be mapped, the root directory and FAT point straight into the
+            /// image instead of into the arena. Anything already open is cleaned up first
+            /// @param ImageDevice disk image to set the values for. Must stay open until Clean is called
+            /// @return true on success, false on failure, in which case nothing is left allocated
+            bool Initialise(Device::BlockDevice *ImageDevice) {
+
+                Clean();
+                if(!ImageDevice) return false;
+                Image = ImageDevice;
+
+                // read the bootrecord and store its values in FS_Info, then work out where everything is on the disk and which
+                // type of FAT it uses. That is everything the arena needs to be sized
+                bool Success = ReadBootRecord() && ReadLayout() && AllocateArena();
+
+                // read the FAT and the root directory. The root directory comes after the FAT because a FAT32 root directory is a cluster chain
+                Success = Success && ReadFAT() && ReadRootDirectory();
+
+                // the root directory is indexed straight away since almost everything looks something up in it
+                if(Success) {
+                    Root.Entries = RootDirectory;
+                    Root.EntryCount = RootEntryCount;
+                    Success = BuildIndex(&Root);
+                }
+
+                if(!Success) Clean();
+                return Success;
 
             }
 
-            /// @brief free any memory that was allocated by Disk functions
+            /// @brief free any memory that was allocated by Disk functions. Safe to call more than once
             void Clean() {
-                free(RootDirectory);
-                free(FileAllocationTable);
+                // mapped metadata belongs to the device and anything in the arena goes with it, so neither is freed on its own
+                if(!RootDirectoryMapped) Release(RootDirectory);
+                if(!FATMapped) Release(FileAllocationTable);
+                Release(DirtyRootSectors);
+                free(RootDirectoryClusters);
+                while(Directories) UnloadDirectory(Directories);
+                FreeIndex(&Root);
+                free(Arena);
+                Forget();
             }
 
-            /// @brief Finds the meta data for a file entry in the root directory. Requires the root directory to have been read
-            /// @param Name name of the file entry in "NAME    EXT" format
-            /// @return pointer to the file entry data on success, NULL on failure
+            /// @return every entry slot in the root directory, including free ones and ones after the N_END entry. Only valid until
+            /// the next entry is added to the root directory, because a FAT32 root directory can move when it grows
+            std::span<FAT::DirectoryEntry_t> RootEntries() {
+                return std::span<FAT::DirectoryEntry_t>(RootDirectory, RootDirectory ? RootEntryCount : 0);
+            }
+
+            /// @return the packed FAT that gets read, exactly as it is on the disk image. Only valid until Clean is called
+            std::span<scim::byte> AllocationTable() {
+                return std::span<scim::byte>(FileAllocationTable, FileAllocationTable ? (size_t)FATSectors * FS_Info.BPB.BytesPerSector : 0);
+            }
+
+            /// @brief hold back every root directory and FAT write until Commit is called so a group of operations either all reach
+            /// the disk image or none of them do. File data is still written straight away, but only into clusters that were free
+            /// before the transaction started. Requires the disk to have been initialised
+            /// @return true on success, false on failure
+            bool BeginTransaction() {
+                if(InTransaction || !RootDirectory || !FileAllocationTable) return false;
+                // changes to mapped metadata would go straight into the image so the transaction works on private copies instead
+                if(RootDirectoryMapped) {
+                    FAT::DirectoryEntry_t *RootDirectoryCopy = (FAT::DirectoryEntry_t *)malloc(RootDirectorySize());
+                    if(!RootDirectoryCopy) return false;
+                    memcpy(RootDirectoryCopy, RootDirectory, RootDirectorySize());
+                    RootDirectory = RootDirectoryCopy;
+                    Root.Entries = RootDirectory;
+                    RootDirectoryMapped = false;
+                }
+                if(FATMapped) {
+                    scim::byte *FATCopy = (scim::byte *)malloc((size_t)FATSectors * FS_Info.BPB.BytesPerSector);
+                    if(!FATCopy) return false;
+                    memcpy(FATCopy, FileAllocationTable, (size_t)FATSectors * FS_Info.BPB.BytesPerSector);
+                    FileAllocationTable = FATCopy;
+                    FATMapped = false;
+                }
+                InTransaction = true;
+                return true;
+            }
+
+            /// @brief write every root directory and FAT sector that changed during the transaction to the disk image in one go, ending
+            /// the transaction started by BeginTransaction. To throw a transaction away, call Clean without calling Commit
+            /// @return true on success, false on failure
+            bool Commit() {
+                if(!InTransaction) return false;
+                InTransaction = false;
+                // once the FAT on the disk image agrees, the clusters that were freed during the transaction can be reused.
+                // They are marked before the FAT is written so the free count in the FAT32 FSInfo sector includes them
+                for(scim::dword Cluster = FIRST_AVAILABLE_CLUSTER; Cluster < ClusterCount; Cluster++)
+                    if(!ClusterTable[Cluster]) FreeClusters[Cluster / 64] |= 1ULL << (Cluster % 64);
+                AllocationCursor = FIRST_AVAILABLE_CLUSTER;
+                return Flush();
+            }
+
+            /// @brief get a pointer to the data of a cluster without copying it. Only works if the device supports mapping
+            /// @param Cluster FAT cluster number
+            /// @return pointer to the cluster data on success, NULL if the device can't be mapped or the cluster is invalid
+            scim::byte *MapCluster(scim::dword Cluster) {
+                scim::dword LBA = Cluster2LBA(Cluster);
+                if(!LBA) return NULL;
+                return MapSectors(LBA, FS_Info.BPB.SectorsPerCluster);
+            }
+
+            /// @brief get where a cluster is on the disk image so it can be read without going through the Disk
+            /// @param Cluster FAT cluster number
+            /// @return byte offset of the cluster on success, 0 if the cluster is invalid
+            scim::qword ClusterOffset(scim::dword Cluster) {
+                return SectorOffset(Cluster2LBA(Cluster));
+            }
+
+            /// @brief get where an entry is on the disk image so it can be patched without going through the Disk
+            /// @param Entry entry in the root directory or a loaded sub-directory, such as one returned by FindEntry
+            /// @return byte offset of the entry on success, 0 if it isn't in a loaded directory
+            scim::qword EntryOffset(const FAT::DirectoryEntry_t *Entry) {
+                Directory_t *Directory;
+                scim::dword Index;
+                if(!OwnerOf(Entry, &Directory, &Index)) return 0;
+                size_t ByteOffset = (size_t)Index * sizeof(FAT::DirectoryEntry_t);
+                return DirectorySectorOffset(Directory, ByteOffset / FS_Info.BPB.BytesPerSector) + ByteOffset % FS_Info.BPB.BytesPerSector;
+            }
+
+            /// @brief get the first cluster of a file entry. FirstClusterHigh is only part of the cluster number on FAT32
+            /// @param Entry file entry to get the first cluster of
+            /// @return first cluster of the entry, 0 if the entry is empty
+            scim::dword FirstCluster(const FAT::DirectoryEntry_t *Entry) {
+                scim::dword Cluster = Entry->FirstClusterLow;
+                if(Type == T_FAT32) Cluster |= (scim::dword)Entry->FirstClusterHigh << 16;
+                return Cluster;
+            }
+
+            /// @brief walks a cluster chain one extent at a time, merging runs of consecutive clusters together
+            class ExtentIterator {
+
+                public:
+
+                    bool Error = false;                 // set if the chain is broken, loops, or points outside of the FAT
+
+                    /// @param FileSystem disk that the chain belongs to. Must have been initialised
+                    /// @param FirstCluster first cluster of the chain. 0 is treated as an empty chain
+                    ExtentIterator(Disk *FileSystem, scim::dword FirstCluster) : FileSystem(FileSystem), CurrentCluster(FirstCluster) {}
+
+                    /// @brief get the next extent in the chain
+                    /// @param ExtentOut where the extent is stored
+                    /// @return true if an extent was found, false at the end of the chain or if Error was set
+                    bool Next(Extent_t *ExtentOut) {
+                        SCIM_TIME(P_CHAIN_WALK);
+                        if(Error || !CurrentCluster || CurrentCluster >= CHAIN_END) return false;
+                        if(!FileSystem->IsDataCluster(CurrentCluster)) {
+                            Error = true;
+                            return false;
+                        }
+                        ExtentOut->FirstCluster = CurrentCluster;
+                        ExtentOut->Length = 1;
+                        // keep going while the next cluster in the chain is also the next cluster on the disk. A corrupt FAT can point
+                        // the last cluster at ClusterCount, which isn't in the table, so that gets caught by IsDataCluster on the next call
+                        while(CurrentCluster + 1 < FileSystem->ClusterCount && FileSystem->ClusterTable[CurrentCluster] == CurrentCluster + 1) {
+                            CurrentCluster++;
+                            ExtentOut->Length++;
+                        }
+                        CurrentCluster = FileSystem->ClusterTable[CurrentCluster];
+                        // a chain can't be longer than the disk, so anything longer must have a loop in it
+                        ClustersVisited += ExtentOut->Length;
+                        if(ClustersVisited > FileSystem->ClusterCount) {
+                            Error = true;
+                            return false;
+                        }
+                        return true;
+                    }
+
+                private:
+
+                    Disk *FileSystem;
+                    scim::dword CurrentCluster;
+                    scim::dword ClustersVisited = 0;
+
+            };
+
+            /// @brief Finds the meta data for a file entry through the hash index of its directory. Requires the root directory to have been read
+            /// @param Name name of an entry in the root directory in "NAME    EXT" format, or a path such as "/SYS/DRIVERS/KBD.SYS" made of
+            /// host names. Each directory on the way is loaded the first time it is used
+            /// @return pointer to the file entry data on success, NULL on failure. Only valid until the next entry is added to the same directory
             FAT::DirectoryEntry_t *FindEntry(const char *Name) {
-                if(!RootDirectory) return NULL;
-                for(int i = 0; i < FS_Info.BPB.RootDirectoryEntries; i++)
-                    if(!memcmp(Name, RootDirectory[i].Name, 11))
-                        return &RootDirectory[i];
-                return NULL;
+                Directory_t *Directory;
+                char EntryName[12];
+                if(!ResolvePath(Name, &Directory, EntryName)) return NULL;
+                scim::dword Index = IndexFind(Directory, EntryName);
+                if(Index == NO_ENTRY) return NULL;
+                return &Directory->Entries[Index];
             }
- 
+
+            /// @brief get every entry in a directory, loading it first if it hasn't been used yet
+            /// @param Path path of the directory such as "/SYS/DRIVERS". "/" or "" is the root directory
+            /// @return every entry slot the directory has, including free ones and ones after the N_END entry. Empty with a NULL data()
+            /// if the path isn't a directory. Only valid until the next entry is added to it
+            std::span<FAT::DirectoryEntry_t> OpenDirectory(const char *Path) {
+                if(!RootDirectory) return std::span<FAT::DirectoryEntry_t>();
+                Directory_t *Directory = FindDirectory(Path, strlen(Path));
+                if(!Directory) return std::span<FAT::DirectoryEntry_t>();
+                return std::span<FAT::DirectoryEntry_t>(Directory->Entries, Directory->EntryCount);
+            }
+
             /// @brief Reads the entirety of a file on a disk image. Requires FS_Info, RootDirectory, and FileAllocationTable to all have valid values in them
-            /// @param Image disk image to read from
             /// @param FileEntry File meta-data to get the files location on the disk
             /// @param BufferOut Buffer to store the data in, should be malloced before calling the function
             /// @return true on success, false on failure
-            bool ReadEntry(FILE *Image, FAT::DirectoryEntry_t *FileEntry, void *BufferOut) {
+            bool ReadEntry(FAT::DirectoryEntry_t *FileEntry, void *BufferOut) {
+                SCIM_TIME_DETAIL(P_DATA_COPY, "ReadEntry");
                 scim::byte *ByteBufferOut = (scim::byte *)BufferOut;
-                if(!FileAllocationTable) return false;
-                scim::word CurrentCluster = FileEntry->FirstClusterLow & 0xFFF;
-                scim::word CurrentLBA; scim::word FAT_Index;
-                while(CurrentCluster < LAST_CLUSTER) {
-                    if(CurrentCluster == BAD_CLUSTER || CurrentCluster < FIRST_AVAILABLE_CLUSTER) return false;
-                    CurrentLBA = Cluster2LBA(CurrentCluster);
-                    if(!CurrentLBA) return false;
-                    if(!ReadSectors(Image, CurrentLBA, FS_Info.BPB.SectorsPerCluster, ByteBufferOut))
+                if(!ClusterTable) return false;
+                if(FirstCluster(FileEntry) < FIRST_AVAILABLE_CLUSTER) return false;
+                // read each run of consecutive clusters in one go instead of a cluster at a time
+                ExtentIterator Extents(this, FirstCluster(FileEntry));
+                Extent_t Extent;
+                while(Extents.Next(&Extent)) {
+                    if(!ReadSectors(Cluster2LBA(Extent.FirstCluster), Extent.Length * FS_Info.BPB.SectorsPerCluster, ByteBufferOut))
                         return false;
-                    ByteBufferOut += FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
-                    
-                    // calculate the next cluster in the chain
-                    FAT_Index = CurrentCluster * 3 / 2; // CurrentCluster is used as the index for the next cluster number, but CurrentCluster is a byte index but needs to be converted into a uint12 index
-                    // computers don't natively support uint12 arrays so some bit fiddling is required to get the right value
-                    if(CurrentCluster & 1) CurrentCluster = *(scim::word *)(FileAllocationTable + FAT_Index) >> 4;
-                    else CurrentCluster = *(scim::word *)(FileAllocationTable + FAT_Index) & 0xFFF;
+                    SCIM_COUNT(C_BYTES_COPIED, (size_t)Extent.Length * FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster);
+                    ByteBufferOut += (size_t)Extent.Length * FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
                 }
-                return true;
+                return !Extents.Error;
             }
 
-            /// @brief Deletes a file entry on the disk
-            /// @param Image disk image to rid of the file
+            /// @brief Copies a file straight to a host file descriptor an extent at a time. Only a STREAM_BUFFER_SIZE buffer on the stack
+            /// is used no matter how big the file is, and nothing is buffered at all if the device is mapped. The output is trimmed to
+            /// the size in the file entry so it is byte for byte the same as the file that was written
+            /// @param FileEntry File meta-data to get the files location on the disk
+            /// @param OutputFileDescriptor host file descriptor to write the data to
             /// @return true on success, false on failure
-            bool DeleteEntry(FILE *Image, FAT::DirectoryEntry_t *FileEntry) {
-                scim::word CurrentCluster = FileEntry->FirstClusterLow & 0xFFF;
-                scim::word FAT_Index;
-                do {
-                    if(CurrentCluster < FIRST_AVAILABLE_CLUSTER) return false;
-                    // same kind of uint12_t messing from ReadEntry
-                    FAT_Index = CurrentCluster * 3 / 2;
-                    if(CurrentCluster & 1) {
-                        CurrentCluster = *(scim::word *)(FileAllocationTable + FAT_Index) >> 4;
-                        *(scim::word *)(FileAllocationTable + FAT_Index) &= 0x000F;         // the upper 12 bits are used for the cluster number here, leave the low 4 untouched
+            bool StreamEntry(FAT::DirectoryEntry_t *FileEntry, int OutputFileDescriptor) {
+                SCIM_TIME_DETAIL(P_DATA_COPY, "StreamEntry");
+                if(!ClusterTable) return false;
+                scim::qword Remaining = FileEntry->Size;
+                if(!Remaining) return true;
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                scim::byte Buffer[STREAM_BUFFER_SIZE];          // only used if the device can't be mapped
+
+                ExtentIterator Extents(this, FirstCluster(FileEntry));
+                Extent_t Extent;
+                while(Remaining && Extents.Next(&Extent)) {
+                    scim::qword Offset = ClusterOffset(Extent.FirstCluster);
+                    // the last extent is cut off at the end of the file
+                    size_t ExtentBytes = scim::min((size_t)Extent.Length * ClusterBytes, Remaining);
+                    SCIM_COUNT(C_SECTORS_READ, SectorCount(ExtentBytes));
+                    SCIM_COUNT(C_BYTES_COPIED, ExtentBytes);
+
+                    // let the kernel copy the extent to the output if it can, and only copy whatever it couldn't by hand
+                    size_t Copied = Device::KernelCopy(Image->GetFileDescriptor(), Offset, OutputFileDescriptor, Device::CURRENT_POSITION, ExtentBytes);
+                    Offset += Copied;
+                    Remaining -= Copied;
+                    ExtentBytes -= Copied;
+                    if(!ExtentBytes) continue;
+
+                    scim::byte *ExtentData = Image->Map(Offset, ExtentBytes);
+                    if(ExtentData) {
+                        if(!scim::WriteAll(OutputFileDescriptor, ExtentData, ExtentBytes)) break;
                     }
                     else {
-                        CurrentCluster = *(scim::word *)(FileAllocationTable + FAT_Index) & 0xFFF;
-                        *(scim::word *)(FileAllocationTable + FAT_Index) &= 0xF000;         // the lower 12 bits are used for the cluster number here, leave the top 4 untouched
+                        size_t Done = 0;
+                        while(Done < ExtentBytes) {
+                            size_t TransferBytes = scim::min(STREAM_BUFFER_SIZE, ExtentBytes - Done);
+                            if(!Image->Read(Offset + Done, TransferBytes, Buffer)) break;
+                            if(!scim::WriteAll(OutputFileDescriptor, Buffer, TransferBytes)) break;
+                            Done += TransferBytes;
+                        }
+                        if(Done < ExtentBytes) break;
                     }
-                } while(CurrentCluster < LAST_CLUSTER);
+                    Remaining -= ExtentBytes;
+                }
+
+                // if anything is left over then either a transfer failed or the chain is shorter than the file
+                return !Remaining && !Extents.Error;
+            }
 
-                // find the entry again to get a reference to its location in the root directory
-                FAT::DirectoryEntry_t *EntryReference = FindEntry(FileEntry->Name);
-                if(!EntryReference) return false;
+            /// @brief Deletes a file entry on the disk. Sub-directories have to be deleted with RemoveDirectory instead
+            /// @param FileEntry file entry to rid the disk image of
+            /// @return true on success, false on failure
+            bool DeleteEntry(FAT::DirectoryEntry_t *FileEntry) {
+                Directory_t *Directory;
+                scim::dword Index;
+                // copies of an entry don't point into a directory so they are found again by name in the root directory
+                if(!OwnerOf(FileEntry, &Directory, &Index)) {
+                    if(!RootDirectory) return false;
+                    Directory = &Root;
+                    Index = IndexFind(Directory, FileEntry->Name);
+                    if(Index == NO_ENTRY) return false;
+                }
+                FAT::DirectoryEntry_t *EntryReference = &Directory->Entries[Index];
+                if(EntryReference->Attributes & A_DIRECTORY) return false;
 
-                // set the special character in the name to mark it as deleted
-                EntryReference->Name[FAT::I_SPECIALCHAR] = FAT::N_ENTRYFREE;
-                EntryReference->FirstClusterLow = 0;
+                // empty files don't have a cluster chain to free
+                scim::dword CurrentCluster = FirstCluster(EntryReference);
+                scim::dword NextCluster;
+                {
+                    SCIM_TIME(P_CHAIN_WALK);
+                    while(CurrentCluster && CurrentCluster < CHAIN_END) {
+                        if(CurrentCluster < FIRST_AVAILABLE_CLUSTER || CurrentCluster >= ClusterCount) return false;
+                        NextCluster = ClusterTable[CurrentCluster];
+                        SetCluster(CurrentCluster, 0);
+                        CurrentCluster = NextCluster;
+                    }
+                }
 
                 // write the updated entry data and FAT to the disk image
-                if(!WriteEntryData(Image, EntryReference, (EntryReference - RootDirectory) / sizeof(FAT::DirectoryEntry_t))) return false;
-                if(!WriteFAT(Image)) return false;
+                ReleaseSlot(Directory, Index);
+                return Flush();
+            }
 
-                return true;
+            /// @brief Creates a sub-directory holding just its "." and ".." entries
+            /// @param Path path of the new directory such as "/SYS/DRIVERS". Every directory before the last one must already exist
+            /// @return true on success, false on failure or if something with the same name already exists
+            bool MakeDirectory(const char *Path) {
+                Directory_t *Parent;
+                char Name[12];
+                if(!ResolvePath(Path, &Parent, Name) || IndexFind(Parent, Name) != NO_ENTRY) return false;
+
+                scim::dword Cluster;
+                if(!AllocateChain(1, &Cluster)) return false;
+                FAT::DirectoryEntry_t Entry;
+                FillEntry(&Entry, Name, A_DIRECTORY, Cluster, 0);
+
+                // the cluster is written before anything points to it. It was free, so this is safe during a transaction too
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                FAT::DirectoryEntry_t *Contents = (FAT::DirectoryEntry_t *)calloc(1, ClusterBytes);
+                if(!Contents) {
+                    FreeChain(Cluster);
+                    return false;
+                }
+                Contents[0] = Entry;
+                memcpy(Contents[0].Name, ".          ", 11);
+                // ".." uses cluster 0 when the parent is the root directory, even on FAT32
+                Contents[1] = Entry;
+                memcpy(Contents[1].Name, "..         ", 11);
+                SetFirstCluster(&Contents[1], Parent->FirstCluster);
+                SCIM_COUNT(C_SECTORS_WRITTEN, FS_Info.BPB.SectorsPerCluster);
+                bool Written = Image->Write(ClusterOffset(Cluster), ClusterBytes, Contents);
+                free(Contents);
+                scim::dword Index;
+                if(!Written || !TakeSlot(Parent, &Index)) {
+                    FreeChain(Cluster);
+                    return false;
+                }
+                Parent->Entries[Index] = Entry;
+                IndexInsert(Parent, Index);
+                MarkSlotDirty(Parent, Index);
+                return Flush();
             }
 
-            bool CreateEntry(FILE *Image, const char *Name, scim::byte Attributes, FILE *FileData) {
-                if(strlen(Name) != 11) return false;
-                for(int i = 0; i < FS_Info.BPB.RootDirectoryEntries; i++) {
-                    // prevent duplicate entries
-                    if(!memcmp(Name, RootDirectory[i].Name, 11)) return false;
-                    
-                    if(RootDirectory[i].Name[0] == FAT::N_END || RootDirectory[i].Name[0] == FAT::N_ENTRYFREE) {
-                        // get the current time and date
-                        time_t now = time(0);
-                        tm *NowLocal = localtime(&now);
-
-                        // fill the entry data with valid values
-                        strcpy(RootDirectory[i].Name, Name);
-                        RootDirectory[i].Attributes = Attributes;
-                        RootDirectory[i]._reserved = 0;
-                        if(NowLocal->tm_sec & 1) RootDirectory[i].CreationTimeCents = 100;
-                        else RootDirectory[i].CreationTimeCents = 0;
-                        RootDirectory[i].CreationDate = FAT::localtime2FatDate(NowLocal);
-                        RootDirectory[i].AccessedDate = FAT::localtime2FatDate(NowLocal);
-                        RootDirectory[i].CreationTime = FAT::localtime2FatTime(NowLocal);
-                        RootDirectory[i].FirstClusterHigh = 0;
-                        RootDirectory[i].ModificationTime = FAT::localtime2FatTime(NowLocal);
-                        RootDirectory[i].ModificationDate = FAT::localtime2FatDate(NowLocal);
-                        RootDirectory[i].FirstClusterLow = NextFreeCluster();
-                        
-                        // get the size of the file
-                        if(fseek(FileData, 0, SEEK_END) < 0) return false;
-                        RootDirectory[i].Size = ftell(FileData);
-                        
-                        if(!WriteEntryData(Image, &RootDirectory[i], i)) return false;
-
-                        // calculate how many values need to be added to the FAT
-                        size_t FileClusterCount = RootDirectory[i].Size / (FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster);
-                        if(RootDirectory[i].Size % (FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster)) FileClusterCount++;
-
-                        // fill the values in the file allocation table
-                        scim::word FatIndex;
-                        scim::word CurrentCluster = RootDirectory[i].FirstClusterLow;
-                        for(size_t j = 0; j < FileClusterCount; j++) {
-                            FatIndex = CurrentCluster * 3 / 2;
-                            if(j + 1 == FileClusterCount) {
-                                if(CurrentCluster & 1) *(scim::word *)(FileAllocationTable + FatIndex) |= LAST_CLUSTER << 4;
-                                else *(scim::word *)(FileAllocationTable + FatIndex) |= LAST_CLUSTER;
-                                break;
-                            }
-                            if(CurrentCluster & 1) {
-                                // fill the active cluster with a dummy number first so it doesnt get counted as free
-                                *(scim::word *)(FileAllocationTable + FatIndex) |= 0x001 << 4;
-                                CurrentCluster = NextFreeCluster();
-                                // empty the dummy cluster number
-                                *(scim::word *)(FileAllocationTable + FatIndex) &= 0x000f;
-                                *(scim::word *)(FileAllocationTable + FatIndex) |= CurrentCluster << 4;
-                            }
-                            else {
-                                *(scim::word *)(FileAllocationTable + FatIndex) |= 0x001;
-                                CurrentCluster = NextFreeCluster();
-                                *(scim::word *)(FileAllocationTable + FatIndex) &= 0xf000;
-                                *(scim::word *)(FileAllocationTable + FatIndex) |= CurrentCluster;
-                            }
-                        }
+            /// @brief Deletes an empty sub-directory
+            /// @param Path path of the directory such as "/SYS/DRIVERS"
+            /// @return true on success, false on failure or if the directory still has anything in it other than "." and ".."
+            bool RemoveDirectory(const char *Path) {
+                Directory_t *Parent;
+                char Name[12];
+                if(!ResolvePath(Path, &Parent, Name)) return false;
+                scim::dword Index = IndexFind(Parent, Name);
+                if(Index == NO_ENTRY || !(Parent->Entries[Index].Attributes & A_DIRECTORY)) return false;
+                Directory_t *Directory = LoadDirectory(FirstCluster(&Parent->Entries[Index]));
+                if(!Directory || Directory == &Root) return false;
+                for(scim::dword i = 0; i < Directory->EndIndex; i++) {
+                    const char *EntryName = Directory->Entries[i].Name;
+                    if(EntryName[0] == N_ENTRYFREE || !memcmp(EntryName, ".          ", 11) || !memcmp(EntryName, "..         ", 11)) continue;
+                    return false;
+                }
+
+                // nothing will be written to the directory's clusters again, so anything it still had waiting to be flushed is thrown away
+                FreeChain(Directory->FirstCluster);
+                UnloadDirectory(Directory);
+                ReleaseSlot(Parent, Index);
+                return Flush();
+            }
 
-                        if(!WriteFAT(Image)) return false;
+            /// @brief Creates a file entry and copies the contents of a host file into it
+            /// @param Name name of the file entry in "NAME    EXT" format, or a path like the ones FindEntry takes
+            /// @param Attributes FAT::FILE_ATTRIBUTES of the new entry
+            /// @param FileData host file to copy the data from
+            /// @return true on success, false on failure
+            bool CreateEntry(const char *Name, scim::byte Attributes, FILE *FileData) {
+                // get the size of the file
+                if(fseeko(FileData, 0, SEEK_END) < 0) return false;
+                off_t FileSize = ftello(FileData);
+                if(FileSize < 0) return false;
 
-                        // now the location of the data is known on the disk, all that is left to do is fill all of that data
-                        CurrentCluster = RootDirectory[i].FirstClusterLow;
-                        scim::byte *FileDataBuffer = (scim::byte *)malloc(FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster);
-                        for(int j = 0; CurrentCluster < LAST_CLUSTER; j++) {
-                            FatIndex = CurrentCluster * 3 / 2;
+                FAT::DirectoryEntry_t *Entry = AddEntry(Name, Attributes, FileSize);
+                if(!Entry) return false;
 
-                            memset(FileDataBuffer, 0, FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster);
-                            if(fseek(FileData, j * FS_Info.BPB.SectorsPerCluster * FS_Info.BPB.BytesPerSector, SEEK_SET) < 0) return false;
-                            if(!fread(FileDataBuffer, scim::min(FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster, ftell(FileData) - RootDirectory[i].Size), 1, FileData)) {
-                                if(ferror(FileData)) return false;
-                            }
-                            
-                            if(fseek(Image, Cluster2LBA(CurrentCluster) * FS_Info.BPB.BytesPerSector, SEEK_SET) < 0) return false;
-                            if(!fwrite(FileDataBuffer, FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster, 1, Image)) return false;
+                // now the location of the data is known on the disk, all that is left to do is fill all of that data
+                return WriteChain(FirstCluster(Entry), FileData, FileSize);
+            }
 
-                            if(CurrentCluster & 1) CurrentCluster = *(scim::word *)(FileAllocationTable + FatIndex) >> 4;
-                            else CurrentCluster = *(scim::word *)(FileAllocationTable + FatIndex) & 0xFFF;
+            /// @brief Creates a file entry and allocates its cluster chain without writing any file data. The data can be filled in
+            /// later with WriteChain. A full FAT32 root directory or sub-directory is given another cluster
+            /// @param Name name of the file entry in "NAME    EXT" format, or a path like the ones FindEntry takes
+            /// @param Attributes FAT::FILE_ATTRIBUTES of the new entry
+            /// @param Size size of the file in bytes
+            /// @return pointer to the new entry on success, NULL on failure. Only valid until the next AddEntry because extending
+            /// the directory can move it
+            FAT::DirectoryEntry_t *AddEntry(const char *Name, scim::byte Attributes, scim::qword Size) {
+                if(Size > 0xFFFFFFFF) return NULL;
+                Directory_t *Directory;
+                char EntryName[12];
+                if(!ResolvePath(Name, &Directory, EntryName)) return NULL;
+                // prevent duplicate entries
+                if(IndexFind(Directory, EntryName) != NO_ENTRY) return NULL;
+
+                // calculate how many values need to be added to the FAT
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                size_t FileClusterCount = (Size + ClusterBytes - 1) / ClusterBytes;
+
+                // build the cluster chain in the decoded FAT before anything is written so a full disk doesn't leave a half written entry
+                scim::dword FirstCluster;
+                if(!AllocateChain(FileClusterCount, &FirstCluster)) return NULL;
+                scim::dword Index;
+                if(!TakeSlot(Directory, &Index)) {
+                    FreeChain(FirstCluster);
+                    return NULL;
+                }
+
+                FillEntry(&Directory->Entries[Index], EntryName, Attributes, FirstCluster, Size);
+                IndexInsert(Directory, Index);
+                MarkSlotDirty(Directory, Index);
+                if(!Flush()) return NULL;
+                return &Directory->Entries[Index];
+            }
+
+            /// @brief copies a host file into a cluster chain an extent at a time. Only reads the FAT and only writes to the clusters
+            /// in the chain, so different chains can be written from different threads at the same time as long as nothing changes the FAT
+            /// @param FirstCluster first cluster of the chain. 0 for empty files
+            /// @param FileData host file to copy the data from. Each thread needs its own stream
+            /// @param FileSize number of bytes to copy from the host file
+            /// @return true on success, false on failure
+            bool WriteChain(scim::dword FirstCluster, FILE *FileData, scim::qword FileSize) {
+                SCIM_TIME_DETAIL(P_DATA_COPY, "WriteChain");
+                scim::qword HostOffset = 0;
+                ExtentIterator Extents(this, FirstCluster);
+                Extent_t Extent;
+                while(Extents.Next(&Extent))
+                    if(!WriteExtent(Extent, FileData, &HostOffset, FileSize)) return false;
+                return !Extents.Error;
+            }
+
+            /// @brief work out the scim::Hash_t of the data in a file entry, up to the size in the entry. The data is hashed straight out of
+            /// the mapping if the device has one, otherwise it goes through a STREAM_BUFFER_SIZE buffer on the stack
+            /// @param FileEntry file entry to hash
+            /// @param HashOut where the hash is stored
+            /// @return true on success, false on failure
+            bool HashEntry(const FAT::DirectoryEntry_t *FileEntry, scim::qword *HashOut) {
+                if(!ClusterTable) return false;
+                scim::Hash_t Hash;
+                scim::qword Remaining = FileEntry->Size;
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                scim::byte Buffer[STREAM_BUFFER_SIZE];          // only used if the device can't be mapped
+
+                ExtentIterator Extents(this, FirstCluster(FileEntry));
+                Extent_t Extent;
+                while(Remaining && Extents.Next(&Extent)) {
+                    scim::qword Offset = ClusterOffset(Extent.FirstCluster);
+                    // the last extent is cut off at the end of the file
+                    size_t ExtentBytes = scim::min((size_t)Extent.Length * ClusterBytes, Remaining);
+                    SCIM_COUNT(C_SECTORS_READ, SectorCount(ExtentBytes));
+
+                    scim::byte *ExtentData = Image->Map(Offset, ExtentBytes);
+                    if(ExtentData) Hash.Update(ExtentData, ExtentBytes);
+                    else {
+                        size_t Done = 0;
+                        while(Done < ExtentBytes) {
+                            size_t TransferBytes = scim::min(STREAM_BUFFER_SIZE, ExtentBytes - Done);
+                            if(!Image->Read(Offset + Done, TransferBytes, Buffer)) break;
+                            Hash.Update(Buffer, TransferBytes);
+                            Done += TransferBytes;
                         }
+                        if(Done < ExtentBytes) break;
+                    }
+                    Remaining -= ExtentBytes;
+                }
 
-                        free(FileDataBuffer);
-                        return true;
+                *HashOut = Hash.Finish();
+                // if anything is left over then either a read failed or the chain is shorter than the file
+                return !Remaining && !Extents.Error;
+            }
+
+            /// @brief change the size of a file entry without moving it so the new data can be written over the old data with WriteChain.
+            /// Clusters past the new end of the file are freed. The chain can't grow, so this fails if the new size needs more clusters than
+            /// the entry already has
+            /// @param FileEntry file entry to resize. Must point into a directory, such as one returned by FindEntry
+            /// @param Size new size of the file in bytes
+            /// @return true on success, false on failure or if the new size doesn't fit in the chain
+            bool ResizeEntry(FAT::DirectoryEntry_t *FileEntry, scim::qword Size) {
+                Directory_t *Directory;
+                scim::dword Index;
+                if(!OwnerOf(FileEntry, &Directory, &Index) || Size > 0xFFFFFFFF) return false;
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                scim::qword ClustersNeeded = (Size + ClusterBytes - 1) / ClusterBytes;
+
+                // find the last cluster that is still needed. Cluster ends up on the first one that isn't
+                scim::dword Cluster = FirstCluster(FileEntry), LastCluster = 0;
+                {
+                    SCIM_TIME(P_CHAIN_WALK);
+                    for(scim::qword i = 0; i < ClustersNeeded; i++) {
+                        if(!IsDataCluster(Cluster)) return false;
+                        LastCluster = Cluster;
+                        Cluster = ClusterTable[Cluster];
                     }
                 }
-                return false;
+
+                if(!LastCluster) SetFirstCluster(FileEntry, 0);
+                else if(IsDataCluster(Cluster)) SetCluster(LastCluster, CHAIN_END);
+                FreeChain(Cluster);
+                FileEntry->Size = Size;
+                MarkSlotDirty(Directory, Index);
+                return Flush();
+            }
+
+            /// @brief set the modification time and date of a file entry. The last accessed date is set to the same day
+            /// @param FileEntry file entry to change. Must point into a directory, such as one returned by FindEntry
+            /// @param Time host time to store. FAT only keeps it to the nearest 2 seconds
+            /// @return true on success, false on failure
+            bool SetModificationTime(FAT::DirectoryEntry_t *FileEntry, time_t Time) {
+                Directory_t *Directory;
+                scim::dword Index;
+                if(!OwnerOf(FileEntry, &Directory, &Index)) return false;
+                // localtime_r because several disks can be changed from different threads at once, such as in provision mode
+                tm LocalTime;
+                if(!localtime_r(&Time, &LocalTime)) return false;
+                FileEntry->ModificationTime = FAT::localtime2FatTime(&LocalTime);
+                FileEntry->ModificationDate = FAT::localtime2FatDate(&LocalTime);
+                FileEntry->AccessedDate = FileEntry->ModificationDate;
+                MarkSlotDirty(Directory, Index);
+                return Flush();
+            }
+
+            /// @brief finds the first cluster in the FAT that isnt being used. Searches the FreeClusters bitmap from AllocationCursor a word
+            /// at a time, since every cluster before the cursor is known to be used, and moves the cursor up to the cluster it finds.
+            /// The cluster isn't allocated so calling this again returns the same cluster
+            /// @return the cluster number of the first free cluster on success, 0 if the disk is full
+            scim::dword NextFreeCluster() {
+                if(AllocationCursor >= ClusterCount) return 0;
+                scim::dword Words = (ClusterCount + 63) / 64;
+                scim::dword Word = AllocationCursor / 64;
+                // ignore the bits before the cursor in the first word that gets checked
+                scim::qword Bits = FreeClusters[Word] & (~0ULL << (AllocationCursor % 64));
+                while(!Bits && ++Word < Words) Bits = FreeClusters[Word];
+                if(!Bits) return 0;
+                scim::dword Cluster = Word * 64 + __builtin_ctzll(Bits);
+                if(Cluster >= ClusterCount) return 0;       // bits past the end of the table are never set but better safe than sorry
+                AllocationCursor = Cluster;
+                return Cluster;
+            }
+
+            /// @brief measure how fragmented the files in every directory and the free space are. Sub-directories that haven't been
+            /// used yet are loaded
+            /// @param ReportOut where the measurements are stored
+            /// @return true on success, false if a chain is broken or a sub-directory can't be read
+            bool MeasureFragmentation(Fragmentation_t *ReportOut) {
+                memset(ReportOut, 0, sizeof(Fragmentation_t));
+                FileSlot_t *Files = NULL;
+                scim::dword FileCount = 0;
+                bool Success = RootDirectory && ListFiles(&Root, 0, &Files, &FileCount);
+                for(scim::dword i = 0; Success && i < FileCount; i++) {
+                    scim::dword Extents = 0;
+                    ExtentIterator Chain(this, FirstCluster(&Files[i].Directory->Entries[Files[i].Index]));
+                    Extent_t Extent;
+                    while(Chain.Next(&Extent)) Extents++;
+                    if(Chain.Error) Success = false;
+                    ReportOut->Files++;
+                    ReportOut->Extents += Extents;
+                    if(Extents > 1) ReportOut->FragmentedFiles++;
+                }
+                free(Files);
+                if(!Success) return false;
+                for(scim::dword Cluster = FIRST_AVAILABLE_CLUSTER; Cluster < ClusterCount;) {
+                    scim::dword Length = FreeRunLength(Cluster);
+                    if(!Length) {
+                        Cluster++;
+                        continue;
+                    }
+                    ReportOut->FreeClusters += Length;
+                    ReportOut->FreeRuns++;
+                    if(Length > ReportOut->LargestFreeRun) ReportOut->LargestFreeRun = Length;
+                    Cluster += Length;
+                }
+                return true;
+            }
+
+            /// @brief move the files in every directory towards the start of the data section so each chain is a single extent. A file
+            /// only ever moves into the lowest run of free clusters that holds its whole chain, and only if that puts it in fewer extents
+            /// or nearer the start than it is now, so a file is never split and nothing gets more fragmented. Sub-directories, bad
+            /// clusters, and the FAT32 root directory stay where they are. The work is done in passes. Each pass copies files an extent
+            /// at a time through a STREAM_BUFFER_SIZE buffer on the stack into clusters that are free in the FAT on the disk image, then
+            /// commits the FAT and the directory entries together, so the clusters a file leaves behind can only be reused by the next
+            /// pass. Interrupting it leaves every file whole, either where it was or where it was moved to. Passes carry on until one
+            /// doesn't move anything. A file bigger than every free run stays where it is. Requires the disk to have been initialised
+            /// and not be in a transaction
+            /// @param FirstName name of a file to try to put at the start of the data section in "NAME    EXT" format or a path like
+            /// the ones FindEntry takes, or NULL. It gets first pick of the free space in every pass, so it only ends up at the very
+            /// start if the clusters there can be freed
+            /// @return true on success, false on failure. If false is returned the passes that finished are on the disk image, the
+            /// pass that failed is still in a transaction, and the Disk should be cleaned without calling Commit
+            bool Defragment(const char *FirstName) {
+                if(InTransaction || !ClusterTable) return false;
+                FileSlot_t *Files = NULL;
+                scim::dword FileCount = 0;
+                bool Success = ListFiles(&Root, 0, &Files, &FileCount) && SeparateChains(Files, FileCount);
+
+                // the first file goes to the front of the list so it is placed before any other file in every pass
+                if(Success && FirstName) {
+                    FAT::DirectoryEntry_t *First = FindEntry(FirstName);
+                    scim::dword i = 0;
+                    while(i < FileCount && &Files[i].Directory->Entries[Files[i].Index] != First) i++;
+                    if(!First || (First->Attributes & FAT::A_DIRECTORY)) Success = false;
+                    else if(i < FileCount) {
+                        FileSlot_t Slot = Files[i];
+                        memmove(Files + 1, Files, i * sizeof(FileSlot_t));
+                        Files[0] = Slot;
+                    }
+                }
+
+                bool Moved = true;
+                while(Success && Moved) {
+                    Moved = false;
+                    Success = BeginTransaction();
+                    for(scim::dword i = 0; Success && i < FileCount; i++) Success = RelocateFile(&Files[i], &Moved);
+                    // a pass that didn't move anything has nothing to write, and committing it still ends the transaction
+                    Success = Success && Commit();
+                }
+                free(Files);
+                return Success;
+            }
+
+            /// @brief check every cluster chain on the disk in time proportional to the number of clusters. Each chain is walked once
+            /// from its directory entry, claiming its clusters in an owner table, so a cluster that is claimed twice is either a loop or
+            /// a cross-link. Sub-directories are checked too. One pass over the decoded FAT then finds the used clusters nobody claimed
+            /// and groups them into lost chains, and each FAT copy is compared against the one that was read. Requires the disk to have
+            /// been initialised and not be in a transaction
+            /// @param ReportOut where the results are stored. ReportOut->Problems must be freed by the caller, even if false is returned
+            /// @param Repair true to fix what was found in one commit. Chains are cut off before a cross-link, loop, or bad reference,
+            /// files are trimmed to fit their chain or have their extra clusters freed, lost chains are freed, and every FAT copy is
+            /// made to match the one that was read
+            /// @return true on success, false if the disk couldn't be checked or the repair couldn't be written
+            bool Check(CheckReport_t *ReportOut, bool Repair) {
+                memset(ReportOut, 0, sizeof(CheckReport_t));
+                if(InTransaction || !ClusterTable) return false;
+                SCIM_COUNT(C_FAT_SCANS, 1);
+
+                CheckState_t State;
+                State.Report = ReportOut;
+                State.Repair = Repair;
+                State.Owners = (scim::dword *)calloc(ClusterCount, sizeof(scim::dword));
+                if(!State.Owners) return false;
+
+                CheckFATCopies(&State);
+                // the transaction is started after the FAT copies are compared because it can swap FileAllocationTable for a copy
+                if(Repair && !BeginTransaction()) State.Failed = true;
+
+                if(!State.Failed) {
+                    // the FAT32 root directory is a chain like any other and is claimed first so nothing else can take it
+                    if(RootDirectoryClusters) CheckChain(&State, FS_Info.EBPB32.RootCluster, "ROOT DIR");
+                    CheckEntries(&State, RootDirectory, RootEntryCount, 0, 0);
+                    FindLostChains(&State);
+                }
+
+                bool Success = !State.Failed;
+                if(Success && Repair) Success = Commit();
+                // entries in sub-directories aren't part of the root directory so they are written once the FAT agrees with them
+                for(scim::dword i = 0; Success && i < State.FixCount; i++)
+                    Success = Image->Write(State.Fixes[i].Offset, sizeof(FAT::DirectoryEntry_t), &State.Fixes[i].Entry);
+                if(State.FixCount) SCIM_COUNT(C_SECTORS_WRITTEN, State.FixCount);
+
+                free(State.Fixes);
+                free(State.Owners);
+                return Success;
             }
 
         private:
 
-            scim::word DataSectionLBA = 0;
+            /// @brief a directory that has been read, with a hash index on the 11 character names so lookups, duplicate checks, and
+            /// finding a free slot don't have to scan every entry
+            typedef struct Directory_t {
+                scim::dword FirstCluster = 0;                   // 0 for the root directory, even on FAT32
+                FAT::DirectoryEntry_t *Entries = NULL;          // RootDirectory for the root directory, otherwise a malloced copy of the whole chain
+                scim::dword EntryCount = 0;
+                scim::dword *Clusters = NULL;                   // clusters of a sub-directory in chain order. The root directory uses RootDirectoryClusters
+                scim::dword ClusterCount = 0;
+                scim::qword *DirtySectors = NULL;               // bitmap of the sub-directory sectors that changed since the last Flush. The root directory uses DirtyRootSectors
+                scim::dword *Buckets = NULL;                    // index + 1 of the last entry added to each bucket, 0 if the bucket is empty. There is a power of 2 of them
+                scim::dword BucketMask = 0;                     // number of buckets - 1. There are never fewer buckets than entries
+                scim::dword *Chains = NULL;                     // index + 1 of the next entry in the same bucket for each entry, 0 at the end of the bucket
+                scim::dword *FreeSlots = NULL;                  // stack of deleted entries before EndIndex that can be reused. Has room for every entry
+                scim::dword FreeSlotCount = 0;
+                scim::dword EndIndex = 0;                       // index of the N_END entry that ends the directory. Nothing after it is in use
+                Directory_t *Next = NULL;                       // next loaded sub-directory
+            } Directory_t;
+
+            /// @brief a sub-directory entry that Check changed. It is written to Offset once the repaired FAT has been committed
+            typedef struct DirectoryFix_t {
+                scim::qword Offset;                             // byte offset of the entry on the disk image
+                FAT::DirectoryEntry_t Entry;
+            } DirectoryFix_t;
+
+            /// @brief where a file entry is, so it can still be found after other entries have been changed
+            typedef struct FileSlot_t {
+                Directory_t *Directory;                         // the root directory or a loaded sub-directory
+                scim::dword Index;                              // index of the entry in the directory
+            } FileSlot_t;
+
+            /// @brief everything Check needs to carry between the functions that make it up
+            typedef struct CheckState_t {
+                CheckReport_t *Report;
+                bool Repair;
+                scim::dword *Owners = NULL;                     // chain number that claimed each cluster, 0 if no chain has yet
+                scim::dword Chains = 0;                         // number of chains that have been walked. Each one gets the next number
+                DirectoryFix_t *Fixes = NULL;
+                scim::dword FixCount = 0;
+                bool Failed = false;                            // set if something couldn't be read or allocated, which stops the check
+            } CheckState_t;
+
+            FAT::DirectoryEntry_t *RootDirectory = NULL;
+            scim::byte *FileAllocationTable = NULL;
+            scim::dword RootEntryCount = 0;                     // number of entries RootDirectory can hold. Grows as a FAT32 root directory is extended
+            scim::byte *Arena = NULL;                           // one allocation holding everything whose size is known from the BPB
+            size_t ArenaSize = 0;
+            scim::dword TotalSectors = 0;                       // BPB.TotalSectors, or BPB.LargeSectors if the disk is too big for it
+            scim::dword FATSectors = 0;                         // size of one FAT. Comes from the FAT32 EBPB when BPB.SectorsPerFAT is 0
+            scim::dword FATLBA = 0;                             // first sector of the FAT that gets read
+            scim::dword FirstFATCopyLBA = 0;                    // first sector of the first FAT that gets written. Each copy after it is FATSectors further on
+            scim::dword FATCopies = 1;                          // number of FATs that get written. Only the active one on FAT32 disks with mirroring turned off
+            scim::dword EntryBits = 12;                         // size of one FAT entry in bits
+            const Format::Layout_t *Layout = NULL;              // layout of the geometry profile the BPB matches. NULL if it doesn't match one
+            scim::byte SectorShift = scim::NO_SHIFT;            // log2 of BPB.BytesPerSector. NO_SHIFT if it isn't a power of two
+            scim::byte ClusterShift = scim::NO_SHIFT;           // log2 of BPB.SectorsPerCluster. NO_SHIFT if it isn't a power of two
+            scim::dword DataSectionLBA = 0;
+            scim::dword RootDirectoryLBA = 0;                   // only used by FAT12 and FAT16
+            scim::dword RootDirectorySectors = 0;               // only used by FAT12 and FAT16
+            scim::dword FSInfoLBA = 0;                          // FAT32 FSInfo sector. 0 if there isn't a valid one
+            scim::dword *RootDirectoryClusters = NULL;          // clusters of a FAT32 root directory in chain order. NULL on FAT12 and FAT16
+            scim::dword RootDirectoryClusterCount = 0;          // number of clusters in RootDirectoryClusters
+            bool InTransaction = false;                         // set between BeginTransaction and Commit
+            Device::BlockDevice *Image = NULL;
+            bool RootDirectoryMapped = false;                   // set when RootDirectory points into the device rather than into the arena or malloced memory
+            bool FATMapped = false;                             // set when FileAllocationTable points into the device rather than into the arena or malloced memory
+            scim::dword *ClusterTable = NULL;                   // decoded copy of FileAllocationTable with one entry per cluster so the packed values don't need unpacking every time
+            scim::qword *FreeClusters = NULL;                   // bitmap of clusters that aren't in use. A set bit means the cluster is free
+            scim::dword ClusterCount = 0;                       // number of entries in ClusterTable, including the 2 reserved entries at the start
+            scim::dword AllocationCursor = FIRST_AVAILABLE_CLUSTER; // every cluster before this one is used, so searches for free clusters start here. Can be ClusterCount on a full disk
+            scim::qword *DirtyFATSectors = NULL;                // bitmap of the sectors in one FAT that changed since the last Flush. A set bit means the sector needs writing
+            scim::qword *DirtyRootSectors = NULL;               // bitmap of the root directory sectors that changed since the last Flush
+            Directory_t Root;                                   // index of the root directory
+            Directory_t *Directories = NULL;                    // every sub-directory that has been loaded, most recent first
+
+            /// @brief take over the metadata of another disk and leave it owning nothing
+            /// @param Other disk to take from. Must not be this disk
+            void Adopt(Disk *Other) {
+                FS_Info = Other->FS_Info;
+                Type = Other->Type;
+                RootDirectory = Other->RootDirectory;
+                FileAllocationTable = Other->FileAllocationTable;
+                RootEntryCount = Other->RootEntryCount;
+                Arena = Other->Arena;
+                ArenaSize = Other->ArenaSize;
+                TotalSectors = Other->TotalSectors;
+                FATSectors = Other->FATSectors;
+                FATLBA = Other->FATLBA;
+                FirstFATCopyLBA = Other->FirstFATCopyLBA;
+                FATCopies = Other->FATCopies;
+                EntryBits = Other->EntryBits;
+                Layout = Other->Layout;
+                SectorShift = Other->SectorShift;
+                ClusterShift = Other->ClusterShift;
+                DataSectionLBA = Other->DataSectionLBA;
+                RootDirectoryLBA = Other->RootDirectoryLBA;
+                RootDirectorySectors = Other->RootDirectorySectors;
+                FSInfoLBA = Other->FSInfoLBA;
+                RootDirectoryClusters = Other->RootDirectoryClusters;
+                RootDirectoryClusterCount = Other->RootDirectoryClusterCount;
+                InTransaction = Other->InTransaction;
+                Image = Other->Image;
+                RootDirectoryMapped = Other->RootDirectoryMapped;
+                FATMapped = Other->FATMapped;
+                ClusterTable = Other->ClusterTable;
+                FreeClusters = Other->FreeClusters;
+                ClusterCount = Other->ClusterCount;
+                AllocationCursor = Other->AllocationCursor;
+                DirtyFATSectors = Other->DirtyFATSectors;
+                DirtyRootSectors = Other->DirtyRootSectors;
+                Root = Other->Root;
+                Directories = Other->Directories;
+                Other->Forget();
+            }
+
+            /// @brief drop every pointer to metadata without freeing anything, leaving the disk as if it had never been initialised
+            void Forget() {
+                Root = Directory_t();
+                Directories = NULL;
+                Layout = NULL;
+                InTransaction = false;
+                RootDirectory = NULL;
+                FileAllocationTable = NULL;
+                Arena = NULL;
+                ArenaSize = 0;
+                ClusterTable = NULL;
+                FreeClusters = NULL;
+                ClusterCount = 0;
+                RootDirectoryClusters = NULL;
+                DirtyFATSectors = NULL;
+                DirtyRootSectors = NULL;
+                RootDirectoryClusterCount = 0;
+                RootEntryCount = 0;
+                RootDirectoryMapped = FATMapped = false;
+                Image = NULL;
+            }
+
+            /// @return true if some memory is part of the arena
+            bool InArena(const void *Memory) {
+                uintptr_t Address = (uintptr_t)Memory, Start = (uintptr_t)Arena;
+                return Arena && Address >= Start && Address < Start + ArenaSize;
+            }
+
+            /// @brief free some metadata unless it is part of the arena, which Clean frees in one go
+            void Release(void *Memory) {
+                if(!InArena(Memory)) free(Memory);
+            }
+
+            /// @brief work out how many clusters the FAT can describe. Requires ReadLayout to have been called
+            /// @return number of entries ClusterTable needs, including the 2 reserved entries at the start
+            scim::dword CountClusters() {
+                // the FAT can hold fewer entries than there are clusters on the disk (the SawconOS disks do this) and vice versa so only the smaller of the two is usable
+                scim::dword FATEntries = (scim::qword)FATSectors * FS_Info.BPB.BytesPerSector * 8 / EntryBits;
+                scim::dword DataClusters = Layout ? Layout->DataClusters : (TotalSectors - DataSectionLBA) / FS_Info.BPB.SectorsPerCluster;
+                scim::dword Count = scim::min(FATEntries, (scim::qword)DataClusters + FIRST_AVAILABLE_CLUSTER);
+                // the bad cluster marker and anything above it can't be used as a cluster number
+                scim::dword BadCluster = Type == T_FAT12 ? FAT12::Width::BAD : Type == T_FAT16 ? FAT16::Width::BAD : FAT32::Width::BAD;
+                return scim::min(Count, BadCluster);
+            }
+
+            /// @brief get the memory for the FAT, ClusterTable, FreeClusters, the dirty sector bitmaps, and a FAT12 or FAT16 root
+            /// directory and its hash index with one allocation. The FAT and root directory are only given space if they can't be
+            /// mapped. A FAT32 root directory is a cluster chain that isn't measured until the FAT has been read, and it can grow, so
+            /// ReadRootChain and BuildIndex allocate it and its index separately. Requires ReadLayout to have been called
+            /// @return true on success, false on failure
+            bool AllocateArena() {
+                ClusterCount = CountClusters();
+                if(ClusterCount <= FIRST_AVAILABLE_CLUSTER) return false;
+                FileAllocationTable = MapSectors(FATLBA, FATSectors);
+                FATMapped = FileAllocationTable != NULL;
+                if(Type != T_FAT32) {
+                    RootDirectory = (FAT::DirectoryEntry_t *)MapSectors(RootDirectoryLBA, RootDirectorySectors);
+                    RootDirectoryMapped = RootDirectory != NULL;
+                }
+
+                // every piece starts on an 8 byte boundary so the bitmaps can be used as qwords
+                size_t Offset = 0;
+                auto Carve = [&Offset](size_t Bytes) {
+                    size_t Start = Offset;
+                    Offset += (Bytes + 7) & ~(size_t)7;
+                    return Start;
+                };
+                size_t FATOffset = Carve(FATMapped ? 0 : (size_t)FATSectors * FS_Info.BPB.BytesPerSector);
+                size_t ClusterTableOffset = Carve(ClusterCount * sizeof(scim::dword));
+                size_t FreeClustersOffset = Carve((ClusterCount + 63) / 64 * sizeof(scim::qword));
+                size_t DirtyFATOffset = Carve((FATSectors + 63) / 64 * sizeof(scim::qword));
+                size_t RootOffset = Carve(Type == T_FAT32 || RootDirectoryMapped ? 0 : RootDirectorySize());
+                size_t DirtyRootOffset = Carve(Type == T_FAT32 ? 0 : (RootDirectorySectorCount() + 63) / 64 * sizeof(scim::qword));
+                // a FAT12 or FAT16 root directory never changes size so its index is sized here once
+                scim::dword RootSlots = Type == T_FAT32 ? 0 : IndexSlots(FS_Info.BPB.RootDirectoryEntries);
+                size_t RootBucketsOffset = Carve(Type == T_FAT32 ? 0 : IndexBuckets(FS_Info.BPB.RootDirectoryEntries) * sizeof(scim::dword));
+                size_t RootChainsOffset = Carve(RootSlots * sizeof(scim::dword));
+                size_t RootFreeSlotsOffset = Carve(RootSlots * sizeof(scim::dword));
+
+                // nothing is free or dirty until the FAT has been decoded
+                Arena = (scim::byte *)calloc(1, Offset);
+                if(!Arena) return false;
+                ArenaSize = Offset;
+                if(!FATMapped) FileAllocationTable = Arena + FATOffset;
+                ClusterTable = (scim::dword *)(Arena + ClusterTableOffset);
+                FreeClusters = (scim::qword *)(Arena + FreeClustersOffset);
+                DirtyFATSectors = (scim::qword *)(Arena + DirtyFATOffset);
+                if(Type != T_FAT32) {
+                    if(!RootDirectoryMapped) RootDirectory = (FAT::DirectoryEntry_t *)(Arena + RootOffset);
+                    DirtyRootSectors = (scim::qword *)(Arena + DirtyRootOffset);
+                    Root.Buckets = (scim::dword *)(Arena + RootBucketsOffset);
+                    Root.Chains = (scim::dword *)(Arena + RootChainsOffset);
+                    Root.FreeSlots = (scim::dword *)(Arena + RootFreeSlotsOffset);
+                }
+                return true;
+            }
+
+            /// @brief check that a cluster number refers to a cluster in the data section
+            /// @param Cluster FAT cluster number
+            /// @return true if the cluster can hold data, false otherwise
+            bool IsDataCluster(scim::dword Cluster) {
+                return Cluster >= FIRST_AVAILABLE_CLUSTER && Cluster < ClusterCount;
+            }
+
+            /// @brief check if a cluster is free without going through the FAT
+            /// @param Cluster FAT cluster number. Must be less than ClusterCount
+            /// @return true if the cluster is free, false if it is used or reserved
+            bool IsFree(scim::dword Cluster) {
+                return FreeClusters[Cluster / 64] & (1ULL << (Cluster % 64));
+            }
+
+            /// @brief find the length of the run of free clusters starting at a cluster
+            /// @param Cluster first cluster of the run
+            /// @return number of consecutive free clusters, 0 if Cluster itself is used
+            scim::dword FreeRunLength(scim::dword Cluster) {
+                scim::dword Length = 0;
+                while(Cluster + Length < ClusterCount) {
+                    // whole words of free clusters can be skipped over at once
+                    if((Cluster + Length) % 64 == 0 && FreeClusters[(Cluster + Length) / 64] == ~0ULL && Cluster + Length + 64 <= ClusterCount) {
+                        Length += 64;
+                        continue;
+                    }
+                    if(!IsFree(Cluster + Length)) break;
+                    Length++;
+                }
+                return Length;
+            }
+
+            /// @brief find the next run of free clusters on the disk using the free cluster bitmap
+            /// @param Cluster cluster to start searching from
+            /// @param RunOut where the run is stored
+            /// @return true if a run was found, false if there aren't any free clusters at or after Cluster
+            bool NextFreeRun(scim::dword Cluster, Extent_t *RunOut) {
+                while(Cluster < ClusterCount) {
+                    // skip over whole words of used clusters
+                    if(Cluster % 64 == 0 && !FreeClusters[Cluster / 64]) {
+                        Cluster += 64;
+                        continue;
+                    }
+                    if(!IsFree(Cluster)) {
+                        Cluster++;
+                        continue;
+                    }
+                    RunOut->FirstCluster = Cluster;
+                    RunOut->Length = FreeRunLength(Cluster);
+                    return true;
+                }
+                return false;
+            }
+
+            /// @brief find the first run of free clusters that is long enough to hold a chain
+            /// @param Length number of clusters the run needs
+            /// @param Limit the run has to start before this cluster. ClusterCount searches the whole disk
+            /// @return first cluster of the run, 0 if there isn't one
+            scim::dword LowestFreeRun(scim::dword Length, scim::dword Limit) {
+                Extent_t Run;
+                for(scim::dword Cluster = AllocationCursor; NextFreeRun(Cluster, &Run) && Run.FirstCluster < Limit; Cluster = Run.FirstCluster + Run.Length)
+                    if(Run.Length >= Length) return Run.FirstCluster;
+                return 0;
+            }
+
+            /// @brief count the free clusters in runs that are at least a certain length
+            /// @param MinimumLength shortest run to count
+            /// @return number of free clusters in those runs
+            scim::dword FreeInRuns(scim::dword MinimumLength) {
+                SCIM_COUNT(C_FAT_SCANS, 1);
+                scim::dword Total = 0;
+                Extent_t Run;
+                for(scim::dword Cluster = AllocationCursor; NextFreeRun(Cluster, &Run); Cluster = Run.FirstCluster + Run.Length)
+                    if(Run.Length >= MinimumLength) Total += Run.Length;
+                return Total;
+            }
+
+            /// @brief allocates a cluster chain, keeping it in as few extents as possible. The smallest free run that fits the whole chain is
+            /// used if there is one (best-fit). Otherwise the chain is spread over the largest free runs and linked together in disk order.
+            /// The runs are found by scanning the free cluster bitmap so nothing is allocated on the heap
+            /// @param Length number of clusters in the chain
+            /// @param FirstClusterOut where the first cluster of the chain is stored. 0 if Length is 0
+            /// @return true on success, false if there isn't enough free space
+            bool AllocateChain(scim::dword Length, scim::dword *FirstClusterOut) {
+                *FirstClusterOut = 0;
+                if(!Length) return true;
+                SCIM_TIME(P_ALLOCATE);
+                SCIM_COUNT(C_FAT_SCANS, 1);
+
+                // look at every free run on the disk in one pass. The clusters before AllocationCursor are all used so the search starts
+                // there, and the cursor is moved up to the first free run so the next search skips the used clusters in between
+                scim::dword FreeTotal = 0, LargestRun = 0;
+                Extent_t Run, BestFit = { 0, 0 };
+                if(NextFreeRun(AllocationCursor, &Run)) AllocationCursor = Run.FirstCluster;
+                for(scim::dword Cluster = AllocationCursor; NextFreeRun(Cluster, &Run); Cluster = Run.FirstCluster + Run.Length) {
+                    if(Run.Length >= Length && (!BestFit.Length || Run.Length < BestFit.Length)) BestFit = Run;
+                    if(Run.Length > LargestRun) LargestRun = Run.Length;
+                    FreeTotal += Run.Length;
+                }
+                if(FreeTotal < Length) return false;
+
+                if(BestFit.Length) {
+                    LinkRun(BestFit.FirstCluster, Length, CHAIN_END);
+                    *FirstClusterOut = BestFit.FirstCluster;
+                    return true;
+                }
+
+                // the chain has to be fragmented. Taking the largest runs first keeps the number of extents down, so find the length of
+                // the shortest run that has to be used by halving the range of lengths it could be. Each step is one pass over the bitmap
+                scim::dword Shortest = 1, Longest = LargestRun;
+                while(Shortest < Longest) {
+                    scim::dword Middle = Shortest + (Longest - Shortest + 1) / 2;
+                    if(FreeInRuns(Middle) >= Length) Shortest = Middle;
+                    else Longest = Middle - 1;
+                }
+
+                // every run longer than that is used whole and runs of exactly that length make up the rest. Linking the runs in disk
+                // order means the chain is read in one forward sweep
+                scim::dword FromShortest = Length - FreeInRuns(Shortest + 1), LastCluster = 0;
+                for(scim::dword Cluster = AllocationCursor; NextFreeRun(Cluster, &Run); Cluster = Run.FirstCluster + Run.Length) {
+                    scim::dword Used = Run.Length;
+                    if(Run.Length == Shortest) {
+                        Used = scim::min(Run.Length, FromShortest);
+                        FromShortest -= Used;
+                    }
+                    else if(Run.Length < Shortest) Used = 0;
+                    if(!Used) continue;
+                    LinkRun(Run.FirstCluster, Used, CHAIN_END);
+                    if(LastCluster) SetCluster(LastCluster, Run.FirstCluster);
+                    else *FirstClusterOut = Run.FirstCluster;
+                    LastCluster = Run.FirstCluster + Used - 1;
+                }
+                return true;
+            }
+
+            /// @brief mark a run of consecutive clusters as used and chain them together
+            /// @param FirstCluster first cluster of the run
+            /// @param Length number of clusters in the run
+            /// @param NextCluster what the last cluster of the run points to. Either the start of the next run or CHAIN_END
+            void LinkRun(scim::dword FirstCluster, scim::dword Length, scim::dword NextCluster) {
+                SCIM_COUNT(C_CLUSTERS_ALLOCATED, Length);
+                for(scim::dword Cluster = FirstCluster; Cluster + 1 < FirstCluster + Length; Cluster++)
+                    SetCluster(Cluster, Cluster + 1);
+                SetCluster(FirstCluster + Length - 1, NextCluster);
+            }
+
+            /// @brief copy clusters from one place on the disk image to another that doesn't overlap it, through a STREAM_BUFFER_SIZE
+            /// buffer on the stack unless both places can be mapped
+            /// @param Source first cluster to copy from
+            /// @param Target first cluster to copy to
+            /// @param Length number of clusters to copy
+            /// @return true on success, false on failure
+            bool CopyClusters(scim::dword Source, scim::dword Target, scim::dword Length) {
+                size_t Bytes = (size_t)Length * FS_Info.BPB.SectorsPerCluster * FS_Info.BPB.BytesPerSector;
+                scim::qword SourceOffset = ClusterOffset(Source), TargetOffset = ClusterOffset(Target);
+                SCIM_COUNT(C_SECTORS_READ, SectorCount(Bytes));
+                SCIM_COUNT(C_SECTORS_WRITTEN, SectorCount(Bytes));
+                SCIM_COUNT(C_BYTES_COPIED, Bytes);
+                scim::byte *SourceData = Image->Map(SourceOffset, Bytes);
+                scim::byte *TargetData = SourceData ? Image->Map(TargetOffset, Bytes) : NULL;
+                if(TargetData) {
+                    memcpy(TargetData, SourceData, Bytes);
+                    return true;
+                }
+                scim::byte Buffer[STREAM_BUFFER_SIZE];
+                for(size_t Done = 0; Done < Bytes;) {
+                    size_t TransferBytes = scim::min(STREAM_BUFFER_SIZE, Bytes - Done);
+                    if(!Image->Read(SourceOffset + Done, TransferBytes, Buffer) ||
+                       !Image->Write(TargetOffset + Done, TransferBytes, Buffer)) return false;
+                    Done += TransferBytes;
+                }
+                return true;
+            }
+
+            /// @brief move a file into the lowest run of free clusters that holds its whole chain, if that leaves it in one extent
+            /// where it was in more, or nearer the start of the data section. Only used by Defragment, inside a transaction, so the
+            /// run is free in the FAT on the disk image and the clusters the file leaves behind aren't reused until Commit
+            /// @param File file to move
+            /// @param MovedOut set to true if the file was moved, left alone otherwise
+            /// @return true on success, including when the file stays where it is, false on failure
+            bool RelocateFile(const FileSlot_t *File, bool *MovedOut) {
+                FAT::DirectoryEntry_t *Entry = &File->Directory->Entries[File->Index];
+                scim::dword First = FirstCluster(Entry), Length = 0, Extents = 0;
+                ExtentIterator Counter(this, First);
+                Extent_t Extent;
+                while(Counter.Next(&Extent)) {
+                    Length += Extent.Length;
+                    Extents++;
+                }
+                if(Counter.Error) return false;
+
+                // a file that is already in one extent only ever moves towards the start, which is what makes the passes end
+                scim::dword Target = LowestFreeRun(Length, Extents > 1 ? ClusterCount : First);
+                if(!Target) return true;
+                SCIM_TIME_DETAIL(P_DATA_COPY, "Defragment");
+                scim::dword Done = 0;
+                ExtentIterator Chain(this, First);
+                while(Chain.Next(&Extent)) {
+                    if(!CopyClusters(Extent.FirstCluster, Target + Done, Extent.Length)) return false;
+                    Done += Extent.Length;
+                }
+                if(Chain.Error) return false;
+
+                FreeChain(First);
+                LinkRun(Target, Length, CHAIN_END);
+                SetFirstCluster(Entry, Target);
+                MarkSlotDirty(File->Directory, File->Index);
+                *MovedOut = true;
+                return true;
+            }
+
+            /// @brief check that no cluster belongs to more than one file or directory, because Defragment would free a cluster
+            /// that is still in use if it moved a file that is cross-linked with something else
+            /// @param Files every file on the disk, from ListFiles
+            /// @param FileCount number of files
+            /// @return true if every chain has clusters of its own, false if two chains share one or there isn't enough memory
+            bool SeparateChains(const FileSlot_t *Files, scim::dword FileCount) {
+                scim::qword *Claimed = (scim::qword *)calloc((ClusterCount + 63) / 64, sizeof(scim::qword));
+                if(!Claimed) return false;
+                bool Separate = true;
+                auto Claim = [&](scim::dword Cluster) {
+                    if(Claimed[Cluster / 64] & (1ULL << (Cluster % 64))) Separate = false;
+                    Claimed[Cluster / 64] |= 1ULL << (Cluster % 64);
+                };
+                for(scim::dword i = 0; i < RootDirectoryClusterCount; i++) Claim(RootDirectoryClusters[i]);
+                for(Directory_t *Directory = Directories; Directory; Directory = Directory->Next)
+                    for(scim::dword i = 0; i < Directory->ClusterCount; i++) Claim(Directory->Clusters[i]);
+                for(scim::dword i = 0; Separate && i < FileCount; i++) {
+                    ExtentIterator Chain(this, FirstCluster(&Files[i].Directory->Entries[Files[i].Index]));
+                    Extent_t Extent;
+                    while(Chain.Next(&Extent))
+                        for(scim::dword Cluster = Extent.FirstCluster; Cluster < Extent.FirstCluster + Extent.Length; Cluster++) Claim(Cluster);
+                    if(Chain.Error) Separate = false;
+                }
+                free(Claimed);
+                return Separate;
+            }
+
+            /// @brief copy the next part of a host file into an extent. The part of the extent past the end of the file is zeroed out
+            /// @param Extent clusters to fill
+            /// @param FileData host file to read from
+            /// @param HostOffset byte offset in the host file to start reading from. Moved past the data that was copied
+            /// @param FileSize size of the host file in bytes
+            /// @return true on success, false on failure
+            bool WriteExtent(Extent_t Extent, FILE *FileData, scim::qword *HostOffset, scim::qword FileSize) {
+                size_t ExtentBytes = (size_t)Extent.Length * FS_Info.BPB.SectorsPerCluster * FS_Info.BPB.BytesPerSector;
+                scim::qword Offset = ClusterOffset(Extent.FirstCluster);
+                size_t DataBytes = *HostOffset < FileSize ? scim::min(ExtentBytes, FileSize - *HostOffset) : 0;
+                SCIM_COUNT(C_SECTORS_WRITTEN, SectorCount(ExtentBytes));
+                SCIM_COUNT(C_BYTES_COPIED, DataBytes);
+
+                // let the kernel copy the host data into the image so it never has to pass through SCIM
+                size_t Copied = Device::KernelCopy(fileno(FileData), *HostOffset, Image->GetFileDescriptor(), Offset, DataBytes);
+                *HostOffset += Copied;
+                Offset += Copied;
+                ExtentBytes -= Copied;
+                // only the zeroes after the end of the file are left to write
+                if(Copied == DataBytes) return ZeroFill(Offset, ExtentBytes);
+
+                // the kernel couldn't do it so carry on from wherever it got to
+                SCIM_COUNT(C_SEEKS, 1);
+                if(fseeko(FileData, *HostOffset, SEEK_SET) < 0) return false;
+                *HostOffset += DataBytes - Copied;
+
+                // read the host data straight into the image when it's mapped
+                scim::byte *ExtentData = Image->Map(Offset, ExtentBytes);
+                if(ExtentData) {
+                    size_t BytesRead = fread(ExtentData, 1, ExtentBytes, FileData);
+                    if(ferror(FileData)) return false;
+                    memset(ExtentData + BytesRead, 0, ExtentBytes - BytesRead);
+                    return true;
+                }
+
+                // otherwise go through a buffer on the stack so that copying the file data never touches the heap. FileData is a stdio
+                // stream so the host side is already buffered and a bigger buffer here wouldn't save any reads
+                scim::byte Buffer[STREAM_BUFFER_SIZE];
+                for(size_t Done = 0; Done < ExtentBytes;) {
+                    size_t TransferBytes = scim::min(STREAM_BUFFER_SIZE, ExtentBytes - Done);
+                    size_t BytesRead = fread(Buffer, 1, TransferBytes, FileData);
+                    if(ferror(FileData)) return false;
+                    memset(Buffer + BytesRead, 0, TransferBytes - BytesRead);
+                    if(!Image->Write(Offset + Done, TransferBytes, Buffer)) return false;
+                    Done += TransferBytes;
+                }
+                return true;
+            }
+
+            /// @brief write zeroes to part of the disk image
+            /// @param Offset byte offset to start writing at
+            /// @param Length number of zero bytes to write
+            /// @return true on success, false on failure
+            bool ZeroFill(scim::qword Offset, size_t Length) {
+                if(!Length) return true;
+                scim::byte *Destination = Image->Map(Offset, Length);
+                if(Destination) {
+                    memset(Destination, 0, Length);
+                    return true;
+                }
+                SCIM_COUNT(C_SECTORS_WRITTEN, SectorCount(Length));
+                // one block of zeroes is shared by every call and written as many times as it takes
+                static const scim::byte Zeroes[STREAM_BUFFER_SIZE] = {};
+                for(size_t Done = 0; Done < Length;) {
+                    size_t TransferBytes = scim::min(STREAM_BUFFER_SIZE, Length - Done);
+                    if(!Image->Write(Offset + Done, TransferBytes, Zeroes)) return false;
+                    Done += TransferBytes;
+                }
+                return true;
+            }
 
             /// @brief read some sectors from a disk image. requires FS_Info to have valid values in it
-            /// @param Image disk image to read from
             /// @param LBA which sector to start reading from
             /// @param Count how many sectors to read
             /// @param BufferOut where the data will be stored
             /// @return true on success, false on error
-            bool ReadSectors(FILE *Image, scim::word LBA, scim::word Count, void *BufferOut) {
-                if(fseek(Image, LBA * FS_Info.BPB.BytesPerSector, SEEK_SET) < 0) return false;
-                if(fread(BufferOut, FS_Info.BPB.BytesPerSector, Count, Image) != Count) return false;
-                return true;
+            bool ReadSectors(scim::dword LBA, scim::dword Count, void *BufferOut) {
+                SCIM_COUNT(C_SECTORS_READ, Count);
+                return Image->Read(SectorOffset(LBA), SectorOffset(Count), BufferOut);
+            }
+
+            /// @brief get a pointer straight to some sectors of the disk image. requires FS_Info to have valid values in it
+            /// @param LBA first sector to map
+            /// @param Count how many sectors will be accessed
+            /// @return pointer to the sectors on success, NULL if the device can't be mapped
+            scim::byte *MapSectors(scim::dword LBA, scim::dword Count) {
+                SCIM_COUNT(C_SECTORS_READ, Count);     // everything that gets mapped is read through the pointer straight away
+                return Image->Map(SectorOffset(LBA), SectorOffset(Count));
+            }
+
+            /// @brief work out how many sectors some bytes cover, for --stats
+            /// @param Bytes number of bytes
+            /// @return number of sectors, rounded up
+            size_t SectorCount(size_t Bytes) {
+                return (Bytes + FS_Info.BPB.BytesPerSector - 1) / FS_Info.BPB.BytesPerSector;
             }
 
-            /// @brief convert a cluster number to its LBA location. Requires DataSectionLBA to have been set by ReadRootDirectory
+            /// @brief convert a number of sectors to bytes, or an LBA to a byte offset. Requires ReadLayout to have been called
+            /// @param Sectors number of sectors
+            /// @return number of bytes
+            scim::qword SectorOffset(scim::qword Sectors) {
+                if(Layout) return Layout->SectorOffset(Sectors);
+                // every real BPB has a power of two sector size but anything else still works with a multiply
+                if(SectorShift != scim::NO_SHIFT) return Sectors << SectorShift;
+                return Sectors * FS_Info.BPB.BytesPerSector;
+            }
+
+            /// @brief convert a cluster number to its LBA location. Requires DataSectionLBA to have been set by ReadLayout
             /// @param Cluster FAT cluster number
             /// @return LBA number on success, 0 on failure
-            scim::word Cluster2LBA(scim::word Cluster) {
-                if(Cluster < FIRST_AVAILABLE_CLUSTER || 
+            scim::dword Cluster2LBA(scim::dword Cluster) {
+                if(Cluster < FIRST_AVAILABLE_CLUSTER ||
                    !DataSectionLBA) return 0;
-                return DataSectionLBA + (Cluster - FIRST_AVAILABLE_CLUSTER) * FS_Info.BPB.SectorsPerCluster;
+                if(Layout) return Layout->Cluster2LBA(Cluster);
+                scim::dword Sectors = Cluster - FIRST_AVAILABLE_CLUSTER;
+                return DataSectionLBA + (ClusterShift != scim::NO_SHIFT ? Sectors << ClusterShift : Sectors * FS_Info.BPB.SectorsPerCluster);
+            }
+
+            /// @brief set the first cluster of a file entry, splitting it between FirstClusterLow and FirstClusterHigh on FAT32
+            /// @param Entry file entry to change
+            /// @param Cluster first cluster of the chain, 0 for empty files
+            void SetFirstCluster(FAT::DirectoryEntry_t *Entry, scim::dword Cluster) {
+                Entry->FirstClusterLow = Cluster & 0xFFFF;
+                Entry->FirstClusterHigh = Type == T_FAT32 ? Cluster >> 16 : 0;
+            }
+
+            /// @brief work out where the FAT, root directory, and data section are and decide which type of FAT the disk uses.
+            /// Requires FS_Info to have valid values in it
+            /// @return true on success, false if the BPB doesn't describe a usable disk
+            bool ReadLayout() {
+                SCIM_TIME(P_READ_LAYOUT);
+                if(!FS_Info.BPB.BytesPerSector || !FS_Info.BPB.SectorsPerCluster || !FS_Info.BPB.TotalFATs) return false;
+
+                // disks with more than 65535 sectors keep their size in LargeSectors instead
+                TotalSectors = FS_Info.BPB.TotalSectors ? FS_Info.BPB.TotalSectors : FS_Info.BPB.LargeSectors;
+                // FAT32 disks leave SectorsPerFAT as 0 and use the 32 bit value in their EBPB
+                FATSectors = FS_Info.BPB.SectorsPerFAT ? FS_Info.BPB.SectorsPerFAT : FS_Info.EBPB32.SectorsPerFAT;
+                if(!FATSectors) return false;
+                FATLBA = FS_Info.BPB.ReservedSectors;
+
+                // a disk formatted with one of the geometry profiles already has its layout worked out, so only other disks need theirs
+                // calculated from the BPB
+                Layout = Format::MatchLayout(&FS_Info.BPB, TotalSectors, FATSectors);
+                if(Layout) {
+                    SectorShift = Layout->SectorShift;
+                    ClusterShift = Layout->ClusterShift;
+                    RootDirectoryLBA = Layout->RootDirectoryLBA;
+                    RootDirectorySectors = Layout->RootDirectorySectors;
+                    DataSectionLBA = Layout->DataSectionLBA;
+                    Type = Layout->Type;
+                }
+                else {
+                    SectorShift = scim::ShiftFor(FS_Info.BPB.BytesPerSector);
+                    ClusterShift = scim::ShiftFor(FS_Info.BPB.SectorsPerCluster);
+
+                    // calculate the LBA of the root directory
+                    // the root directory is located directly after the FAT region of the disk, which is located after the reserved sectors at the start of the disk
+                    RootDirectoryLBA = FATLBA + FS_Info.BPB.TotalFATs * FATSectors;
+
+                    // calculate the size of the root directory in sectors. This is 0 on FAT32 where the root directory is in the data section
+                    unsigned int RootDirectoryBytes = sizeof(FAT::DirectoryEntry_t) * FS_Info.BPB.RootDirectoryEntries;
+                    // division operations always round down with integers so when a division needs to be rounded up, which it does in this case to make sure we read the whole thing, we can add the divisor - 1 to the dividend
+                    RootDirectorySectors = (RootDirectoryBytes + (FS_Info.BPB.BytesPerSector - 1)) / FS_Info.BPB.BytesPerSector;
+
+                    DataSectionLBA = RootDirectoryLBA + RootDirectorySectors;
+                    if(TotalSectors <= DataSectionLBA) return false;
+
+                    // the number of data clusters is the only thing that decides the type of FAT
+                    scim::dword DataClusters = (TotalSectors - DataSectionLBA) / FS_Info.BPB.SectorsPerCluster;
+                    if(DataClusters < FAT12_MAX_CLUSTERS) Type = T_FAT12;
+                    else if(DataClusters < FAT16_MAX_CLUSTERS) Type = T_FAT16;
+                    else Type = T_FAT32;
+                }
+                EntryBits = Type == T_FAT12 ? FAT12::Width::BITS : Type == T_FAT16 ? FAT16::Width::BITS : FAT32::Width::BITS;
+
+                // every FAT is written so the copies never disagree
+                FirstFATCopyLBA = FATLBA;
+                FATCopies = FS_Info.BPB.TotalFATs;
+
+                if(Type != T_FAT32) return FS_Info.BPB.RootDirectoryEntries != 0;
+
+                // FAT32 has no fixed size root directory
+                if(FS_Info.BPB.RootDirectoryEntries) return false;
+                // when mirroring is turned off only the active FAT is kept up to date
+                if(FS_Info.EBPB32.Flags & FAT32::F_NO_MIRROR) {
+                    if((FS_Info.EBPB32.Flags & FAT32::F_ACTIVE_FAT) >= FS_Info.BPB.TotalFATs) return false;
+                    FATLBA += (FS_Info.EBPB32.Flags & FAT32::F_ACTIVE_FAT) * FATSectors;
+                    FirstFATCopyLBA = FATLBA;
+                    FATCopies = 1;
+                }
+                // the FSInfo sector is only a hint so a disk without a valid one is still usable. Only the start of the sector is read
+                // because sectors bigger than 512 bytes wouldn't fit in FSInfo
+                FSInfoLBA = 0;
+                FAT32::FSInfo_t FSInfo;
+                if(FS_Info.EBPB32.FSInfoSector && FS_Info.EBPB32.FSInfoSector < FS_Info.BPB.ReservedSectors && FS_Info.BPB.BytesPerSector >= sizeof(FSInfo) &&
+                   Image->Read(SectorOffset(FS_Info.EBPB32.FSInfoSector), sizeof(FSInfo), &FSInfo) && FSInfo.LeadSignature == FAT32::FSINFO_LEAD_SIGNATURE &&
+                   FSInfo.StructSignature == FAT32::FSINFO_STRUCT_SIGNATURE && FSInfo.TrailSignature == FAT32::FSINFO_TRAIL_SIGNATURE)
+                    FSInfoLBA = FS_Info.EBPB32.FSInfoSector;
+                return true;
             }
 
-            /// @brief Reads the first file allocation table of a disk image into FileAllocationTable
-            /// @param Image disk image to read from
+            /// @brief Reads the file allocation table of a disk image into FileAllocationTable and decodes it into ClusterTable and FreeClusters. Requires AllocateArena to have been called
             /// @return true on sucess, false on failure
-            bool ReadFAT(FILE *Image) {
-                FileAllocationTable = (scim::byte *)malloc(FS_Info.BPB.SectorsPerFAT * FS_Info.BPB.BytesPerSector);
-                if(!FileAllocationTable) return false;
-                if(!ReadSectors(Image, FS_Info.BPB.ReservedSectors, FS_Info.BPB.SectorsPerFAT, FileAllocationTable)) return false;
+            bool ReadFAT() {
+                SCIM_TIME(P_READ_FAT);
+                // a mapped FAT is used in place so nothing needs to be copied. Otherwise it is read into the arena
+                if(!FATMapped && !ReadSectors(FATLBA, FATSectors, FileAllocationTable)) return false;
+                return DecodeFAT();
+            }
+
+            /// @brief unpacks FileAllocationTable into ClusterTable and builds the FreeClusters bitmap using the decoder for the type of the disk
+            /// @return true on success, false on failure
+            bool DecodeFAT() {
+                switch(Type) {
+                    case T_FAT12: return DecodeTable<FAT12::Width>();
+                    case T_FAT16: return DecodeTable<FAT16::Width>();
+                    case T_FAT32: return DecodeTable<FAT32::Width>();
+                }
+                return false;
+            }
+
+            /// @brief packs part of ClusterTable back into FileAllocationTable using the encoder for the type of the disk
+            /// @param FirstSector first sector of the FAT to rebuild
+            /// @param Count number of sectors to rebuild
+            void EncodeFAT(scim::dword FirstSector, scim::dword Count) {
+                // every entry that has at least one bit in the sectors is rebuilt. A FAT12 entry that hangs over the edge of the
+                // sectors also changes a byte outside them, but only to the value it already has unless that sector is dirty too
+                scim::qword FirstBit = (scim::qword)FirstSector * FS_Info.BPB.BytesPerSector * 8;
+                scim::qword EndBit = (scim::qword)(FirstSector + Count) * FS_Info.BPB.BytesPerSector * 8;
+                scim::dword First = scim::min(FirstBit / EntryBits, (scim::qword)ClusterCount);
+                scim::dword End = scim::min((EndBit + EntryBits - 1) / EntryBits, (scim::qword)ClusterCount);
+                if(First < FIRST_AVAILABLE_CLUSTER) First = FIRST_AVAILABLE_CLUSTER;
+                switch(Type) {
+                    case T_FAT12: EncodeTable<FAT12::Width>(First, End); break;
+                    case T_FAT16: EncodeTable<FAT16::Width>(First, End); break;
+                    case T_FAT32: EncodeTable<FAT32::Width>(First, End); break;
+                }
+            }
+
+            /// @brief unpacks FileAllocationTable into ClusterTable and builds the FreeClusters bitmap. This is the only place the FAT gets scanned
+            /// @tparam Width FAT12::Width, FAT16::Width, or FAT32::Width
+            /// @return true on success, false on failure
+            template<typename Width> bool DecodeTable() {
+                SCIM_COUNT(C_FAT_SCANS, 1);
+                // ClusterCount, ClusterTable, and FreeClusters were all set up by AllocateArena
+                // entries 0 and 1 hold the media descriptor and some flags instead of chain values so they are never decoded or written back
+                ClusterTable[0] = ClusterTable[1] = CHAIN_END;
+                for(scim::dword Cluster = FIRST_AVAILABLE_CLUSTER; Cluster < ClusterCount; Cluster++) {
+                    scim::dword Value = Width::Get(FileAllocationTable, Cluster);
+                    // each width has its own markers so they are swapped for ones that mean the same thing on every type of FAT
+                    if(Value >= Width::END) Value = CHAIN_END;
+                    else if(Value == Width::BAD) Value = CHAIN_BAD;
+                    ClusterTable[Cluster] = Value;
+                    if(!Value) FreeClusters[Cluster / 64] |= 1ULL << (Cluster % 64);
+                }
+                AllocationCursor = FIRST_AVAILABLE_CLUSTER;
                 return true;
             }
 
+            /// @brief packs a range of ClusterTable back into FileAllocationTable. Entries 0 and 1 and entries past ClusterCount are never touched
+            /// @tparam Width FAT12::Width, FAT16::Width, or FAT32::Width
+            /// @param First first cluster to pack. Must be at least FIRST_AVAILABLE_CLUSTER
+            /// @param End cluster after the last one to pack. Must be no more than ClusterCount
+            template<typename Width> void EncodeTable(scim::dword First, scim::dword End) {
+                for(scim::dword Cluster = First; Cluster < End; Cluster++) {
+                    scim::dword Value = ClusterTable[Cluster];
+                    if(Value == CHAIN_END) Value = Width::END;
+                    else if(Value == CHAIN_BAD) Value = Width::BAD;
+                    Width::Set(FileAllocationTable, Cluster, Value);
+                }
+            }
+
+            /// @brief change the value of a cluster in ClusterTable and keep FreeClusters up to date. The packed FAT isn't touched until
+            /// Flush, which only rebuilds and writes the sectors marked here
+            /// @param Cluster cluster number to change
+            /// @param Value next cluster in the chain, CHAIN_END, or 0 to free the cluster
+            void SetCluster(scim::dword Cluster, scim::dword Value) {
+                if(ClusterTable[Cluster] != Value) {
+                    // a FAT12 entry can be split across two sectors
+                    scim::qword FirstBit = (scim::qword)Cluster * EntryBits;
+                    MarkDirty(DirtyFATSectors, FirstBit / 8 / FS_Info.BPB.BytesPerSector);
+                    MarkDirty(DirtyFATSectors, (FirstBit + EntryBits - 1) / 8 / FS_Info.BPB.BytesPerSector);
+                }
+                ClusterTable[Cluster] = Value;
+                if(Value) {
+                    FreeClusters[Cluster / 64] &= ~(1ULL << (Cluster % 64));
+                    // allocating the cluster at the cursor means every cluster up to the next one is used
+                    if(Cluster == AllocationCursor) AllocationCursor++;
+                }
+                // clusters freed during a transaction still belong to a file on the disk image until Commit, so they can't be reused yet
+                else if(!InTransaction) {
+                    FreeClusters[Cluster / 64] |= 1ULL << (Cluster % 64);
+                    // freed clusters behind the cursor would otherwise never get reused until it wraps around
+                    if(Cluster < AllocationCursor) AllocationCursor = Cluster;
+                }
+            }
+
+            /// @brief free every cluster in a chain
+            /// @param Cluster first cluster of the chain. 0 is treated as an empty chain
+            void FreeChain(scim::dword Cluster) {
+                SCIM_TIME(P_CHAIN_WALK);
+                scim::dword NextCluster;
+                while(Cluster >= FIRST_AVAILABLE_CLUSTER && Cluster < ClusterCount) {
+                    NextCluster = ClusterTable[Cluster];
+                    SetCluster(Cluster, 0);
+                    Cluster = NextCluster;
+                }
+            }
+
             /// @brief read the FAT header data from the boot sector of a disk image into FS_Info
-            /// @param Image disk image to read from
             /// @return true on success, false on failure
-            bool ReadBootRecord(FILE *Image) {
-
-                // navigate to where the FAT header is expected to be
-                if(fseek(Image, FAT::BPB_OFFSET, SEEK_SET) < 0) 
-                    return false;
-                
+            bool ReadBootRecord() {
+                SCIM_TIME(P_READ_BOOT_RECORD);
+                SCIM_COUNT(C_SECTORS_READ, 1);
                 // because the BootRecord_t structure doesn't have any padding, it is possible to read the entire structures data all at once and all the values will still be in the right place
-                if(fread(&FS_Info, sizeof(BootRecord_t), 1, Image) <= 0) 
-                    return false;
+                return Image->Read(FAT::BPB_OFFSET, sizeof(BootRecord_t), &FS_Info);
+            }
+
+            /// @return size of RootDirectory in bytes, including the padding at the end of the last sector or cluster
+            size_t RootDirectorySize() {
+                if(RootDirectoryClusters) return (size_t)RootDirectoryClusterCount * FS_Info.BPB.SectorsPerCluster * FS_Info.BPB.BytesPerSector;
+                return (size_t)RootDirectorySectors * FS_Info.BPB.BytesPerSector;
+            }
+
+            /// @return size of RootDirectory in sectors
+            scim::dword RootDirectorySectorCount() {
+                return RootDirectorySize() / FS_Info.BPB.BytesPerSector;
+            }
+
+            /// @brief read the file meta-data in the root directory of a disk image into RootDirectory. Requires AllocateArena to have been
+            /// called, and on FAT32 requires the FAT to have been read too
+            /// @return true on success, false on failure
+            bool ReadRootDirectory() {
+                SCIM_TIME(P_READ_ROOT_DIRECTORY);
+
+                if(Type == T_FAT32) return ReadRootChain();
+                RootEntryCount = FS_Info.BPB.RootDirectoryEntries;
+
+                // a mapped root directory points straight into the image. Otherwise the data is read into the arena, which has
+                // room for RootDirectorySectors whole sectors because RootEntryCount might not fill the last one
+                if(RootDirectoryMapped) return true;
+                return ReadSectors(RootDirectoryLBA, RootDirectorySectors, RootDirectory);
+
+            }
+
+            /// @brief read a FAT32 root directory, which is a cluster chain like any other file. It is mapped if the whole chain is a
+            /// single extent, otherwise the clusters are copied into one buffer and RootDirectoryClusters remembers where each one came from
+            /// @return true on success, false on failure
+            bool ReadRootChain() {
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                Extent_t Extent;
+
+                // count the clusters first so everything can be allocated in one go
+                scim::dword ExtentCount = 0;
+                ExtentIterator Counter(this, FS_Info.EBPB32.RootCluster);
+                while(Counter.Next(&Extent)) {
+                    RootDirectoryClusterCount += Extent.Length;
+                    ExtentCount++;
+                }
+                if(Counter.Error || !RootDirectoryClusterCount) return false;
+
+                RootDirectoryClusters = (scim::dword *)malloc(RootDirectoryClusterCount * sizeof(scim::dword));
+                if(!RootDirectoryClusters) return false;
+                RootEntryCount = RootDirectoryClusterCount * ClusterBytes / sizeof(FAT::DirectoryEntry_t);
+
+                scim::dword Index = 0;
+                ExtentIterator Extents(this, FS_Info.EBPB32.RootCluster);
+                while(Extents.Next(&Extent))
+                    for(scim::dword i = 0; i < Extent.Length; i++)
+                        RootDirectoryClusters[Index++] = Extent.FirstCluster + i;
+
+                // point straight into the image if the root directory is in one piece and the device supports it
+                if(ExtentCount == 1) {
+                    RootDirectory = (FAT::DirectoryEntry_t *)MapSectors(Cluster2LBA(RootDirectoryClusters[0]), RootDirectoryClusterCount * FS_Info.BPB.SectorsPerCluster);
+                    RootDirectoryMapped = RootDirectory != NULL;
+                }
+
+                // the chain can grow, so its dirty sector bitmap is allocated on its own instead of in the arena
+                DirtyRootSectors = (scim::qword *)calloc((RootDirectorySectorCount() + 63) / 64, sizeof(scim::qword));
+                if(!DirtyRootSectors) return false;
+                if(RootDirectoryMapped) return true;
+
+                RootDirectory = (FAT::DirectoryEntry_t *)malloc(RootDirectorySize());
+                if(!RootDirectory) return false;
+                scim::byte *Destination = (scim::byte *)RootDirectory;
+                ExtentIterator Reader(this, FS_Info.EBPB32.RootCluster);
+                while(Reader.Next(&Extent)) {
+                    if(!ReadSectors(Cluster2LBA(Extent.FirstCluster), Extent.Length * FS_Info.BPB.SectorsPerCluster, Destination)) return false;
+                    Destination += Extent.Length * ClusterBytes;
+                }
+                return true;
+            }
+
+            /// @brief add another cluster to the end of a FAT32 root directory once every entry in it is in use. The new cluster is zeroed
+            /// on the disk image straight away, which is safe during a transaction because it was free before
+            /// @return true on success, false if the root directory can't grow
+            bool ExtendRootDirectory() {
+                if(!RootDirectoryClusters) return false;          // FAT12 and FAT16 root directories have a fixed size
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                size_t OldSize = RootDirectorySize();
+
+                scim::dword *Clusters = (scim::dword *)realloc(RootDirectoryClusters, (RootDirectoryClusterCount + 1) * sizeof(scim::dword));
+                if(!Clusters) return false;
+                RootDirectoryClusters = Clusters;
+
+                // the bigger root directory probably won't be in one piece any more so it moves into malloced memory
+                scim::byte *Resized;
+                if(RootDirectoryMapped) {
+                    Resized = (scim::byte *)malloc(OldSize + ClusterBytes);
+                    if(!Resized) return false;
+                    memcpy(Resized, RootDirectory, OldSize);
+                }
+                else {
+                    Resized = (scim::byte *)realloc(RootDirectory, OldSize + ClusterBytes);
+                    if(!Resized) return false;
+                }
+                RootDirectory = (FAT::DirectoryEntry_t *)Resized;
+                Root.Entries = RootDirectory;
+                RootDirectoryMapped = false;
+                memset(Resized + OldSize, 0, ClusterBytes);
+
+                // the new sectors need bits in the dirty map too
+                scim::dword OldWords = (RootDirectorySectorCount() + 63) / 64;
+                scim::dword NewWords = (RootDirectorySectorCount() + FS_Info.BPB.SectorsPerCluster + 63) / 64;
+                scim::qword *Dirty = (scim::qword *)realloc(DirtyRootSectors, NewWords * sizeof(scim::qword));
+                if(!Dirty) return false;
+                DirtyRootSectors = Dirty;
+                memset(Dirty + OldWords, 0, (NewWords - OldWords) * sizeof(scim::qword));
+
+                scim::dword NewCluster;
+                if(!AllocateChain(1, &NewCluster)) return false;
+                SetCluster(RootDirectoryClusters[RootDirectoryClusterCount - 1], NewCluster);
+                RootDirectoryClusters[RootDirectoryClusterCount++] = NewCluster;
+                RootEntryCount += ClusterBytes / sizeof(FAT::DirectoryEntry_t);
+                Root.EntryCount = RootEntryCount;
+
+                // anything left in the cluster would show up as entries otherwise
+                if(!ZeroFill(ClusterOffset(NewCluster), ClusterBytes)) return false;
+                return BuildIndex(&Root) && Flush();
+            }
 
+            /// @brief get the location of a root directory sector on the disk image
+            /// @param Sector index of the sector in RootDirectory
+            /// @return byte offset of the sector
+            scim::qword RootSectorOffset(scim::dword Sector) {
+                if(!RootDirectoryClusters) return SectorOffset(RootDirectoryLBA + Sector);
+                scim::dword LBA = Cluster2LBA(RootDirectoryClusters[Sector / FS_Info.BPB.SectorsPerCluster]) + Sector % FS_Info.BPB.SectorsPerCluster;
+                return SectorOffset(LBA);
+            }
+
+            /// @brief set a bit in a dirty sector bitmap
+            /// @param Bitmap DirtyFATSectors, DirtyRootSectors, or the DirtySectors of a sub-directory
+            /// @param Sector sector that changed
+            void MarkDirty(scim::qword *Bitmap, scim::dword Sector) {
+                Bitmap[Sector / 64] |= 1ULL << (Sector % 64);
+            }
+
+            /// @brief mark the sector holding a root directory entry as changed so the next Flush writes it
+            /// @param index index of the entry in the root directory
+            void MarkEntryDirty(scim::dword index) {
+                MarkDirty(DirtyRootSectors, index * sizeof(FAT::DirectoryEntry_t) / FS_Info.BPB.BytesPerSector);
+            }
+
+            /// @brief get a hash of an 11 character entry name with 32 bit FNV-1a
+            /// @param Name name in "NAME    EXT" format. Doesn't need a null terminator
+            /// @return hash of the name
+            static scim::dword HashName(const char *Name) {
+                scim::dword Hash = 2166136261u;
+                for(int i = 0; i < 11; i++) Hash = (Hash ^ (scim::byte)Name[i]) * 16777619u;
+                return Hash;
+            }
+
+            /// @param EntryCount number of entries in a directory
+            /// @return number of hash buckets the index of the directory has. Always a power of 2
+            scim::dword IndexBuckets(scim::dword EntryCount) {
+                scim::dword BucketCount = 1;
+                while(BucketCount < EntryCount) BucketCount *= 2;
+                return BucketCount;
+            }
+
+            /// @param EntryCount number of entries in a directory
+            /// @return number of entries the chain links and free slot stack of the directory's index have room for
+            scim::dword IndexSlots(scim::dword EntryCount) {
+                return EntryCount ? EntryCount : 1;
+            }
+
+            /// @brief (re)build the hash index, free slot stack, and EndIndex of a directory from its entries. Called when a directory is
+            /// read and whenever it grows. A FAT12 or FAT16 root directory reuses the index AllocateArena put in the arena, and every other
+            /// directory gets a new one on the heap
+            /// @param Directory directory to index. Entries and EntryCount must be set
+            /// @return true on success, false if there isn't enough memory
+            bool BuildIndex(Directory_t *Directory) {
+                scim::dword BucketCount = IndexBuckets(Directory->EntryCount);
+                size_t SlotCount = IndexSlots(Directory->EntryCount);
+                if(InArena(Directory->Buckets)) {
+                    memset(Directory->Buckets, 0, BucketCount * sizeof(scim::dword));
+                    memset(Directory->Chains, 0, SlotCount * sizeof(scim::dword));
+                    Directory->FreeSlotCount = 0;
+                }
+                else {
+                    scim::dword *Buckets = (scim::dword *)calloc(BucketCount, sizeof(scim::dword));
+                    scim::dword *Chains = (scim::dword *)calloc(SlotCount, sizeof(scim::dword));
+                    scim::dword *FreeSlots = (scim::dword *)malloc(SlotCount * sizeof(scim::dword));
+                    if(!Buckets || !Chains || !FreeSlots) {
+                        free(Buckets);
+                        free(Chains);
+                        free(FreeSlots);
+                        return false;
+                    }
+                    FreeIndex(Directory);
+                    Directory->Buckets = Buckets;
+                    Directory->Chains = Chains;
+                    Directory->FreeSlots = FreeSlots;
+                }
+                Directory->BucketMask = BucketCount - 1;
+                scim::dword *FreeSlots = Directory->FreeSlots;
+
+                Directory->EndIndex = Directory->EntryCount;
+                for(scim::dword i = 0; i < Directory->EntryCount; i++) {
+                    if(Directory->Entries[i].Name[0] != FAT::N_END) continue;
+                    Directory->EndIndex = i;
+                    break;
+                }
+                // free slots are pushed from the end so the lowest one comes off the stack first, which is the one a linear search would have found
+                for(scim::dword i = Directory->EndIndex; i-- > 0;)
+                    if(Directory->Entries[i].Name[0] == FAT::N_ENTRYFREE) FreeSlots[Directory->FreeSlotCount++] = i;
+                // long file name entries don't have a real name so they are left out
+                for(scim::dword i = 0; i < Directory->EndIndex; i++)
+                    if(Directory->Entries[i].Name[0] != FAT::N_ENTRYFREE && (Directory->Entries[i].Attributes & A_LONG_NAME) != A_LONG_NAME)
+                        IndexInsert(Directory, i);
+                return true;
+            }
+
+            /// @brief free the hash index and free slot stack of a directory, unless they are part of the arena
+            /// @param Directory directory to free the index of
+            void FreeIndex(Directory_t *Directory) {
+                Release(Directory->Buckets);
+                Release(Directory->Chains);
+                Release(Directory->FreeSlots);
+                Directory->Buckets = Directory->Chains = Directory->FreeSlots = NULL;
+                Directory->FreeSlotCount = 0;
+            }
+
+            /// @brief add an entry to the hash index of its directory
+            /// @param Directory directory the entry is in
+            /// @param Index index of the entry. Its name must already be filled in
+            void IndexInsert(Directory_t *Directory, scim::dword Index) {
+                scim::dword Bucket = HashName(Directory->Entries[Index].Name) & Directory->BucketMask;
+                Directory->Chains[Index] = Directory->Buckets[Bucket];
+                Directory->Buckets[Bucket] = Index + 1;
+            }
+
+            /// @brief take an entry out of the hash index of its directory. Must be called before the name is changed
+            /// @param Directory directory the entry is in
+            /// @param Index index of the entry
+            void IndexRemove(Directory_t *Directory, scim::dword Index) {
+                scim::dword *Link = &Directory->Buckets[HashName(Directory->Entries[Index].Name) & Directory->BucketMask];
+                while(*Link && *Link != Index + 1) Link = &Directory->Chains[*Link - 1];
+                if(*Link) *Link = Directory->Chains[Index];
+            }
+
+            /// @brief look a name up in the hash index of a directory
+            /// @param Directory directory to search
+            /// @param Name name in "NAME    EXT" format. Doesn't need a null terminator
+            /// @return index of the entry, or NO_ENTRY if the directory doesn't have one with that name
+            scim::dword IndexFind(Directory_t *Directory, const char *Name) {
+                for(scim::dword Link = Directory->Buckets[HashName(Name) & Directory->BucketMask]; Link; Link = Directory->Chains[Link - 1])
+                    if(!memcmp(Directory->Entries[Link - 1].Name, Name, 11)) return Link - 1;
+                return NO_ENTRY;
+            }
+
+            /// @brief get an unused entry in a directory. Deleted entries are reused first, then the N_END entry is moved along, and
+            /// only once every entry is in use does the directory get another cluster
+            /// @param Directory directory to get the entry from
+            /// @param IndexOut where the index of the entry is stored. The entry isn't in the hash index until IndexInsert is called
+            /// @return true on success, false if the directory is full and can't grow
+            bool TakeSlot(Directory_t *Directory, scim::dword *IndexOut) {
+                if(Directory->FreeSlotCount) {
+                    *IndexOut = Directory->FreeSlots[--Directory->FreeSlotCount];
+                    return true;
+                }
+                if(Directory->EndIndex == Directory->EntryCount && !(Directory == &Root ? ExtendRootDirectory() : ExtendDirectory(Directory))) return false;
+                *IndexOut = Directory->EndIndex++;
                 return true;
             }
 
-            /// @brief read the file meta-data in the root directory of a disk image into RootDirectory. Requires FS_Info to have valid values in it
-            /// @param Image disk image to read from
+            /// @brief mark an entry as deleted and make it available to TakeSlot again
+            /// @param Directory directory the entry is in
+            /// @param Index index of the entry
+            void ReleaseSlot(Directory_t *Directory, scim::dword Index) {
+                IndexRemove(Directory, Index);
+                Directory->Entries[Index].Name[FAT::I_SPECIALCHAR] = FAT::N_ENTRYFREE;
+                SetFirstCluster(&Directory->Entries[Index], 0);
+                Directory->FreeSlots[Directory->FreeSlotCount++] = Index;
+                MarkSlotDirty(Directory, Index);
+            }
+
+            /// @brief fill in a new entry, setting every time and date to now
+            /// @param Entry entry to fill in
+            /// @param Name name in "NAME    EXT" format
+            /// @param Attributes FAT::FILE_ATTRIBUTES of the entry
+            /// @param Cluster first cluster of the entry's chain. 0 for empty files
+            /// @param Size size of the file in bytes. 0 for directories
+            void FillEntry(FAT::DirectoryEntry_t *Entry, const char *Name, scim::byte Attributes, scim::dword Cluster, scim::dword Size) {
+                // get the current time and date. localtime_r for the same reason as in SetModificationTime
+                time_t now = time(0);
+                tm NowLocal;
+                localtime_r(&now, &NowLocal);
+
+                memcpy(Entry->Name, Name, 11);
+                Entry->Attributes = Attributes;
+                Entry->_reserved = 0;
+                if(NowLocal.tm_sec & 1) Entry->CreationTimeCents = 100;
+                else Entry->CreationTimeCents = 0;
+                Entry->CreationDate = FAT::localtime2FatDate(&NowLocal);
+                Entry->AccessedDate = FAT::localtime2FatDate(&NowLocal);
+                Entry->CreationTime = FAT::localtime2FatTime(&NowLocal);
+                Entry->ModificationTime = FAT::localtime2FatTime(&NowLocal);
+                Entry->ModificationDate = FAT::localtime2FatDate(&NowLocal);
+                Entry->FirstClusterHigh = 0;
+                SetFirstCluster(Entry, Cluster);
+                Entry->Size = Size;
+            }
+
+            /// @brief find the directory that a pointer to an entry points into
+            /// @param Entry pointer to check
+            /// @param DirectoryOut where the directory is stored
+            /// @param IndexOut where the index of the entry in the directory is stored
+            /// @return true on success, false if the pointer isn't in the root directory or a loaded sub-directory
+            bool OwnerOf(const FAT::DirectoryEntry_t *Entry, Directory_t **DirectoryOut, scim::dword *IndexOut) {
+                if(!RootDirectory) return false;
+                for(Directory_t *Directory = &Root; Directory; Directory = Directory == &Root ? Directories : Directory->Next) {
+                    if(Entry < Directory->Entries || Entry >= Directory->Entries + Directory->EntryCount) continue;
+                    *DirectoryOut = Directory;
+                    *IndexOut = Entry - Directory->Entries;
+                    return true;
+                }
+                return false;
+            }
+
+            /// @brief read a sub-directory and index it, unless it has already been loaded
+            /// @param Cluster first cluster of the sub-directory. 0 gives the root directory, which is what ".." uses at the top level
+            /// @return the directory on success, NULL on failure
+            Directory_t *LoadDirectory(scim::dword Cluster) {
+                if(!Cluster) return &Root;
+                for(Directory_t *Directory = Directories; Directory; Directory = Directory->Next)
+                    if(Directory->FirstCluster == Cluster) return Directory;
+                SCIM_TIME(P_READ_ROOT_DIRECTORY);
+
+                Directory_t *Directory = new Directory_t;
+                Directory->FirstCluster = Cluster;
+                Extent_t Extent;
+                ExtentIterator Counter(this, Cluster);
+                while(Counter.Next(&Extent)) Directory->ClusterCount += Extent.Length;
+                if(Counter.Error || !Directory->ClusterCount) {
+                    delete Directory;
+                    return NULL;
+                }
+
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                Directory->EntryCount = Directory->ClusterCount * ClusterBytes / sizeof(FAT::DirectoryEntry_t);
+                Directory->Clusters = (scim::dword *)malloc(Directory->ClusterCount * sizeof(scim::dword));
+                Directory->Entries = (FAT::DirectoryEntry_t *)malloc((size_t)Directory->ClusterCount * ClusterBytes);
+                Directory->DirtySectors = (scim::qword *)calloc((DirectorySectorCount(Directory) + 63) / 64, sizeof(scim::qword));
+                bool Success = Directory->Clusters && Directory->Entries && Directory->DirtySectors;
+
+                // sub-directories always live in malloced memory so they work the same way inside and outside of transactions
+                scim::dword Index = 0;
+                ExtentIterator Reader(this, Cluster);
+                while(Success && Reader.Next(&Extent)) {
+                    Success = ReadSectors(Cluster2LBA(Extent.FirstCluster), Extent.Length * FS_Info.BPB.SectorsPerCluster,
+                                          (scim::byte *)Directory->Entries + (size_t)Index * ClusterBytes);
+                    for(scim::dword i = 0; i < Extent.Length; i++) Directory->Clusters[Index++] = Extent.FirstCluster + i;
+                }
+                Directory->Next = Directories;
+                Directories = Directory;
+                if(!Success || !BuildIndex(Directory)) {
+                    UnloadDirectory(Directory);
+                    return NULL;
+                }
+                return Directory;
+            }
+
+            /// @brief find every file that has a cluster chain in a directory and every sub-directory under it, loading the
+            /// sub-directories that haven't been used yet
+            /// @param Directory directory to start from
+            /// @param Depth how many sub-directories deep Directory is. 0 for the root directory
+            /// @param Files malloced array the files are added to with Append. NULL if it is empty
+            /// @param FileCount number of files in the array
+            /// @return true on success, false if a sub-directory can't be read, they are nested deeper than MAX_DIRECTORY_DEPTH, or
+            /// there isn't enough memory
+            bool ListFiles(Directory_t *Directory, scim::dword Depth, FileSlot_t **Files, scim::dword *FileCount) {
+                if(Depth > MAX_DIRECTORY_DEPTH) return false;
+                for(scim::dword i = 0; i < Directory->EndIndex; i++) {
+                    FAT::DirectoryEntry_t *Entry = &Directory->Entries[i];
+                    // long file name entries have the volume name bit set too, and "." and ".." are the directories themselves
+                    if(Entry->Name[0] == N_ENTRYFREE || Entry->Name[0] == '.' || (Entry->Attributes & A_VOLUME_NAME)) continue;
+                    if(FirstCluster(Entry) < FIRST_AVAILABLE_CLUSTER) continue;
+                    if(Entry->Attributes & A_DIRECTORY) {
+                        Directory_t *SubDirectory = LoadDirectory(FirstCluster(Entry));
+                        if(!SubDirectory || !ListFiles(SubDirectory, Depth + 1, Files, FileCount)) return false;
+                        continue;
+                    }
+                    FileSlot_t File = { Directory, i };
+                    if(!Append(Files, FileCount, &File)) return false;
+                }
+                return true;
+            }
+
+            /// @brief free a loaded sub-directory and take it out of the list. Any of its sectors that haven't been flushed are lost
+            /// @param Directory sub-directory to free
+            void UnloadDirectory(Directory_t *Directory) {
+                Directory_t **Link = &Directories;
+                while(*Link && *Link != Directory) Link = &(*Link)->Next;
+                if(*Link) *Link = Directory->Next;
+                FreeIndex(Directory);
+                free(Directory->Entries);
+                free(Directory->Clusters);
+                free(Directory->DirtySectors);
+                delete Directory;
+            }
+
+            /// @brief add another cluster to the end of a sub-directory once every entry in it is in use. Works like ExtendRootDirectory
+            /// @param Directory loaded sub-directory to extend
             /// @return true on success, false on failure
-            bool ReadRootDirectory(FILE *Image) {
-                
-                // calculate the LBA of the root directory
-                // the root directory is located directly after the FAT region of the disk, which is located after the reserved sectors at the start of the disk
-                scim::word RootDirectoryLBA = FS_Info.BPB.ReservedSectors + (FS_Info.BPB.TotalFATs * FS_Info.BPB.SectorsPerFAT);
-
-                // calculate the size of the root directory in sectors
-                unsigned int RootDirectoryBytes = sizeof(FAT::DirectoryEntry_t) * FS_Info.BPB.RootDirectoryEntries;
-                // division operations always round down with integers so when a division needs to be rounded up, which it does in this case to make sure we read the whole thing, we can add the divisor - 1 to the dividend
-                scim::word RootDirectorySectors = (RootDirectoryBytes + (FS_Info.BPB.BytesPerSector - 1)) / FS_Info.BPB.BytesPerSector;
-
-                // make space to store the root directory data when it is read
-                // we shouldn't use RootDirectoryBytes here because if RootDirectorySectors is rounded to the next sector then RootDirectoryBytes will be inaccurate
-                RootDirectory = (FAT::DirectoryEntry_t *)malloc(RootDirectorySectors * FS_Info.BPB.BytesPerSector);
+            bool ExtendDirectory(Directory_t *Directory) {
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                scim::dword *Clusters = (scim::dword *)realloc(Directory->Clusters, (Directory->ClusterCount + 1) * sizeof(scim::dword));
+                if(!Clusters) return false;
+                Directory->Clusters = Clusters;
+                scim::byte *Resized = (scim::byte *)realloc(Directory->Entries, (size_t)(Directory->ClusterCount + 1) * ClusterBytes);
+                if(!Resized) return false;
+                Directory->Entries = (FAT::DirectoryEntry_t *)Resized;
+                memset(Resized + (size_t)Directory->ClusterCount * ClusterBytes, 0, ClusterBytes);
+
+                scim::dword OldWords = (DirectorySectorCount(Directory) + 63) / 64;
+                scim::dword NewWords = (DirectorySectorCount(Directory) + FS_Info.BPB.SectorsPerCluster + 63) / 64;
+                scim::qword *Dirty = (scim::qword *)realloc(Directory->DirtySectors, NewWords * sizeof(scim::qword));
+                if(!Dirty) return false;
+                Directory->DirtySectors = Dirty;
+                memset(Dirty + OldWords, 0, (NewWords - OldWords) * sizeof(scim::qword));
+
+                scim::dword NewCluster;
+                if(!AllocateChain(1, &NewCluster)) return false;
+                SetCluster(Directory->Clusters[Directory->ClusterCount - 1], NewCluster);
+                Directory->Clusters[Directory->ClusterCount++] = NewCluster;
+                Directory->EntryCount += ClusterBytes / sizeof(FAT::DirectoryEntry_t);
+
+                if(!ZeroFill(ClusterOffset(NewCluster), ClusterBytes)) return false;
+                return BuildIndex(Directory) && Flush();
+            }
+
+            /// @brief follow the directories in a path from the root directory, loading each one that hasn't been used yet
+            /// @param Path path made of host names separated by '/'. Empty components from leading or doubled slashes are skipped
+            /// @param Length number of characters of Path to use
+            /// @return the last directory in the path on success, NULL if any part of it isn't a directory
+            Directory_t *FindDirectory(const char *Path, size_t Length) {
+                Directory_t *Directory = &Root;
+                for(size_t Start = 0; Start < Length;) {
+                    size_t End = Start;
+                    while(End < Length && Path[End] != '/') End++;
+                    if(End > Start) {
+                        char Component[MAX_PATH_COMPONENT + 1], Name[12];
+                        if(End - Start > MAX_PATH_COMPONENT) return NULL;
+                        memcpy(Component, Path + Start, End - Start);
+                        Component[End - Start] = '\0';
+                        if(!HostName2FatName(Component, Name)) return NULL;
+                        scim::dword Index = IndexFind(Directory, Name);
+                        if(Index == NO_ENTRY || !(Directory->Entries[Index].Attributes & A_DIRECTORY)) return NULL;
+                        Directory = LoadDirectory(FirstCluster(&Directory->Entries[Index]));
+                        if(!Directory) return NULL;
+                    }
+                    Start = End + 1;
+                }
+                return Directory;
+            }
+
+            /// @brief split a name or path into the directory it belongs in and the 11 character name of its entry
+            /// @param Path name in "NAME    EXT" format, which is always in the root directory, or a path with at least one '/' in it
+            /// @param DirectoryOut where the directory is stored
+            /// @param NameOut where the name is stored in "NAME    EXT" format. Must have space for 12 characters
+            /// @return true on success, false if the directory doesn't exist or the name isn't valid
+            bool ResolvePath(const char *Path, Directory_t **DirectoryOut, char *NameOut) {
                 if(!RootDirectory) return false;
+                const char *Slash = strrchr(Path, '/');
+                if(!Slash) {
+                    if(strlen(Path) != 11) return false;
+                    memcpy(NameOut, Path, 12);
+                    *DirectoryOut = &Root;
+                    return true;
+                }
+                *DirectoryOut = FindDirectory(Path, Slash - Path);
+                return *DirectoryOut && HostName2FatName(Slash + 1, NameOut);
+            }
 
-                // read the data
-                if(!ReadSectors(Image, RootDirectoryLBA, RootDirectorySectors, RootDirectory))
-                    return false;
+            /// @return number of sectors in a directory
+            scim::dword DirectorySectorCount(Directory_t *Directory) {
+                if(Directory == &Root) return RootDirectorySectorCount();
+                return Directory->ClusterCount * FS_Info.BPB.SectorsPerCluster;
+            }
+
+            /// @brief get the location of a directory sector on the disk image
+            /// @param Directory the root directory or a loaded sub-directory
+            /// @param Sector index of the sector in the directory
+            /// @return byte offset of the sector
+            scim::qword DirectorySectorOffset(Directory_t *Directory, scim::dword Sector) {
+                if(Directory == &Root) return RootSectorOffset(Sector);
+                scim::dword LBA = Cluster2LBA(Directory->Clusters[Sector / FS_Info.BPB.SectorsPerCluster]) + Sector % FS_Info.BPB.SectorsPerCluster;
+                return SectorOffset(LBA);
+            }
+
+            /// @return the dirty sector bitmap of a directory
+            scim::qword *DirtyBitmap(Directory_t *Directory) {
+                return Directory == &Root ? DirtyRootSectors : Directory->DirtySectors;
+            }
+
+            /// @brief mark the sector holding an entry as changed so the next Flush writes it
+            /// @param Directory directory the entry is in
+            /// @param Index index of the entry in the directory
+            void MarkSlotDirty(Directory_t *Directory, scim::dword Index) {
+                MarkDirty(DirtyBitmap(Directory), Index * sizeof(FAT::DirectoryEntry_t) / FS_Info.BPB.BytesPerSector);
+            }
+
+            /// @brief find the next set bit in a dirty sector bitmap a word at a time
+            /// @param Bitmap DirtyFATSectors, DirtyRootSectors, or the DirtySectors of a sub-directory
+            /// @param Sector sector to start searching from
+            /// @param Count number of sectors the bitmap covers
+            /// @return the first dirty sector at or after Sector, or Count if there aren't any
+            scim::dword NextDirty(const scim::qword *Bitmap, scim::dword Sector, scim::dword Count) {
+                while(Sector < Count) {
+                    scim::qword Bits = Bitmap[Sector / 64] & (~0ULL << (Sector % 64));
+                    if(Bits) return scim::min((scim::qword)(Sector / 64 * 64 + __builtin_ctzll(Bits)), (scim::qword)Count);
+                    Sector = (Sector / 64 + 1) * 64;
+                }
+                return Count;
+            }
+
+            /// @brief write every dirty directory and FAT sector back to the disk image and clear the dirty bitmaps. Dirty FAT
+            /// sectors are rebuilt from ClusterTable and written to every FAT copy, so the copies can't drift apart. Nothing is written
+            /// during a transaction, and nothing is copied for the parts of the root directory and FAT that are mapped
+            /// @return true on success, false on failure
+            bool Flush() {
+                if(InTransaction) return true;          // Commit flushes everything that changed during the transaction
+                SCIM_TIME(P_METADATA_WRITE);
+                for(Directory_t *Directory = &Root; Directory; Directory = Directory == &Root ? Directories : Directory->Next)
+                    if(!FlushDirectory(Directory)) return false;
+                bool FATChanged = NextDirty(DirtyFATSectors, 0, FATSectors) < FATSectors;
+                if(!FlushFAT()) return false;
+                return !FATChanged || WriteFSInfo();
+            }
 
-                DataSectionLBA = RootDirectoryLBA + RootDirectorySectors;
+            /// @brief write the dirty sectors of a directory, merging neighbouring sectors that are next to each other on the disk image into one write
+            /// @param Directory the root directory or a loaded sub-directory
+            /// @return true on success, false on failure
+            bool FlushDirectory(Directory_t *Directory) {
+                scim::qword *Dirty = DirtyBitmap(Directory);
+                scim::dword Sectors = DirectorySectorCount(Directory);
+                scim::dword Length;
+                for(scim::dword Sector = NextDirty(Dirty, 0, Sectors); Sector < Sectors; Sector = NextDirty(Dirty, Sector + Length, Sectors)) {
+                    // a run in a cluster chain has to stop at the end of a cluster unless the next cluster follows on
+                    for(Length = 1; Sector + Length < Sectors && NextDirty(Dirty, Sector + Length, Sectors) == Sector + Length &&
+                        DirectorySectorOffset(Directory, Sector + Length) == DirectorySectorOffset(Directory, Sector) + (scim::qword)Length * FS_Info.BPB.BytesPerSector; Length++);
+                    SCIM_COUNT(C_SECTORS_WRITTEN, Length);
+                    if(!Image->Write(DirectorySectorOffset(Directory, Sector), (size_t)Length * FS_Info.BPB.BytesPerSector,
+                                     (scim::byte *)Directory->Entries + (size_t)Sector * FS_Info.BPB.BytesPerSector))
+                        return false;
+                }
+                memset(Dirty, 0, (Sectors + 63) / 64 * sizeof(scim::qword));
+                return true;
+            }
 
+            /// @brief rebuild each run of dirty FAT sectors from ClusterTable and write it to every FAT copy before moving on to the next run
+            /// @return true on success, false on failure
+            bool FlushFAT() {
+                scim::dword Length;
+                for(scim::dword Sector = NextDirty(DirtyFATSectors, 0, FATSectors); Sector < FATSectors; Sector = NextDirty(DirtyFATSectors, Sector + Length, FATSectors)) {
+                    for(Length = 1; Sector + Length < FATSectors && NextDirty(DirtyFATSectors, Sector + Length, FATSectors) == Sector + Length; Length++);
+                    EncodeFAT(Sector, Length);
+                    SCIM_COUNT(C_SECTORS_WRITTEN, (scim::qword)Length * FATCopies);
+                    for(scim::dword Copy = 0; Copy < FATCopies; Copy++)
+                        if(!Image->Write(SectorOffset(FirstFATCopyLBA + Copy * FATSectors + Sector), SectorOffset(Length),
+                                         FileAllocationTable + (size_t)Sector * FS_Info.BPB.BytesPerSector))
+                            return false;
+                }
+                memset(DirtyFATSectors, 0, (FATSectors + 63) / 64 * sizeof(scim::qword));
                 return true;
+            }
 
+            /// @brief update the free cluster count and next free cluster hint in the FAT32 FSInfo sector so other drivers don't trust old values
+            /// @return true on success or if the disk doesn't have an FSInfo sector, false on failure
+            bool WriteFSInfo() {
+                if(!FSInfoLBA) return true;
+                SCIM_COUNT(C_SECTORS_WRITTEN, 1);
+                scim::dword FreeCount = 0;
+                for(scim::dword Word = 0; Word < (ClusterCount + 63) / 64; Word++)
+                    FreeCount += __builtin_popcountll(FreeClusters[Word]);
+                // the next free hint is 0xFFFFFFFF when it isn't known, which is the case when the disk is full
+                scim::dword Hints[2] = { FreeCount, AllocationCursor < ClusterCount ? AllocationCursor : 0xFFFFFFFF };
+                return Image->Write((scim::qword)FSInfoLBA * FS_Info.BPB.BytesPerSector + offsetof(FAT32::FSInfo_t, FreeCount), sizeof(Hints), Hints);
             }
 
-            bool WriteEntryData(FILE* Image, FAT::DirectoryEntry_t *Entry, scim::word index) {
-                scim::word RootDirectoryLBA = FS_Info.BPB.ReservedSectors + (FS_Info.BPB.TotalFATs * FS_Info.BPB.SectorsPerFAT);
-                
-                if(fseek(Image, (RootDirectoryLBA * FS_Info.BPB.BytesPerSector) + (index * sizeof(FAT::DirectoryEntry_t)), SEEK_SET) < 0) return false;
-                if(fwrite(Entry, sizeof(FAT::DirectoryEntry_t), 1, Image) <= 0) return false;
-                
+            /// @brief add an item to the end of a malloced array. The array doubles in size whenever Count reaches a power of 2 so it
+            /// doesn't need a separate capacity
+            /// @param Array array to add to. NULL if it is empty
+            /// @param Count number of items in the array. Increased by 1
+            /// @param Item item to copy into the array
+            /// @return true on success, false if there isn't enough memory
+            template<typename T> bool Append(T **Array, scim::dword *Count, const T *Item) {
+                if(!(*Count & (*Count - 1))) {
+                    T *Grown = (T *)realloc(*Array, (*Count ? *Count * 2 : 1) * sizeof(T));
+                    if(!Grown) return false;
+                    *Array = Grown;
+                }
+                (*Array)[(*Count)++] = *Item;
                 return true;
             }
 
-            bool WriteFAT(FILE *Image) {
-                if(fseek(Image, FS_Info.BPB.ReservedSectors * FS_Info.BPB.BytesPerSector, SEEK_SET) < 0) return false;
-                if(fwrite(FileAllocationTable, FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerFAT, 1, Image) <= 0) return false;
+            /// @brief add a problem to the report that Check is filling in
+            /// @param State state of the check
+            /// @param Type CHECK_PROBLEMS value
+            /// @param Name entry the problem was found in in "NAME    EXT" format, or "" if it wasn't in an entry
+            /// @param Cluster see Problem_t
+            /// @param Length see Problem_t
+            /// @param Size see Problem_t
+            void AddProblem(CheckState_t *State, CHECK_PROBLEMS Type, const char *Name, scim::dword Cluster, scim::dword Length, scim::qword Size) {
+                Problem_t Problem;
+                Problem.Type = Type;
+                snprintf(Problem.Name, sizeof(Problem.Name), "%s", Name);
+                Problem.Cluster = Cluster;
+                Problem.Length = Length;
+                Problem.Size = Size;
+                State->Report->Counts[Type]++;
+                if(!Append(&State->Report->Problems, &State->Report->ProblemCount, &Problem)) State->Failed = true;
+            }
+
+            /// @brief compare every FAT copy that gets written against the FAT that was read a sector at a time. When repairing, the
+            /// sectors that differ are marked dirty so the commit writes the FAT that was read over every copy
+            /// @param State state of the check
+            void CheckFATCopies(CheckState_t *State) {
+                size_t BytesPerSector = FS_Info.BPB.BytesPerSector;
+                scim::byte *Buffer = NULL;          // only needed if the device can't be mapped
+                for(scim::dword Copy = 0; Copy < FATCopies; Copy++) {
+                    scim::dword LBA = FirstFATCopyLBA + Copy * FATSectors;
+                    if(LBA == FATLBA) continue;
+                    const scim::byte *CopyData = MapSectors(LBA, FATSectors);
+                    if(!CopyData) {
+                        if(!Buffer) Buffer = (scim::byte *)malloc((size_t)FATSectors * BytesPerSector);
+                        if(!Buffer || !ReadSectors(LBA, FATSectors, Buffer)) {
+                            State->Failed = true;
+                            break;
+                        }
+                        CopyData = Buffer;
+                    }
+                    scim::dword Differing = 0;
+                    for(scim::dword Sector = 0; Sector < FATSectors; Sector++) {
+                        if(!memcmp(CopyData + Sector * BytesPerSector, FileAllocationTable + Sector * BytesPerSector, BytesPerSector)) continue;
+                        Differing++;
+                        if(State->Repair) MarkDirty(DirtyFATSectors, Sector);
+                    }
+                    if(Differing) AddProblem(State, CP_FAT_MISMATCH, "", Copy, Differing, 0);
+                }
+                free(Buffer);
+            }
+
+            /// @brief walk a chain for Check, claiming each of its clusters in State->Owners. The walk stops at the first cluster that
+            /// can't be part of the chain, and when repairing the chain is cut off just before it
+            /// @param State state of the check
+            /// @param Cluster first cluster of the chain. Must not be 0
+            /// @param Name entry the chain belongs to in "NAME    EXT" format
+            /// @return number of clusters in the chain before the first problem, which is all of them if there wasn't one
+            scim::dword CheckChain(CheckState_t *State, scim::dword Cluster, const char *Name) {
+                SCIM_TIME(P_CHAIN_WALK);
+                scim::dword Chain = ++State->Chains, Previous = 0, Length = 0;
+                while(Cluster != CHAIN_END) {
+                    // owners are checked first because repairing an earlier chain can free a cluster it shared with this one
+                    CHECK_PROBLEMS Problem = CP_COUNT;
+                    if(IsDataCluster(Cluster) && State->Owners[Cluster] == Chain) Problem = CP_LOOP;
+                    else if(IsDataCluster(Cluster) && State->Owners[Cluster]) Problem = CP_CROSS_LINK;
+                    else if(!IsDataCluster(Cluster) || !ClusterTable[Cluster] || ClusterTable[Cluster] == CHAIN_BAD) Problem = CP_BAD_REFERENCE;
+                    if(Problem != CP_COUNT) {
+                        AddProblem(State, Problem, Name, Cluster, Length, 0);
+                        if(State->Repair && Previous) SetCluster(Previous, CHAIN_END);
+                        break;
+                    }
+                    State->Owners[Cluster] = Chain;
+                    Previous = Cluster;
+                    Length++;
+                    Cluster = ClusterTable[Cluster];
+                }
+                State->Report->UsedClusters += Length;
+                return Length;
+            }
+
+            /// @brief check the chain of every entry in part of a directory, and the size of every file against its chain. Sub-directories
+            /// are checked as they are found. When repairing, a file whose chain is longer than its size needs has the extra clusters
+            /// freed and a file whose chain is shorter is cut down to the size of its chain
+            /// @param State state of the check
+            /// @param Entries entries to check. Either RootDirectory or a copy of one cluster of a sub-directory
+            /// @param Count number of entries
+            /// @param Offset byte offset of Entries on the disk image, or 0 for the root directory
+            /// @param Depth how many sub-directories deep Entries is. 0 for the root directory
+            /// @return false if the end of the directory was found, true if there could be more entries after these
+            bool CheckEntries(CheckState_t *State, FAT::DirectoryEntry_t *Entries, scim::dword Count, scim::qword Offset, scim::dword Depth) {
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                for(scim::dword i = 0; i < Count && !State->Failed; i++) {
+                    FAT::DirectoryEntry_t *Entry = &Entries[i];
+                    if(Entry->Name[0] == FAT::N_END) return false;
+                    // long file name entries have the volume name bit set too, and neither kind has a chain
+                    if(Entry->Name[0] == FAT::N_ENTRYFREE || (Entry->Attributes & FAT::A_VOLUME_NAME)) continue;
+                    // "." and ".." point at directories that get checked from their own entries
+                    if(Entry->Name[0] == '.') continue;
+
+                    char Name[12];
+                    memcpy(Name, Entry->Name, 11);
+                    Name[11] = '\0';
+                    scim::dword First = FirstCluster(Entry);
+                    scim::dword Length = First ? CheckChain(State, First, Name) : 0;
+                    bool Changed = false;
+                    // not even the first cluster could be kept
+                    if(First && !Length && State->Repair) {
+                        SetFirstCluster(Entry, 0);
+                        Changed = true;
+                    }
+
+                    if(Entry->Attributes & FAT::A_DIRECTORY) {
+                        State->Report->Directories++;
+                        if(Length) CheckDirectory(State, First, Length, Depth + 1);
+                    }
+                    else {
+                        State->Report->Files++;
+                        scim::qword ClustersNeeded = (Entry->Size + ClusterBytes - 1) / ClusterBytes;
+                        if(ClustersNeeded != Length) {
+                            AddProblem(State, CP_SIZE_MISMATCH, Name, First, Length, Entry->Size);
+                            if(State->Repair && ClustersNeeded < Length) {
+                                scim::dword Last = First;
+                                for(scim::qword Cluster = 1; Cluster < ClustersNeeded; Cluster++) Last = ClusterTable[Last];
+                                if(!ClustersNeeded) {
+                                    FreeChain(First);
+                                    SetFirstCluster(Entry, 0);
+                                }
+                                else {
+                                    scim::dword Tail = ClusterTable[Last];
+                                    SetCluster(Last, CHAIN_END);
+                                    FreeChain(Tail);
+                                }
+                            }
+                            // the data past the end of the chain is gone, so the file is cut down to what is left
+                            else if(State->Repair) Entry->Size = (scim::qword)Length * ClusterBytes;
+                            Changed = State->Repair;
+                        }
+                    }
+
+                    if(!Changed) continue;
+                    if(!Offset) MarkEntryDirty(i);
+                    else {
+                        DirectoryFix_t Fix;
+                        Fix.Offset = Offset + i * sizeof(FAT::DirectoryEntry_t);
+                        Fix.Entry = *Entry;
+                        if(!Append(&State->Fixes, &State->FixCount, &Fix)) State->Failed = true;
+                    }
+                }
                 return true;
             }
 
-            /// @brief finds the next cluster in the FAT that isnt being used
-            /// @return the cluster number of the first free cluster
-            scim::word NextFreeCluster() {
-                scim::word FatIndex;
-                for(int i = FIRST_AVAILABLE_CLUSTER;; i++) {
-                    FatIndex = i * 3 / 2;
-                    if((i & 1) && (*(scim::word *)(FileAllocationTable + FatIndex) >> 4) == 0) return i;
-                    if(!(i & 1) && (*(scim::word *)(FileAllocationTable + FatIndex) & 0xfff) == 0) return i;
+            /// @brief check every entry in a sub-directory a cluster at a time
+            /// @param State state of the check
+            /// @param Cluster first cluster of the sub-directory
+            /// @param Length number of clusters CheckChain kept in the sub-directory's chain
+            /// @param Depth how many sub-directories deep this one is
+            void CheckDirectory(CheckState_t *State, scim::dword Cluster, scim::dword Length, scim::dword Depth) {
+                if(Depth > MAX_DIRECTORY_DEPTH) {
+                    State->Failed = true;
+                    return;
+                }
+                size_t ClusterBytes = FS_Info.BPB.BytesPerSector * FS_Info.BPB.SectorsPerCluster;
+                // the entries are copied even if the device is mapped so repairs can't reach the disk image before the FAT is committed
+                FAT::DirectoryEntry_t *Entries = (FAT::DirectoryEntry_t *)malloc(ClusterBytes);
+                if(!Entries) {
+                    State->Failed = true;
+                    return;
+                }
+                for(scim::dword i = 0; i < Length && !State->Failed; i++, Cluster = ClusterTable[Cluster]) {
+                    if(!ReadSectors(Cluster2LBA(Cluster), FS_Info.BPB.SectorsPerCluster, Entries)) {
+                        State->Failed = true;
+                        break;
+                    }
+                    if(!CheckEntries(State, Entries, ClusterBytes / sizeof(FAT::DirectoryEntry_t), ClusterOffset(Cluster), Depth)) break;
                 }
+                free(Entries);
+            }
+
+            /// @brief check if a cluster is used but wasn't claimed by any chain
+            /// @param State state of the check
+            /// @param Cluster FAT cluster number. Must be less than ClusterCount
+            /// @return true if the cluster is lost, false otherwise
+            bool IsLost(CheckState_t *State, scim::dword Cluster) {
+                return ClusterTable[Cluster] && ClusterTable[Cluster] != CHAIN_BAD && !State->Owners[Cluster];
+            }
+
+            /// @brief find the used clusters that no chain claimed in one pass over the decoded FAT and report them as lost chains. A lost
+            /// cluster that another lost cluster points to can't be the start of a lost chain, so every chain is walked once from its start.
+            /// Anything still left after that is a lost loop, which doesn't have a start. When repairing, every lost cluster is freed
+            /// @param State state of the check
+            void FindLostChains(CheckState_t *State) {
+                if(State->Failed) return;
+                scim::qword *PointedTo = (scim::qword *)calloc((ClusterCount + 63) / 64, sizeof(scim::qword));
+                if(!PointedTo) {
+                    State->Failed = true;
+                    return;
+                }
+                for(scim::dword Cluster = FIRST_AVAILABLE_CLUSTER; Cluster < ClusterCount; Cluster++) {
+                    if(ClusterTable[Cluster] == CHAIN_BAD) State->Report->BadClusters++;
+                    if(!IsLost(State, Cluster)) continue;
+                    State->Report->LostClusters++;
+                    if(IsDataCluster(ClusterTable[Cluster])) PointedTo[ClusterTable[Cluster] / 64] |= 1ULL << (ClusterTable[Cluster] % 64);
+                }
+                for(int Pass = 0; Pass < 2; Pass++) {
+                    for(scim::dword Cluster = FIRST_AVAILABLE_CLUSTER; Cluster < ClusterCount; Cluster++) {
+                        if(!IsLost(State, Cluster) || (!Pass && (PointedTo[Cluster / 64] & (1ULL << (Cluster % 64))))) continue;
+                        scim::dword Length = 0;
+                        for(scim::dword Next = Cluster; IsDataCluster(Next) && IsLost(State, Next); Next = ClusterTable[Next]) {
+                            State->Owners[Next] = LOST_OWNER;
+                            Length++;
+                        }
+                        AddProblem(State, CP_LOST_CHAIN, "", Cluster, Length, 0);
+                    }
+                }
+                if(State->Repair)
+                    for(scim::dword Cluster = FIRST_AVAILABLE_CLUSTER; Cluster < ClusterCount; Cluster++)
+                        if(State->Owners[Cluster] == LOST_OWNER) SetCluster(Cluster, 0);
+                free(PointedTo);
             }
 
     };
 
-}                           // contains FAT and cluster information exclusive to FAT12
+}                           // contains the FAT driver shared by FAT12, FAT16, and FAT32
@@ -0,0 +1,313 @@
+// format.hpp
+//
+// format mode for SCIM, which creates a new FAT formatted disk image from a geometry profile, and geometry mode, which writes a
+// profile out for boot.s and the makefile
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Format {
+
+    // Profile_t, Profiles, Layouts, and FindProfile are in geometry.hpp so programs using libscim can look the profiles up too
+
+    enum FormatInfo {
+        DEFAULT_VERSION_CATEGORY = 'A',                 // version SCIM stamps serial numbers with if -s/--serial-version isn't used (Alpha 1.4)
+        DEFAULT_VERSION_NUMBER = 140,
+        EBPB_SIGNATURE = 0x29,                          // means the serial number, volume label and system ID are all there
+        FAT32_FSINFO_SECTOR = 1,
+        FAT32_BACKUP_BOOT_SECTOR = 6,                   // the FSInfo sector is backed up in the sector after this
+    };
+
+    /// @brief build a serial number following "docs/SawconOS Disk Serial Numbers.txt" (0xZZYxxx5C)
+    /// @param Version version the disk is being formatted for, such as "Alpha_1.0", "Beta 2.1.3", or "C1.0.0". NULL uses the version of SCIM
+    /// @param Year year the disk is being formatted in
+    /// @return serial number on success, 0 if the version can't be understood
+    scim::dword SerialID(const char *Version, int Year) {
+        scim::dword Category = DEFAULT_VERSION_CATEGORY - 'A' + 0xA, Number = DEFAULT_VERSION_NUMBER;
+        if(Version) {
+            // only the first letter of the category matters. Full releases are C
+            switch(toupper((unsigned char)Version[0])) {
+                case 'A': Category = 0xA; break;
+                case 'B': Category = 0xB; break;
+                case 'C': case 'F': Category = 0xC; break;
+                default: return 0;
+            }
+            // the version number is its first 3 digits without the dots, padded out with zeroes so 1.0 becomes 100
+            Number = 0;
+            int Digits = 0;
+            for(const char *Character = Version; *Character && Digits < 3; Character++) {
+                if(!isdigit((unsigned char)*Character)) continue;
+                Number = Number * 10 + (*Character - '0');
+                Digits++;
+            }
+            if(!Digits) return 0;
+            for(; Digits < 3; Digits++) Number *= 10;
+        }
+        // the digits are written as hex nibbles so the serial number reads the same as the version in a hex editor
+        scim::dword Serial = (((Year / 10) % 10) << 28) | ((Year % 10) << 24) | (Category << 20);
+        Serial |= ((Number / 100) << 16) | (((Number / 10) % 10) << 12) | ((Number % 10) << 8);
+        return Serial | 0x5C;
+    }
+
+    /// @brief check that a serial number follows "docs/SawconOS Disk Serial Numbers.txt" (0xZZYxxx5C)
+    /// @param Serial serial number to check
+    /// @return true if the year and version are all decimal digits, the category is A, B, or C, and it ends in 5C
+    bool ValidSerialID(scim::dword Serial) {
+        if((Serial & 0xFF) != 0x5C) return false;
+        scim::dword Category = (Serial >> 20) & 0xF;
+        if(Category < 0xA || Category > 0xC) return false;
+        const int DigitShifts[] = { 28, 24, 16, 12, 8 };
+        for(int Shift : DigitShifts)
+            if(((Serial >> Shift) & 0xF) > 9) return false;
+        return true;
+    }
+
+    /// @brief write a buffer to a byte offset in a host file
+    /// @return true on success, false on failure
+    bool WriteAt(int FileDescriptor, scim::qword Offset, const void *Buffer, size_t Length) {
+        if(lseek(FileDescriptor, Offset, SEEK_SET) < 0) return false;
+        return scim::WriteAll(FileDescriptor, Buffer, Length);
+    }
+
+    /// @brief write zeroes over part of a host file
+    /// @return true on success, false on failure
+    bool ZeroAt(int FileDescriptor, scim::qword Offset, scim::qword Length) {
+        static const scim::byte Zeroes[FAT::STREAM_BUFFER_SIZE] = {};
+        if(lseek(FileDescriptor, Offset, SEEK_SET) < 0) return false;
+        while(Length) {
+            size_t TransferBytes = scim::min(sizeof(Zeroes), Length);
+            if(!scim::WriteAll(FileDescriptor, Zeroes, TransferBytes)) return false;
+            Length -= TransferBytes;
+        }
+        return true;
+    }
+
+    /// @brief creates a FAT formatted disk image. Regular files are made sparse with ftruncate so only the boot record, FSInfo,
+    /// and the first sector of each FAT are actually written, which takes the same time whatever the size of the disk. Anything
+    /// else, such as a block device, gets its FATs and root directory zeroed out as well
+    /// @param ImageFileName path of the image to create. An existing file is overwritten
+    /// @param ProfileName name of the geometry profile to use
+    /// @param BootSectorFileName boot sector binary to put at the start of the disk, or NULL for a disk that isn't bootable. Its BPB is replaced with the profile
+    /// @param Version version to build the serial number from, or NULL to use the version of SCIM
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int Run(const char *ImageFileName, const char *ProfileName, const char *BootSectorFileName, const char *Version) {
+        const Profile_t *Profile = FindProfile(ProfileName);
+        if(!Profile) {
+            std::cerr << "SCIM: Error - Unknown geometry profile \"" << ProfileName << "\"\n";
+            return -26;
+        }
+        // the profiles were checked when SCIM was compiled, so the layout is already known
+        const Layout_t *Layout = FindLayout(Profile);
+
+        time_t now = time(0);
+        tm *NowLocal = localtime(&now);
+        scim::dword Serial = SerialID(Version, NowLocal->tm_year + 1900);
+        if(!Serial) {
+            std::cerr << "SCIM: Error - Invalid version for the serial number\n";
+            return -29;
+        }
+
+        // fill in the boot record from the profile
+        FAT::BootRecord_t Record;
+        memset(&Record, 0, sizeof(Record));
+        memcpy(Record.BPB.OEM_Identifier, "SAWCONOS", 8);
+        Record.BPB.BytesPerSector = Profile->BytesPerSector;
+        Record.BPB.SectorsPerCluster = Profile->SectorsPerCluster;
+        Record.BPB.ReservedSectors = Profile->ReservedSectors;
+        Record.BPB.TotalFATs = Profile->TotalFATs;
+        Record.BPB.RootDirectoryEntries = Profile->RootDirectoryEntries;
+        // disks with more than 65535 sectors keep their size in LargeSectors instead
+        if(Profile->TotalSectors > 0xFFFF) Record.BPB.LargeSectors = Profile->TotalSectors;
+        else Record.BPB.TotalSectors = Profile->TotalSectors;
+        Record.BPB.MediaDescriptor = Profile->MediaDescriptor;
+        Record.BPB.SectorsPerTrack = Profile->SectorsPerTrack;
+        Record.BPB.TotalHeads = Profile->TotalHeads;
+        scim::dword FATSectors = Layout->FATSectors;
+        size_t RecordSize;
+        if(Profile->Type == FAT::T_FAT32) {
+            Record.EBPB32.SectorsPerFAT = FATSectors;
+            Record.EBPB32.RootCluster = FAT::FIRST_AVAILABLE_CLUSTER;
+            Record.EBPB32.FSInfoSector = FAT32_FSINFO_SECTOR;
+            Record.EBPB32.BackupBootSector = FAT32_BACKUP_BOOT_SECTOR;
+            Record.EBPB32.DriveNumber = Profile->DriveNumber;
+            Record.EBPB32.Signature = EBPB_SIGNATURE;
+            memcpy(Record.EBPB32.SerialID, &Serial, 4);
+            memcpy(Record.EBPB32.VolumeLabel, Profile->VolumeLabel, 11);
+            memcpy(Record.EBPB32.SystemID, "FAT32   ", 8);
+            RecordSize = FAT::EBPB_OFFSET + sizeof(FAT32::ExtendedBiosParameterBlock_t);
+        }
+        else {
+            Record.BPB.SectorsPerFAT = FATSectors;
+            Record.EBPB.DriveNumber = Profile->DriveNumber;
+            Record.EBPB.Signature = EBPB_SIGNATURE;
+            memcpy(Record.EBPB.SerialID, &Serial, 4);
+            memcpy(Record.EBPB.VolumeLabel, Profile->VolumeLabel, 11);
+            memcpy(Record.EBPB.SystemID, Profile->Type == FAT::T_FAT12 ? "FAT12   " : "FAT16   ", 8);
+            RecordSize = FAT::EBPB_OFFSET + sizeof(FAT12::ExtendedBiosParameterBlock_t);
+        }
+
+        scim::qword DataSectionLBA = Layout->DataSectionLBA;
+        FAT::FAT_TYPE Type = Layout->Type;
+
+        // build the boot sector. Disks that aren't bootable get a jump past the boot record to a loop that halts the CPU
+        scim::byte *BootSector = (scim::byte *)calloc(1, Profile->BytesPerSector);
+        if(!BootSector) return -27;
+        if(BootSectorFileName) {
+            FILE *BootSectorFile = fopen(BootSectorFileName, "rb");
+            size_t BootSectorSize = BootSectorFile ? fread(BootSector, 1, Profile->BytesPerSector, BootSectorFile) : 0;
+            bool TooBig = BootSectorFile && fgetc(BootSectorFile) != EOF;
+            if(BootSectorFile) fclose(BootSectorFile);
+            // the code has to start after the boot record or it would be overwritten by it
+            if(BootSectorSize < 3 || TooBig || BootSector[0] != 0xEB || (size_t)BootSector[1] + 2 < RecordSize) {
+                std::cerr << "SCIM: Error - The boot sector can't be used with this profile\n";
+                free(BootSector);
+                return -28;
+            }
+        }
+        else {
+            const scim::byte Halt[] = { 0xFA, 0xF4, 0xEB, 0xFD };     // cli; hlt; jmp back to the hlt
+            BootSector[0] = 0xEB;
+            BootSector[1] = RecordSize - 2;
+            BootSector[2] = 0x90;
+            memcpy(BootSector + RecordSize, Halt, sizeof(Halt));
+        }
+        memcpy(Record.BPB.DataSkip, BootSector, 3);
+        memcpy(BootSector, &Record, RecordSize);
+        BootSector[510] = 0x55;
+        BootSector[511] = 0xAA;
+
+        int ImageFileDescriptor = open(ImageFileName, O_RDWR | O_CREAT, 0644);
+        if(ImageFileDescriptor < 0) {
+            std::cerr << "SCIM: Error - Could not create the disk image\n";
+            free(BootSector);
+            return -27;
+        }
+        struct stat FileInfo;
+        bool Success = fstat(ImageFileDescriptor, &FileInfo) == 0;
+        // cutting a regular file down to nothing and back up again leaves a sparse file that reads as all zeroes
+        bool Sparse = Success && S_ISREG(FileInfo.st_mode);
+        if(Sparse) Success = ftruncate(ImageFileDescriptor, 0) == 0 && ftruncate(ImageFileDescriptor, (off_t)Layout->SectorOffset(Profile->TotalSectors)) == 0;
+        else if(Success) {
+            Success = ZeroAt(ImageFileDescriptor, Layout->SectorOffset(Profile->ReservedSectors), Layout->SectorOffset(DataSectionLBA - Profile->ReservedSectors));
+            // the FAT32 root directory is the first cluster of the data section
+            if(Success && Type == FAT::T_FAT32) Success = ZeroAt(ImageFileDescriptor, Layout->SectorOffset(DataSectionLBA), Layout->SectorOffset(Profile->SectorsPerCluster));
+        }
+
+        Success = Success && WriteAt(ImageFileDescriptor, 0, BootSector, Profile->BytesPerSector);
+
+        // the first sector of each FAT holds the reserved entries 0 and 1 (and the end of the root directory chain on FAT32). The rest is already zeroed
+        scim::byte *FATSector = (scim::byte *)calloc(1, Profile->BytesPerSector);
+        if(!FATSector) Success = false;
+        else switch(Type) {
+            case FAT::T_FAT12:
+                FAT12::Width::Set(FATSector, 0, 0xF00 | Profile->MediaDescriptor);
+                FAT12::Width::Set(FATSector, 1, 0xFFF);
+                break;
+            case FAT::T_FAT16:
+                FAT16::Width::Set(FATSector, 0, 0xFF00 | Profile->MediaDescriptor);
+                FAT16::Width::Set(FATSector, 1, 0xFFFF);
+                break;
+            case FAT::T_FAT32:
+                FAT32::Width::Set(FATSector, 0, 0x0FFFFF00 | Profile->MediaDescriptor);
+                FAT32::Width::Set(FATSector, 1, FAT32::CLUSTER_MASK);
+                FAT32::Width::Set(FATSector, FAT::FIRST_AVAILABLE_CLUSTER, FAT32::LAST_CLUSTER);
+                break;
+        }
+        for(scim::dword i = 0; Success && i < Profile->TotalFATs; i++)
+            Success = WriteAt(ImageFileDescriptor, Layout->SectorOffset(Profile->ReservedSectors + (scim::qword)i * FATSectors), FATSector, Profile->BytesPerSector);
+
+        // FAT32 also needs the FSInfo sector and backups of both sectors
+        if(Success && Type == FAT::T_FAT32) {
+            FAT32::FSInfo_t FSInfo;
+            memset(&FSInfo, 0, sizeof(FSInfo));
+            FSInfo.LeadSignature = FAT32::FSINFO_LEAD_SIGNATURE;
+            FSInfo.StructSignature = FAT32::FSINFO_STRUCT_SIGNATURE;
+            FSInfo.FreeCount = Layout->DataClusters - 1;                // the root directory uses 1 cluster
+            FSInfo.NextFree = FAT::FIRST_AVAILABLE_CLUSTER + 1;
+            FSInfo.TrailSignature = FAT32::FSINFO_TRAIL_SIGNATURE;
+            Success = WriteAt(ImageFileDescriptor, Layout->SectorOffset(FAT32_FSINFO_SECTOR), &FSInfo, sizeof(FSInfo)) &&
+                      WriteAt(ImageFileDescriptor, Layout->SectorOffset(FAT32_BACKUP_BOOT_SECTOR), BootSector, Profile->BytesPerSector) &&
+                      WriteAt(ImageFileDescriptor, Layout->SectorOffset(FAT32_BACKUP_BOOT_SECTOR + 1), &FSInfo, sizeof(FSInfo));
+        }
+
+        free(FATSector);
+        free(BootSector);
+        if(close(ImageFileDescriptor) < 0) Success = false;
+        if(!Success) {
+            std::cerr << "SCIM: Error - Could not write to the disk image\n";
+            return -27;
+        }
+        return 0;
+    }
+
+    /// @brief writes a geometry profile out so other parts of the build don't need their own copy of it. Files ending in .inc
+    /// get GNU as .equ directives and a VOLUME_LABEL macro for the BPB in boot.s, and files ending in .mk get make variables
+    /// with the size of the image and the QEMU interface it goes on
+    /// @param ProfileName name of the geometry profile to write
+    /// @param OutputFileName file to write it to. An existing file is overwritten
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int Geometry(const char *ProfileName, const char *OutputFileName) {
+        const Profile_t *Profile = FindProfile(ProfileName);
+        if(!Profile) {
+            std::cerr << "SCIM: Error - Unknown geometry profile \"" << ProfileName << "\"\n";
+            return -26;
+        }
+        const Layout_t *Layout = FindLayout(Profile);
+        const char *Extension = strrchr(OutputFileName, '.');
+        bool Assembly = Extension && !strcmp(Extension, ".inc");
+        if(!Assembly && !(Extension && !strcmp(Extension, ".mk"))) {
+            std::cerr << "SCIM: Error - Geometry mode writes .inc files for GNU as or .mk files for make\n";
+            return -43;
+        }
+
+        FILE *Output = fopen(OutputFileName, "w");
+        if(!Output) {
+            std::cerr << "SCIM: Error - Could not open the output file\n";
+            return -20;
+        }
+        if(Assembly) {
+            fprintf(Output, "# BPB of the \"%s\" geometry profile for boot.s\n", Profile->Name);
+            fprintf(Output, "# written by scim geometry from src/tools/SCIM/geometry.hpp. Change the profile there instead of changing this file\n\n");
+            fprintf(Output, ".equ GEOMETRY_FAT_TYPE, %d\n", Profile->Type);
+            fprintf(Output, ".equ GEOMETRY_BYTES_PER_SECTOR, %u\n", Profile->BytesPerSector);
+            fprintf(Output, ".equ GEOMETRY_SECTORS_PER_CLUSTER, %u\n", Profile->SectorsPerCluster);
+            fprintf(Output, ".equ GEOMETRY_RESERVED_SECTORS, %u\n", Profile->ReservedSectors);
+            fprintf(Output, ".equ GEOMETRY_TOTAL_FATS, %u\n", Profile->TotalFATs);
+            fprintf(Output, ".equ GEOMETRY_ROOT_DIRECTORY_ENTRIES, %u\n", Profile->RootDirectoryEntries);
+            // disks with more than 65535 sectors keep their size in LargeSectors instead
+            fprintf(Output, ".equ GEOMETRY_TOTAL_SECTORS, %u\n", Profile->TotalSectors > 0xFFFF ? 0 : Profile->TotalSectors);
+            fprintf(Output, ".equ GEOMETRY_LARGE_SECTORS, %u\n", Profile->TotalSectors > 0xFFFF ? Profile->TotalSectors : 0);
+            fprintf(Output, ".equ GEOMETRY_MEDIA_DESCRIPTOR, 0x%02X\n", Profile->MediaDescriptor);
+            fprintf(Output, ".equ GEOMETRY_SECTORS_PER_FAT, %u\n", Profile->Type == FAT::T_FAT32 ? 0 : Layout->FATSectors);
+            fprintf(Output, ".equ GEOMETRY_SECTORS_PER_TRACK, %u\n", Profile->SectorsPerTrack);
+            fprintf(Output, ".equ GEOMETRY_TOTAL_HEADS, %u\n", Profile->TotalHeads);
+            fprintf(Output, ".equ GEOMETRY_DRIVE_NUMBER, 0x%02X\n", Profile->DriveNumber);
+            fprintf(Output, ".macro VOLUME_LABEL\n    .ascii \"%.11s\"\n.endm\n", Profile->VolumeLabel);
+        }
+        else {
+            fprintf(Output, "# size of the \"%s\" geometry profile for the makefile\n", Profile->Name);
+            fprintf(Output, "# written by scim geometry from src/tools/SCIM/geometry.hpp. Change the profile there instead of changing this file\n\n");
+            fprintf(Output, "GEOMETRY_PROFILE=%s\n", Profile->Name);
+            fprintf(Output, "GEOMETRY_BYTES_PER_SECTOR=%u\n", Profile->BytesPerSector);
+            fprintf(Output, "GEOMETRY_TOTAL_SECTORS=%u\n", Profile->TotalSectors);
+            fprintf(Output, "GEOMETRY_IMAGE_BYTES=%llu\n", Layout->SectorOffset(Profile->TotalSectors));
+            fprintf(Output, "GEOMETRY_DATA_CLUSTERS=%u\n", Layout->DataClusters);
+            // hard disks have bit 7 of their drive number set
+            fprintf(Output, "GEOMETRY_INTERFACE=%s\n", Profile->DriveNumber & 0x80 ? "ide" : "floppy");
+        }
+        if(fclose(Output)) {
+            std::cerr << "SCIM: Error - Could not write to the output file\n";
+            return -20;
+        }
+        return 0;
+    }
+
+}                           // contains the formatter for format mode and geometry mode
@@ -0,0 +1,179 @@
+// geometry.hpp
+//
+// the disk geometry profiles and the layouts worked out from them
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// this is the only place the geometry of a SawconOS disk is written down. Format mode builds images from these profiles, and
+// geometry mode writes them out for boot.s and the makefile, so the BPB in the boot sector and the size of the image can't
+// drift away from what SCIM formats
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Format {
+
+    enum GeometryInfo {
+        FAT32_MIN_RESERVED_SECTORS = 8,
+    };
+
+    typedef struct Profile_t {
+        const char *Name;                               // name passed to -p/--profile
+        FAT::FAT_TYPE Type;                             // type of FAT the geometry has to come out as
+        scim::word BytesPerSector;
+        scim::byte SectorsPerCluster;
+        scim::word ReservedSectors;
+        scim::byte TotalFATs;
+        scim::word RootDirectoryEntries;                // 0 on FAT32
+        scim::dword TotalSectors;
+        scim::byte MediaDescriptor;
+        scim::dword SectorsPerFAT;                      // 0 to work it out from the rest of the geometry
+        scim::word SectorsPerTrack;
+        scim::word TotalHeads;
+        scim::byte DriveNumber;                         // 0x00 for floppies, 0x80 for hard disks
+        const char *VolumeLabel;                        // exactly 11 characters
+    } Profile_t;
+
+    inline constexpr Profile_t Profiles[] {
+        // the SawconOS boot disk. boot.s gets its BPB from this profile through geometry mode
+        { "sawcon", FAT::T_FAT12, 512, 1, 1, 1, 128, 2880, 0xF0, 8, 18, 2, 0x00, "SAWCON  100" },
+        // a normal 1.44MiB floppy like DOS would format it
+        { "floppy", FAT::T_FAT12, 512, 1, 1, 2, 224, 2880, 0xF0, 9, 18, 2, 0x00, "NO NAME    " },
+        // a 2.88MiB extra density floppy like DOS would format it
+        { "floppy288", FAT::T_FAT12, 512, 2, 1, 2, 240, 5760, 0xF0, 9, 36, 2, 0x00, "NO NAME    " },
+        // 64MiB hard disk
+        { "hdd64", FAT::T_FAT16, 512, 4, 4, 2, 512, 131072, 0xF8, 0, 63, 16, 0x80, "NO NAME    " },
+        // 512MiB hard disk
+        { "hdd512", FAT::T_FAT32, 512, 8, 32, 2, 0, 1048576, 0xF8, 0, 63, 16, 0x80, "NO NAME    " },
+        { NULL, FAT::T_FAT12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, NULL }         // end of list
+    };
+
+    inline constexpr size_t PROFILE_COUNT = sizeof(Profiles) / sizeof(Profiles[0]) - 1;
+
+    /// @brief where everything is on a disk formatted with a profile. Profiles always have power of two sector and cluster
+    /// sizes, so offsets are worked out with shifts, and a layout from Layouts turns into constants wherever the profile is
+    /// known at compile time
+    typedef struct Layout_t {
+        scim::dword FATSectors;                         // size of one FAT
+        scim::dword RootDirectoryLBA;                   // first sector after the FATs. The FAT32 root directory is in the data section instead
+        scim::dword RootDirectorySectors;               // 0 on FAT32
+        scim::dword DataSectionLBA;
+        scim::dword DataClusters;                       // number of clusters that fit in the data section
+        FAT::FAT_TYPE Type;                             // type of FAT DataClusters makes the disk, using the same rule as FAT::Disk
+        scim::byte SectorShift;                         // log2 of BytesPerSector
+        scim::byte ClusterShift;                        // log2 of SectorsPerCluster
+
+        /// @return byte offset of a sector on the disk
+        constexpr scim::qword SectorOffset(scim::qword LBA) const {
+            return LBA << SectorShift;
+        }
+
+        /// @return LBA of the first sector of a data cluster
+        constexpr scim::dword Cluster2LBA(scim::dword Cluster) const {
+            return DataSectionLBA + ((Cluster - FAT::FIRST_AVAILABLE_CLUSTER) << ClusterShift);
+        }
+
+        /// @return byte offset of a data cluster on the disk
+        constexpr scim::qword ClusterOffset(scim::dword Cluster) const {
+            return SectorOffset(Cluster2LBA(Cluster));
+        }
+    } Layout_t;
+
+    /// @brief work out how many sectors each FAT needs to cover every cluster on the disk. Making the FATs bigger leaves less
+    /// space for clusters so this is repeated until it settles
+    /// @param Profile geometry of the disk
+    /// @return sectors per FAT
+    constexpr scim::dword SectorsPerFAT(const Profile_t *Profile) {
+        scim::dword RootDirectorySectors = (Profile->RootDirectoryEntries * sizeof(FAT::DirectoryEntry_t) + Profile->BytesPerSector - 1) / Profile->BytesPerSector;
+        scim::dword Sectors = 1;
+        while(true) {
+            scim::qword Overhead = Profile->ReservedSectors + (scim::qword)Profile->TotalFATs * Sectors + RootDirectorySectors;
+            if(Overhead >= Profile->TotalSectors) return Sectors;
+            scim::qword Entries = (Profile->TotalSectors - Overhead) / Profile->SectorsPerCluster + FAT::FIRST_AVAILABLE_CLUSTER;
+            // FAT_TYPE values are the width of an entry in bits
+            scim::dword Needed = ((Entries * Profile->Type + 7) / 8 + Profile->BytesPerSector - 1) / Profile->BytesPerSector;
+            if(Needed <= Sectors) return Sectors;
+            Sectors = Needed;
+        }
+    }
+
+    /// @brief work out the layout of a disk formatted with a profile
+    /// @param Profile geometry of the disk
+    /// @return the layout. DataClusters is 0 if the profile doesn't leave room for any data
+    constexpr Layout_t LayoutOf(const Profile_t *Profile) {
+        Layout_t Layout {};
+        Layout.FATSectors = Profile->SectorsPerFAT ? Profile->SectorsPerFAT : SectorsPerFAT(Profile);
+        Layout.RootDirectoryLBA = Profile->ReservedSectors + Profile->TotalFATs * Layout.FATSectors;
+        Layout.RootDirectorySectors = (Profile->RootDirectoryEntries * sizeof(FAT::DirectoryEntry_t) + Profile->BytesPerSector - 1) / Profile->BytesPerSector;
+        Layout.DataSectionLBA = Layout.RootDirectoryLBA + Layout.RootDirectorySectors;
+        Layout.DataClusters = Layout.DataSectionLBA < Profile->TotalSectors ? (Profile->TotalSectors - Layout.DataSectionLBA) / Profile->SectorsPerCluster : 0;
+        Layout.Type = Layout.DataClusters < FAT::FAT12_MAX_CLUSTERS ? FAT::T_FAT12 : Layout.DataClusters < FAT::FAT16_MAX_CLUSTERS ? FAT::T_FAT16 : FAT::T_FAT32;
+        Layout.SectorShift = scim::ShiftFor(Profile->BytesPerSector);
+        Layout.ClusterShift = scim::ShiftFor(Profile->SectorsPerCluster);
+        return Layout;
+    }
+
+    /// @brief check that a profile makes a disk that FAT::Disk can open
+    /// @param Profile geometry of the disk
+    /// @return true if the geometry comes out as the type of FAT the profile is meant to be and its sizes are powers of two
+    constexpr bool ValidProfile(const Profile_t *Profile) {
+        Layout_t Layout = LayoutOf(Profile);
+        return Layout.DataClusters && Layout.Type == Profile->Type &&
+               Layout.SectorShift != scim::NO_SHIFT && Layout.ClusterShift != scim::NO_SHIFT &&
+               (Profile->Type != FAT::T_FAT32 || Profile->ReservedSectors >= FAT32_MIN_RESERVED_SECTORS);
+    }
+
+    /// @return true if every profile in Profiles is valid
+    constexpr bool ValidProfiles() {
+        for(size_t i = 0; i < PROFILE_COUNT; i++)
+            if(!ValidProfile(&Profiles[i])) return false;
+        return true;
+    }
+
+    static_assert(ValidProfiles(), "a geometry profile doesn't make a disk that FAT::Disk can open");
+
+    /// @brief layout of every profile, worked out at compile time. Layouts[i] goes with Profiles[i]
+    inline constexpr auto Layouts = [] {
+        std::array<Layout_t, PROFILE_COUNT> Table {};
+        for(size_t i = 0; i < PROFILE_COUNT; i++)
+            Table[i] = LayoutOf(&Profiles[i]);
+        return Table;
+    }();
+
+    /// @brief find a geometry profile by name
+    /// @param Name name of the profile. Not case sensitive
+    /// @return pointer to the profile on success, NULL if there isn't one with that name
+    inline const Profile_t *FindProfile(const char *Name) {
+        for(int i = 0; Profiles[i].Name != NULL; i++)
+            if(!strcasecmp(Name, Profiles[i].Name)) return &Profiles[i];
+        return NULL;
+    }
+
+    /// @brief get the layout of a profile from FindProfile
+    /// @param Profile profile in Profiles
+    /// @return layout worked out at compile time
+    inline const Layout_t *FindLayout(const Profile_t *Profile) {
+        return &Layouts[Profile - Profiles];
+    }
+
+    /// @brief find the geometry profile a disk was formatted with, so FAT::Disk can use the layout worked out at compile time
+    /// @param BPB BPB from the boot sector of the disk
+    /// @param TotalSectors BPB.TotalSectors, or BPB.LargeSectors if the disk is too big for it
+    /// @param FATSectors size of one FAT, from the BPB or the FAT32 EBPB
+    /// @return layout of the profile on success, NULL if the BPB doesn't lay the disk out the same way as any profile
+    inline const Layout_t *MatchLayout(const FAT::BiosParameterBlock_t *BPB, scim::dword TotalSectors, scim::dword FATSectors) {
+        for(size_t i = 0; i < PROFILE_COUNT; i++)
+            if(BPB->BytesPerSector == Profiles[i].BytesPerSector && BPB->SectorsPerCluster == Profiles[i].SectorsPerCluster &&
+               BPB->ReservedSectors == Profiles[i].ReservedSectors && BPB->TotalFATs == Profiles[i].TotalFATs &&
+               BPB->RootDirectoryEntries == Profiles[i].RootDirectoryEntries && TotalSectors == Profiles[i].TotalSectors &&
+               FATSectors == Layouts[i].FATSectors) return &Layouts[i];
+        return NULL;
+    }
+
+}                           // contains the geometry profiles
@@ -0,0 +1,155 @@
+// import.hpp
+//
+// import mode for SCIM, which copies every file in a host directory into a disk image
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Import {
+
+    typedef struct Job_t {
+        char *HostPath;                                 // path of the host file to copy. malloced
+        scim::dword FirstCluster;                       // first cluster of the chain that was allocated for the file
+        scim::qword Size;                               // size of the host file in bytes when it was planned
+    } Job_t;
+
+    /// @brief copies the data of each job into its cluster chain. Several of these run at once, each picking up the next job that nobody has taken yet
+    /// @param FileSystem disk to write to. The FAT must not change while this is running
+    /// @param Jobs list of every job
+    /// @param JobCount number of jobs in the list
+    /// @param NextJob index of the next job that hasn't been taken. Shared between all the workers
+    /// @param Failed set if any job fails so the other workers can stop early
+    void Worker(FAT::Disk *FileSystem, Job_t *Jobs, size_t JobCount, std::atomic<size_t> *NextJob, std::atomic<bool> *Failed) {
+        for(size_t i = (*NextJob)++; i < JobCount && !*Failed; i = (*NextJob)++) {
+            FILE *HostFileStream = fopen(Jobs[i].HostPath, "rb");
+            if(!HostFileStream || !FileSystem->WriteChain(Jobs[i].FirstCluster, HostFileStream, Jobs[i].Size)) {
+                std::cerr << "SCIM: Error - Could not copy \"" << Jobs[i].HostPath << "\" into the disk image\n";
+                *Failed = true;
+            }
+            if(HostFileStream) fclose(HostFileStream);
+        }
+    }
+
+    /// @brief copies every regular file in a host directory into the root directory of a disk. All of the directory entries and
+    /// cluster chains are planned first on one thread, then the file data is copied by a pool of threads, then the root directory
+    /// and FAT are committed once. If anything fails the root directory and FAT on the disk image are left as they were
+    /// @param FileSystem disk to import into. Must have been initialised
+    /// @param HostDirectory path of the host directory. Sub-directories are skipped because only the root directory is supported
+    /// @param ThreadCount number of threads copying file data. 0 uses one thread per CPU
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int Run(FAT::Disk *FileSystem, const char *HostDirectory, unsigned int ThreadCount) {
+        DIR *Directory = opendir(HostDirectory);
+        if(!Directory) {
+            std::cerr << "SCIM: Error - Could not open the host directory\n";
+            return -21;
+        }
+
+        // collect the names first so they can be imported in a predictable order
+        char **HostNames = NULL;
+        size_t HostNameCount = 0, HostNameCapacity = 0;
+        int ReturnCode = 0;
+        for(dirent *DirectoryEntry = readdir(Directory); DirectoryEntry; DirectoryEntry = readdir(Directory)) {
+            if(DirectoryEntry->d_name[0] == '.' && (!DirectoryEntry->d_name[1] || !strcmp(DirectoryEntry->d_name, ".."))) continue;
+            if(HostNameCount == HostNameCapacity) {
+                HostNameCapacity = HostNameCapacity ? HostNameCapacity * 2 : 64;
+                char **Resized = (char **)realloc(HostNames, HostNameCapacity * sizeof(char *));
+                if(!Resized) {
+                    ReturnCode = -22;
+                    break;
+                }
+                HostNames = Resized;
+            }
+            HostNames[HostNameCount] = strdup(DirectoryEntry->d_name);
+            if(!HostNames[HostNameCount]) {
+                ReturnCode = -22;
+                break;
+            }
+            HostNameCount++;
+        }
+        closedir(Directory);
+        qsort(HostNames, HostNameCount, sizeof(char *), [](const void *a, const void *b) {
+            return strcmp(*(char * const *)a, *(char * const *)b);
+        });
+
+        // planning phase: every entry and cluster chain is set up before any file data is copied
+        Job_t *Jobs = (Job_t *)calloc(HostNameCount ? HostNameCount : 1, sizeof(Job_t));
+        size_t JobCount = 0;
+        if(!Jobs) ReturnCode = -22;
+        if(!ReturnCode && !FileSystem->BeginTransaction()) ReturnCode = -18;
+        for(size_t i = 0; !ReturnCode && i < HostNameCount; i++) {
+            char *HostPath = (char *)malloc(strlen(HostDirectory) + strlen(HostNames[i]) + 2);
+            if(!HostPath) {
+                ReturnCode = -22;
+                break;
+            }
+            sprintf(HostPath, "%s/%s", HostDirectory, HostNames[i]);
+
+            struct stat FileInfo;
+            if(stat(HostPath, &FileInfo) < 0 || !S_ISREG(FileInfo.st_mode)) {
+                std::cerr << "SCIM: Warning - Skipping \"" << HostPath << "\" because it isn't a regular file\n";
+                free(HostPath);
+                continue;
+            }
+
+            char EntryName[12];
+            if(!FAT::HostName2FatName(HostNames[i], EntryName)) {
+                std::cerr << "SCIM: Error - \"" << HostNames[i] << "\" can't be stored as an 8.3 file name\n";
+                free(HostPath);
+                ReturnCode = -23;
+                break;
+            }
+
+            FAT::DirectoryEntry_t *Entry = FileSystem->AddEntry(EntryName, FAT::A_ARCHIVE, FileInfo.st_size);
+            if(!Entry) {
+                std::cerr << "SCIM: Error - Could not create an entry for \"" << HostPath << "\"\n";
+                free(HostPath);
+                ReturnCode = -12;
+                break;
+            }
+            Jobs[JobCount].HostPath = HostPath;
+            Jobs[JobCount].FirstCluster = FileSystem->FirstCluster(Entry);
+            Jobs[JobCount].Size = FileInfo.st_size;
+            JobCount++;
+        }
+
+        // data phase: the FAT doesn't change from here on so the chains can be filled in parallel
+        if(!ReturnCode) {
+            if(!ThreadCount) ThreadCount = std::thread::hardware_concurrency();
+            if(!ThreadCount) ThreadCount = 1;
+            if(ThreadCount > JobCount) ThreadCount = JobCount;
+
+            std::atomic<size_t> NextJob(0);
+            std::atomic<bool> Failed(false);
+            std::thread *Workers = new std::thread[ThreadCount];
+            for(unsigned int i = 0; i < ThreadCount; i++)
+                Workers[i] = std::thread(Worker, FileSystem, Jobs, JobCount, &NextJob, &Failed);
+            for(unsigned int i = 0; i < ThreadCount; i++)
+                Workers[i].join();
+            delete[] Workers;
+            if(Failed) ReturnCode = -24;
+        }
+
+        // only write the root directory and FAT if every file made it
+        if(!ReturnCode && !FileSystem->Commit()) {
+            std::cerr << "SCIM: Error - Could not commit the changes to the disk image\n";
+            ReturnCode = -18;
+        }
+
+        for(size_t i = 0; i < JobCount; i++)
+            free(Jobs[i].HostPath);
+        free(Jobs);
+        for(size_t i = 0; i < HostNameCount; i++)
+            free(HostNames[i]);
+        free(HostNames);
+        return ReturnCode;
+    }
+
+}                           // contains the planner and worker pool for import mode
@@ -0,0 +1,122 @@
+// library.hpp
+//
+// entry points of the modes that are compiled into libscim
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// everything declared here is defined once in libscim.cpp, which includes the header of each mode. Only the types and tables
+// that callers need to use the modes are defined here, so this header can be included by any number of translation units
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Operations {
+
+    /// @brief prints the name of every entry in a directory to stdout
+    bool List(FAT::Disk *FileSystem, const char *Path);
+    /// @brief streams the contents of a file entry into a host file descriptor
+    bool Read(FAT::Disk *FileSystem, const char *Name, int OutputFileDescriptor);
+    /// @brief streams the contents of a file entry into a new host file
+    bool Read(FAT::Disk *FileSystem, const char *Name, const char *HostFileName);
+    /// @brief copies a host file into a new file entry
+    bool Write(FAT::Disk *FileSystem, const char *Name, const char *HostFileName);
+    /// @brief deletes a file entry
+    bool Delete(FAT::Disk *FileSystem, const char *Name);
+
+}                           // contains the single file operations
+
+namespace Batch {
+
+    /// @brief runs every operation in a manifest against a disk as a single transaction
+    int Run(FAT::Disk *FileSystem, FILE *Manifest);
+
+}                           // contains batch mode
+
+namespace Import {
+
+    /// @brief copies every regular file in a host directory into the root directory of a disk on a pool of threads
+    int Run(FAT::Disk *FileSystem, const char *HostDirectory, unsigned int ThreadCount);
+
+}                           // contains import mode
+
+namespace Format {
+
+    // Profile_t, Profiles, Layouts, and FindProfile are in geometry.hpp
+
+    /// @brief build a serial number following "docs/SawconOS Disk Serial Numbers.txt" (0xZZYxxx5C)
+    scim::dword SerialID(const char *Version, int Year);
+    /// @brief check that a serial number follows "docs/SawconOS Disk Serial Numbers.txt" (0xZZYxxx5C)
+    bool ValidSerialID(scim::dword Serial);
+    /// @brief creates a FAT formatted disk image from a geometry profile
+    int Run(const char *ImageFileName, const char *ProfileName, const char *BootSectorFileName, const char *Version);
+    /// @brief writes a geometry profile out as a GNU as include for boot.s or as make variables
+    int Geometry(const char *ProfileName, const char *OutputFileName);
+
+}                           // contains format mode and geometry mode
+
+namespace Defrag {
+
+    /// @brief defragments a disk and reports how fragmented it was before and after
+    int Run(FAT::Disk *FileSystem, const char *FirstName);
+
+}                           // contains defrag mode
+
+namespace Sync {
+
+    /// @brief makes the root directory of a disk match a host directory or manifest, only writing files that changed
+    int Run(FAT::Disk *FileSystem, const char *HostDirectory, FILE *Manifest);
+
+}                           // contains sync mode
+
+namespace Serve {
+
+    enum OPERATIONS {
+        OP_INVALID = 0,
+        OP_LIST,
+        OP_READ,
+        OP_WRITE,
+        OP_DELETE,
+    };
+
+    /// @brief listen on a Unix domain socket and answer requests until SCIM is killed
+    int Run(const char *SocketPath, const char *PreloadImage);
+    /// @brief send one request to a SCIM server and pass the response on
+    int Request(const char *SocketPath, unsigned int Operation, const char *ImageFileName, const char *EntryName, const char *HostFileName, int OutputFileDescriptor);
+
+}                           // contains serve mode and the client side of --socket
+
+namespace Check {
+
+    /// @brief checks the boot record and every cluster chain on a disk image and prints what was found
+    int Run(Device::BlockDevice *ImageDevice, bool Repair);
+
+}                           // contains check mode
+
+namespace Extract {
+
+    /// @brief copies the files in the root directory of a disk into a host directory in one sorted sweep over the image
+    int Run(FAT::Disk *FileSystem, Device::BlockDevice *ImageDevice, const char *HostDirectory, const char *Pattern, unsigned int ThreadCount);
+
+}                           // contains extract mode
+
+namespace Provision {
+
+    /// @brief clone a template image once for each unit in a manifest and patch each clone
+    int Run(FAT::Disk *FileSystem, const char *TemplatePath, FILE *ManifestStream, const char *Version, unsigned int ThreadCount);
+
+}                           // contains provision mode
+
+namespace Overlay {
+
+    /// @brief turn a base image and a delta into a new flat image
+    int Commit(const char *BaseFileName, const char *DeltaFileName, const char *OutputFileName);
+    /// @brief make a delta that turns one image into another
+    int Diff(const char *BaseFileName, const char *ChangedFileName, const char *DeltaFileName);
+
+}                           // contains the commit and diff modes for overlays
@@ -0,0 +1,43 @@
+// libscim.cpp
+//
+// source file for libscim, the Sawcon Image Manipulator as a library
+// This file was written as part of the SawconOS Host Tools
+// This version of the code was written for SCIM Alpha 1.4
+// compiled using g++
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// the FAT driver and the block devices are in headers so programs compile them in themselves. Every mode is compiled here
+// instead, so that it is only defined once however many translation units include scim.hpp. Anything linked against
+// libscim has to be built with the same SCIM_FEATURES as the library
+
+#include "scim.hpp"
+
+namespace scim {
+
+    #include "operations.hpp"
+
+    #include "batch.hpp"
+
+    #include "import.hpp"
+
+    #include "format.hpp"
+
+    #include "defrag.hpp"
+
+    #include "sync.hpp"
+
+    #include "serve.hpp"
+
+    #include "check.hpp"
+
+    #include "extract.hpp"
+
+    #include "provision.hpp"
+
+    #include "overlay.hpp"
+
+}
@@ -2,10 +2,10 @@
 //
 // utilities for specifying modes in SCIM
 // This file was written as part of the Sawcon Image Manipulator
-// This version of the header was written for SCIM Alpha 1.3
+// This version of the header was written for SCIM Alpha 1.4
 //
 // Written: Sunday 27th August 2023
-// Last Updated: Wednesday 30th August 2023
+// Last Updated: Saturday 17th October 2026
 //
 // Written by Gabriel Jickells
 
@@ -18,6 +18,20 @@ const char *ValidModes[] {
     "read",
     "delete",
     "write",
+    "batch",
+    "import",
+    "format",
+    "defrag",
+    "sync",
+    "serve",
+    "check",
+    "extract",
+    "mkdir",
+    "rmdir",
+    "provision",
+    "commit",
+    "diff",
+    "geometry",
     NULL                        // end of list
 };
 
@@ -27,4 +41,18 @@ enum MODES {
     M_READ,
     M_DELETE,
     M_WRITE,
+    M_BATCH,
+    M_IMPORT,
+    M_FORMAT,
+    M_DEFRAG,
+    M_SYNC,
+    M_SERVE,
+    M_CHECK,
+    M_EXTRACT,
+    M_MKDIR,
+    M_RMDIR,
+    M_PROVISION,
+    M_COMMIT,
+    M_DIFF,
+    M_GEOMETRY,
 };
@@ -0,0 +1,83 @@
+// operations.hpp
+//
+// file operations shared between the different modes in SCIM
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Operations {
+
+    /// @brief prints the name of every entry in a directory to stdout. Requires the disk to have been initialised
+    /// @param FileSystem disk to list
+    /// @param Path path of the directory such as "/SYS/DRIVERS", or NULL for the root directory
+    /// @return true on success, false if the directory couldn't be found
+    bool List(FAT::Disk *FileSystem, const char *Path) {
+        std::span<FAT::DirectoryEntry_t> Entries = FileSystem->OpenDirectory(Path ? Path : "/");
+        if(!Entries.data()) return false;
+        for(const FAT::DirectoryEntry_t &Entry : Entries) {
+            if(Entry.Name[0] == FAT::N_END) break;
+            if(Entry.Name[0] == FAT::N_ENTRYFREE) continue;
+            // the root directory may be mapped straight from the image so the special character is swapped in a copy of the name
+            char EntryName[11];
+            memcpy(EntryName, Entry.Name, 11);
+            if(EntryName[0] == FAT::N_SIGMALOW) EntryName[0] = (char)0xe5;
+            printf("%.11s\n", EntryName);
+        }
+        return true;
+    }
+
+    /// @brief streams the contents of a file entry into a host file descriptor
+    /// @param FileSystem disk to read from
+    /// @param Name name of the file entry in "NAME    EXT" format
+    /// @param OutputFileDescriptor host file descriptor to write the data to
+    /// @return true on success, false on failure
+    bool Read(FAT::Disk *FileSystem, const char *Name, int OutputFileDescriptor) {
+        FAT::DirectoryEntry_t *TargetEntry = FileSystem->FindEntry(Name);
+        if(!TargetEntry) return false;
+        return FileSystem->StreamEntry(TargetEntry, OutputFileDescriptor);
+    }
+
+    /// @brief streams the contents of a file entry into a new host file
+    /// @param FileSystem disk to read from
+    /// @param Name name of the file entry in "NAME    EXT" format
+    /// @param HostFileName path of the host file to create. Any existing file is overwritten
+    /// @return true on success, false on failure
+    bool Read(FAT::Disk *FileSystem, const char *Name, const char *HostFileName) {
+        int OutputFileDescriptor = open(HostFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(OutputFileDescriptor < 0) return false;
+        bool Success = Read(FileSystem, Name, OutputFileDescriptor);
+        return !close(OutputFileDescriptor) && Success;
+    }
+
+    /// @brief copies a host file into a new file entry
+    /// @param FileSystem disk to write to
+    /// @param Name name of the new file entry in "NAME    EXT" format
+    /// @param HostFileName path to the host file
+    /// @return true on success, false on failure
+    bool Write(FAT::Disk *FileSystem, const char *Name, const char *HostFileName) {
+        FILE *HostFileStream = fopen(HostFileName, "rb");
+        if(!HostFileStream) return false;
+        bool Success = FileSystem->CreateEntry(Name, FAT::A_ARCHIVE, HostFileStream);
+        fclose(HostFileStream);
+        return Success;
+    }
+
+    /// @brief deletes a file entry
+    /// @param FileSystem disk to delete the file from
+    /// @param Name name of the file entry in "NAME    EXT" format
+    /// @return true on success, false on failure
+    bool Delete(FAT::Disk *FileSystem, const char *Name) {
+        FAT::DirectoryEntry_t *TargetEntry = FileSystem->FindEntry(Name);
+        if(!TargetEntry) return false;
+        return FileSystem->DeleteEntry(TargetEntry);
+    }
+
+}                           // contains operations that more than one mode needs
@@ -0,0 +1,151 @@
+// overlay.hpp
+//
+// commit and diff modes for copy on write overlays in SCIM
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Overlay {
+
+    enum DiffInfo {
+        DIFF_CHUNK_SIZE = 1024 * 1024,                  // how much of each image is compared at a time
+    };
+
+    /// @brief turn a base image and a delta into a new flat image. The base is cloned first, so on filesystems with reflinks
+    /// only the sectors in the delta take up new space
+    /// @param BaseFileName path to the base image
+    /// @param DeltaFileName path to the delta
+    /// @param OutputFileName path to the flat image to create
+    /// @return 0 on success, error code on failure
+    int Commit(const char *BaseFileName, const char *DeltaFileName, const char *OutputFileName) {
+        Device::OverlayDevice Overlay;
+        if(!Overlay.Open(BaseFileName, DeltaFileName)) {
+            std::cerr << "SCIM: Error - Could not open the overlay. It has to be a delta made against this image\n";
+            return -42;
+        }
+        int Base = open(BaseFileName, O_RDONLY);
+        if(Base < 0) {
+            std::cerr << "SCIM: Error - Could not open disk image\n";
+            return -5;
+        }
+        bool Reflinked;
+        int Output;
+        {
+            SCIM_TIME_DETAIL(P_DATA_COPY, "Clone base");
+            Output = Device::CloneFile(Base, OutputFileName, &Reflinked);
+        }
+        close(Base);
+        if(Output < 0) {
+            std::cerr << "SCIM: Error - Could not create the output image. It can't be the base image\n";
+            return -20;
+        }
+        bool Success;
+        {
+            SCIM_TIME_DETAIL(P_DATA_COPY, "Apply delta");
+            Success = Overlay.ApplyTo(Output);
+        }
+        if(close(Output) < 0) Success = false;
+        if(!Success) {
+            std::cerr << "SCIM: Error - Could not write the delta into the output image\n";
+            return -43;
+        }
+        printf("%llu sectors committed onto a %s of the base\n", Overlay.SectorCount(), Reflinked ? "reflink" : "copy");
+        return 0;
+    }
+
+    /// @brief make a delta that turns one image into another, so that the second image can be kept as an overlay on the first.
+    /// Holes that both images have are skipped without being read
+    /// @param BaseFileName path to the image the delta will go on top of
+    /// @param ChangedFileName path to the image the delta should turn the base into. It has to be the same size as the base
+    /// @param DeltaFileName path to the delta to create. An existing file is overwritten
+    /// @return 0 on success, error code on failure
+    int Diff(const char *BaseFileName, const char *ChangedFileName, const char *DeltaFileName) {
+        int Base = open(BaseFileName, O_RDONLY);
+        int Changed = open(ChangedFileName, O_RDONLY);
+        struct stat BaseInfo, ChangedInfo;
+        if(Base < 0 || Changed < 0 || fstat(Base, &BaseInfo) < 0 || fstat(Changed, &ChangedInfo) < 0) {
+            std::cerr << "SCIM: Error - Could not open both images\n";
+            if(Base >= 0) close(Base);
+            if(Changed >= 0) close(Changed);
+            return -5;
+        }
+        if(BaseInfo.st_size != ChangedInfo.st_size) {
+            std::cerr << "SCIM: Error - The images are different sizes\n";
+            close(Base);
+            close(Changed);
+            return -43;
+        }
+        Device::OverlayDevice Overlay;
+        if(!Overlay.Open(BaseFileName, DeltaFileName, true)) {
+            std::cerr << "SCIM: Error - Could not create the delta. It can't be the base image\n";
+            close(Base);
+            close(Changed);
+            return -20;
+        }
+        scim::byte *BaseChunk = (scim::byte *)malloc(DIFF_CHUNK_SIZE);
+        scim::byte *ChangedChunk = (scim::byte *)malloc(DIFF_CHUNK_SIZE);
+        bool Success = BaseChunk && ChangedChunk;
+        if(!Success) std::cerr << "SCIM: Error - Not enough memory\n";
+
+        scim::qword Size = BaseInfo.st_size;
+        scim::qword Offset = 0;
+        SCIM_TIME_DETAIL(P_DATA_COPY, "Diff");
+        while(Success && Offset < Size) {
+            // skip to the next place either image has data. Filesystems that can't find holes just get compared everywhere
+            off_t BaseData = lseek(Base, Offset, SEEK_DATA);
+            off_t ChangedData = lseek(Changed, Offset, SEEK_DATA);
+            SCIM_COUNT(C_SYSCALLS, 2);
+            if(BaseData < 0 && errno != ENXIO) BaseData = Offset;
+            if(ChangedData < 0 && errno != ENXIO) ChangedData = Offset;
+            if(BaseData < 0 && ChangedData < 0) break;
+            scim::qword NextData = BaseData < 0 ? ChangedData : ChangedData < 0 ? BaseData : BaseData < ChangedData ? BaseData : ChangedData;
+            Offset = NextData - NextData % Device::DELTA_SECTOR_SIZE;
+
+            size_t Length = scim::min(DIFF_CHUNK_SIZE, Size - Offset);
+            if(!scim::ReadAllAt(Base, BaseChunk, Length, Offset) || !scim::ReadAllAt(Changed, ChangedChunk, Length, Offset)) {
+                std::cerr << "SCIM: Error - Could not read the images\n";
+                Success = false;
+                break;
+            }
+            // each run of sectors that changed goes into the delta with one write
+            for(size_t Start = 0; Success && Start < Length;) {
+                size_t SectorLength = scim::min(Device::DELTA_SECTOR_SIZE, Length - Start);
+                if(!memcmp(BaseChunk + Start, ChangedChunk + Start, SectorLength)) {
+                    Start += SectorLength;
+                    continue;
+                }
+                size_t End = Start + SectorLength;
+                while(End < Length) {
+                    SectorLength = scim::min(Device::DELTA_SECTOR_SIZE, Length - End);
+                    if(!memcmp(BaseChunk + End, ChangedChunk + End, SectorLength)) break;
+                    End += SectorLength;
+                }
+                Success = Overlay.Write(Offset + Start, End - Start, ChangedChunk + Start);
+                if(!Success) std::cerr << "SCIM: Error - Could not write to the delta\n";
+                Start = End;
+            }
+            Offset += Length;
+        }
+
+        free(BaseChunk);
+        free(ChangedChunk);
+        close(Base);
+        close(Changed);
+        if(Success && !Overlay.Sync()) {
+            std::cerr << "SCIM: Error - Could not write to the delta\n";
+            Success = false;
+        }
+        if(!Success) return -43;
+        printf("%llu sectors differ\n", Overlay.SectorCount());
+        return 0;
+    }
+
+}                           // contains the commit and diff modes for overlays
@@ -0,0 +1,409 @@
+// provision.hpp
+//
+// provision mode for SCIM, which clones a template disk image once for each unit in a manifest and gives every clone its own
+// serial number, volume label, and files
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// manifest format
+// - blank lines and lines starting with # are ignored
+// - each unit starts with an image line giving the image to create, its serial number, and optionally its volume label. The
+//   serial number is either "auto" or 8 hex digits that follow "docs/SawconOS Disk Serial Numbers.txt". "auto" takes the year
+//   and version category from -s/--serial-version the same way format mode does and puts the unit's position in the manifest
+//   in the xxx digits, so every unit that uses it gets a different serial number. Only the first 999 units can use it. The
+//   template's label is kept if one isn't given
+// - file lines copy a host file into the unit above them. The entry comes first, either as an 11 character "NAME    EXT" name
+//   in the root directory or as a path starting with /, followed by the host file. An entry that is already there is replaced
+//
+// image out/unit001.img 0x26A1405C UNIT 001
+// file CONFIG  SYS units/001/config.sys
+// file /SYS/UNIT.CFG units/001/unit.cfg
+// image out/unit002.img auto UNIT 002
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Provision {
+
+    typedef struct File_t {
+        char *EntryName;                                // "NAME    EXT" or a path starting with /. malloced
+        char *HostPath;                                 // malloced
+    } File_t;
+
+    typedef struct Unit_t {
+        char *ImagePath;                                // image to create. malloced
+        scim::dword Serial;
+        bool SerialGenerated;                           // set for an "auto" serial number, which is numbered from the unit's position in the manifest
+        char VolumeLabel[11];                           // padded with spaces
+        bool LabelSpecified;                            // the template's label is kept otherwise
+        size_t FirstFile;                               // index of the unit's first file in the file list
+        size_t FileCount;
+    } Unit_t;
+
+    typedef struct Manifest_t {
+        Unit_t *Units = NULL;
+        size_t UnitCount = 0;
+        size_t UnitCapacity = 0;
+        File_t *Files = NULL;                           // every unit's files, in manifest order
+        size_t FileCount = 0;
+        size_t FileCapacity = 0;
+    } Manifest_t;
+
+    typedef struct Template_t {
+        int FileDescriptor;                             // template image opened for reading
+        scim::qword Size;
+        FAT::FAT_TYPE Type;
+        scim::word BytesPerSector;
+        scim::word BackupBootSector;                    // FAT32 backup boot sector, 0 if there isn't one
+        scim::qword LabelEntryOffset;                   // volume label entry in the root directory, 0 if there isn't one
+    } Template_t;           // everything about the template that is worked out once and shared by every worker
+
+    /// @brief make room for one more item at the end of a malloced array, doubling its capacity when it is full
+    /// @param Array array to grow. NULL if it is empty
+    /// @param Count number of items in the array
+    /// @param Capacity number of items the array has space for
+    /// @return true on success, false if there isn't enough memory
+    template<typename T> bool Reserve(T **Array, size_t Count, size_t *Capacity) {
+        if(Count < *Capacity) return true;
+        size_t NewCapacity = *Capacity ? *Capacity * 2 : 64;
+        T *Resized = (T *)realloc(*Array, NewCapacity * sizeof(T));
+        if(!Resized) return false;
+        *Array = Resized;
+        *Capacity = NewCapacity;
+        return true;
+    }
+
+    /// @brief free everything in a manifest
+    /// @param Manifest manifest to free
+    void FreeManifest(Manifest_t *Manifest) {
+        for(size_t i = 0; i < Manifest->UnitCount; i++) free(Manifest->Units[i].ImagePath);
+        for(size_t i = 0; i < Manifest->FileCount; i++) {
+            free(Manifest->Files[i].EntryName);
+            free(Manifest->Files[i].HostPath);
+        }
+        free(Manifest->Units);
+        free(Manifest->Files);
+    }
+
+    /// @brief cut the next word off the front of a manifest line
+    /// @param Line line to read from. Moved past the word and any spaces after it
+    /// @return the word, or NULL if the line is empty. It is null terminated in place
+    char *NextWord(char **Line) {
+        char *Word = *Line + strspn(*Line, " \t");
+        if(!*Word) return NULL;
+        char *End = Word + strcspn(Word, " \t");
+        *Line = End + strspn(End, " \t");
+        if(*End) *End = '\0';
+        return Word;
+    }
+
+    enum ProvisionInfo {
+        MAX_GENERATED_UNIT = 999,                       // the xxx digits of a serial number only go up to 999
+    };
+
+    /// @brief build the "auto" serial number of a unit. Its year and version category come from the serial number format mode
+    /// would give the disk and the xxx digits, which would otherwise hold the version, number the unit instead
+    /// @param GeneratedSerial serial number from Format::SerialID
+    /// @param UnitNumber position of the unit in the manifest, starting at 1. No more than MAX_GENERATED_UNIT
+    /// @return serial number for the unit
+    scim::dword UnitSerialID(scim::dword GeneratedSerial, size_t UnitNumber) {
+        // the digits are written as hex nibbles like the version they replace
+        scim::dword Digits = ((UnitNumber / 100) << 8) | (((UnitNumber / 10) % 10) << 4) | (UnitNumber % 10);
+        return (GeneratedSerial & 0xFFF000FF) | (Digits << 8);
+    }
+
+    /// @brief read an image line into a new unit
+    /// @param Manifest manifest to add the unit to
+    /// @param Arguments everything on the line after "image"
+    /// @param GeneratedSerial serial number "auto" serial numbers are built from, or 0 if -s/--serial-version couldn't be understood
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int ReadUnit(Manifest_t *Manifest, char *Arguments, scim::dword GeneratedSerial) {
+        char *ImagePath = NextWord(&Arguments);
+        char *SerialText = NextWord(&Arguments);
+        if(!ImagePath || !SerialText) return -33;
+        Unit_t Unit = {};
+        if(!strcasecmp(SerialText, "auto")) {
+            if(!GeneratedSerial) {
+                std::cerr << "SCIM: Error - Invalid version for the serial number\n";
+                return -29;
+            }
+            if(Manifest->UnitCount >= MAX_GENERATED_UNIT) {
+                std::cerr << "SCIM: Error - Only the first " << MAX_GENERATED_UNIT << " units in a manifest can use \"auto\" for their serial number\n";
+                return -33;
+            }
+            Unit.Serial = UnitSerialID(GeneratedSerial, Manifest->UnitCount + 1);
+            Unit.SerialGenerated = true;
+        }
+        else {
+            char *End;
+            unsigned long Serial = strtoul(SerialText, &End, 16);
+            if(*End || Serial > 0xFFFFFFFF || !Format::ValidSerialID(Serial)) {
+                std::cerr << "SCIM: Error - \"" << SerialText << "\" doesn't follow the 0xZZYxxx5C serial number scheme\n";
+                return -33;
+            }
+            Unit.Serial = Serial;
+        }
+        // the label is the rest of the line so it can have spaces in it
+        if(*Arguments) {
+            size_t Length = strlen(Arguments);
+            while(Length && (Arguments[Length - 1] == ' ' || Arguments[Length - 1] == '\t')) Length--;
+            if(Length > sizeof(Unit.VolumeLabel)) {
+                std::cerr << "SCIM: Error - Volume label \"" << Arguments << "\" is longer than 11 characters\n";
+                return -33;
+            }
+            memset(Unit.VolumeLabel, ' ', sizeof(Unit.VolumeLabel));
+            for(size_t i = 0; i < Length; i++) Unit.VolumeLabel[i] = toupper((unsigned char)Arguments[i]);
+            Unit.LabelSpecified = true;
+        }
+        Unit.FirstFile = Manifest->FileCount;
+        Unit.ImagePath = strdup(ImagePath);
+        if(!Unit.ImagePath || !Reserve(&Manifest->Units, Manifest->UnitCount, &Manifest->UnitCapacity)) {
+            free(Unit.ImagePath);
+            return -22;
+        }
+        Manifest->Units[Manifest->UnitCount++] = Unit;
+        return 0;
+    }
+
+    /// @brief read a file line into the last unit
+    /// @param Manifest manifest to add the file to. Must have at least one unit
+    /// @param Arguments everything on the line after "file"
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int ReadFile(Manifest_t *Manifest, char *Arguments) {
+        // paths end at the first space, but 11 character names can have spaces in them so they are taken as they are
+        char *EntryName, *HostPath;
+        if(*Arguments == '/') {
+            EntryName = NextWord(&Arguments);
+            HostPath = Arguments;
+        }
+        else {
+            if(strlen(Arguments) < 12 || (Arguments[11] != ' ' && Arguments[11] != '\t')) return -33;
+            EntryName = Arguments;
+            EntryName[11] = '\0';
+            HostPath = Arguments + 12 + strspn(Arguments + 12, " \t");
+        }
+        if(!*HostPath) return -33;
+        File_t File = { strdup(EntryName), strdup(HostPath) };
+        if(!File.EntryName || !File.HostPath || !Reserve(&Manifest->Files, Manifest->FileCount, &Manifest->FileCapacity)) {
+            free(File.EntryName);
+            free(File.HostPath);
+            return -22;
+        }
+        Manifest->Files[Manifest->FileCount++] = File;
+        Manifest->Units[Manifest->UnitCount - 1].FileCount++;
+        return 0;
+    }
+
+    /// @brief read every unit in a manifest
+    /// @param Stream stream to read the manifest from
+    /// @param Manifest where the units and files are stored
+    /// @param GeneratedSerial serial number "auto" serial numbers are built from, or 0 if -s/--serial-version couldn't be understood
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int ReadManifest(FILE *Stream, Manifest_t *Manifest, scim::dword GeneratedSerial) {
+        char *Line = NULL;
+        size_t LineCapacity = 0;
+        int ReturnCode = 0;
+        for(unsigned int LineNumber = 1; !ReturnCode && getline(&Line, &LineCapacity, Stream) >= 0; LineNumber++) {
+            Line[strcspn(Line, "\r\n")] = '\0';
+            char *Arguments = Line;
+            char *Keyword = NextWord(&Arguments);
+            if(!Keyword || *Keyword == '#') continue;
+            if(!strcmp(Keyword, "image")) ReturnCode = ReadUnit(Manifest, Arguments, GeneratedSerial);
+            else if(!strcmp(Keyword, "file") && Manifest->UnitCount) ReturnCode = ReadFile(Manifest, Arguments);
+            else ReturnCode = -33;
+            if(ReturnCode == -33) std::cerr << "SCIM: Error - Invalid line " << LineNumber << " in the manifest\n";
+        }
+        free(Line);
+        if(!ReturnCode && !Manifest->UnitCount) {
+            std::cerr << "SCIM: Error - The manifest doesn't have any units in it\n";
+            ReturnCode = -33;
+        }
+        return ReturnCode;
+    }
+
+    /// @brief check that no two units would write to the same image, and warn about units that were given the same serial number
+    /// @param Manifest manifest to check
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int CheckUnits(const Manifest_t *Manifest) {
+        const Unit_t **Sorted = (const Unit_t **)malloc(Manifest->UnitCount * sizeof(Unit_t *));
+        if(!Sorted) return -22;
+        for(size_t i = 0; i < Manifest->UnitCount; i++) Sorted[i] = &Manifest->Units[i];
+
+        int ReturnCode = 0;
+        qsort(Sorted, Manifest->UnitCount, sizeof(Unit_t *), [](const void *a, const void *b) {
+            return strcmp((*(const Unit_t **)a)->ImagePath, (*(const Unit_t **)b)->ImagePath);
+        });
+        for(size_t i = 1; i < Manifest->UnitCount; i++) {
+            if(strcmp(Sorted[i - 1]->ImagePath, Sorted[i]->ImagePath)) continue;
+            std::cerr << "SCIM: Error - \"" << Sorted[i]->ImagePath << "\" is in the manifest more than once\n";
+            ReturnCode = -33;
+            break;
+        }
+
+        // "auto" serial numbers never match each other but one can still match a serial number that was given explicitly
+        qsort(Sorted, Manifest->UnitCount, sizeof(Unit_t *), [](const void *a, const void *b) {
+            scim::dword SerialA = (*(const Unit_t **)a)->Serial, SerialB = (*(const Unit_t **)b)->Serial;
+            return SerialA < SerialB ? -1 : SerialA > SerialB ? 1 : 0;
+        });
+        for(size_t i = 1; !ReturnCode && i < Manifest->UnitCount; i++) {
+            if(Sorted[i - 1]->Serial != Sorted[i]->Serial) continue;
+            fprintf(stderr, "SCIM: Warning - More than one unit has the serial number 0x%08X\n", Sorted[i]->Serial);
+            while(i + 1 < Manifest->UnitCount && Sorted[i + 1]->Serial == Sorted[i]->Serial) i++;
+        }
+        free(Sorted);
+        return ReturnCode;
+    }
+
+    /// @brief make a copy of the template with Device::CloneFile. Reflinks are instant however big the image is, and filesystems
+    /// that don't support them get a sparse copy instead
+    /// @param Template template to clone
+    /// @param ImagePath image to create. An existing file is overwritten
+    /// @param ReflinkedOut set if the clone is a reflink
+    /// @return true on success, false on failure
+    bool Clone(const Template_t *Template, const char *ImagePath, bool *ReflinkedOut) {
+        int FileDescriptor = Device::CloneFile(Template->FileDescriptor, ImagePath, ReflinkedOut);
+        if(FileDescriptor < 0) return false;
+        return close(FileDescriptor) == 0;
+    }
+
+    /// @brief give a clone its serial number and volume label and copy its files into it. The files all go in as one transaction
+    /// @param Template template the unit was cloned from
+    /// @param Manifest manifest the unit is in
+    /// @param Unit unit to patch
+    /// @return true on success, false on failure
+    bool Patch(const Template_t *Template, const Manifest_t *Manifest, const Unit_t *Unit) {
+        Device::BlockDevice *Image = Device::Open(Unit->ImagePath);
+        if(!Image) return false;
+
+        // only the serial number and label change, so the rest of the boot record is written back as it was
+        FAT::BootRecord_t Record;
+        bool Success = Image->Read(FAT::BPB_OFFSET, sizeof(Record), &Record);
+        if(Success) {
+            bool FAT32 = Template->Type == FAT::T_FAT32;
+            memcpy(FAT32 ? Record.EBPB32.SerialID : Record.EBPB.SerialID, &Unit->Serial, 4);
+            if(Unit->LabelSpecified) memcpy(FAT32 ? Record.EBPB32.VolumeLabel : Record.EBPB.VolumeLabel, Unit->VolumeLabel, 11);
+            SCIM_COUNT(C_SECTORS_WRITTEN, Template->BackupBootSector ? 2 : 1);
+            Success = Image->Write(FAT::BPB_OFFSET, sizeof(Record), &Record);
+            if(Success && Template->BackupBootSector)
+                Success = Image->Write((scim::qword)Template->BackupBootSector * Template->BytesPerSector + FAT::BPB_OFFSET, sizeof(Record), &Record);
+            if(Success && Unit->LabelSpecified && Template->LabelEntryOffset) {
+                SCIM_COUNT(C_SECTORS_WRITTEN, 1);
+                Success = Image->Write(Template->LabelEntryOffset, 11, Unit->VolumeLabel);
+            }
+        }
+
+        if(Success && Unit->FileCount) {
+            FAT::Disk FileSystem;
+            Success = FileSystem.Initialise(Image) && FileSystem.BeginTransaction();
+            for(size_t i = Unit->FirstFile; Success && i < Unit->FirstFile + Unit->FileCount; i++) {
+                const File_t *File = &Manifest->Files[i];
+                FILE *HostFile = fopen(File->HostPath, "rb");
+                FAT::DirectoryEntry_t *OldEntry = FileSystem.FindEntry(File->EntryName);
+                Success = HostFile && (!OldEntry || FileSystem.DeleteEntry(OldEntry)) && FileSystem.CreateEntry(File->EntryName, FAT::A_ARCHIVE, HostFile);
+                if(HostFile) fclose(HostFile);
+                if(!Success) std::cerr << "SCIM: Error - Could not copy \"" << File->HostPath << "\" into \"" << Unit->ImagePath << "\"\n";
+            }
+            // throwing the transaction away leaves the clone with the template's files
+            Success = Success && FileSystem.Commit();
+            FileSystem.Clean();
+        }
+        delete Image;
+        return Success;
+    }
+
+    /// @brief clones and patches units until there are none left. Several of these run at once, each picking up the next unit
+    /// that nobody has taken yet. A unit that fails doesn't stop the others
+    /// @param Template template to clone
+    /// @param Manifest every unit to provision
+    /// @param NextUnit index of the next unit that hasn't been taken. Shared between all the workers
+    /// @param Reflinked number of clones that were reflinks. Shared between all the workers
+    /// @param Copied number of clones that had to be copied. Shared between all the workers
+    /// @param Failed number of units that couldn't be provisioned. Shared between all the workers
+    void Worker(const Template_t *Template, const Manifest_t *Manifest, std::atomic<size_t> *NextUnit, std::atomic<unsigned int> *Reflinked,
+                std::atomic<unsigned int> *Copied, std::atomic<unsigned int> *Failed) {
+        for(size_t i = (*NextUnit)++; i < Manifest->UnitCount; i = (*NextUnit)++) {
+            const Unit_t *Unit = &Manifest->Units[i];
+            bool Reflink;
+            if(!Clone(Template, Unit->ImagePath, &Reflink)) {
+                std::cerr << "SCIM: Error - Could not create \"" << Unit->ImagePath << "\"\n";
+                (*Failed)++;
+                continue;
+            }
+            (*(Reflink ? Reflinked : Copied))++;
+            if(!Patch(Template, Manifest, Unit)) {
+                std::cerr << "SCIM: Error - Could not patch \"" << Unit->ImagePath << "\"\n";
+                (*Failed)++;
+            }
+        }
+    }
+
+    /// @brief clones a template image once for each unit in a manifest on a pool of threads and patches each clone with its own
+    /// serial number, volume label, and files. Only the sectors that change are written, so a clone that is a reflink costs
+    /// little more than those writes
+    /// @param FileSystem template disk. Must have been initialised
+    /// @param TemplatePath path of the template image
+    /// @param ManifestStream stream to read the manifest from
+    /// @param Version version to build "auto" serial numbers from, or NULL to use the version of SCIM
+    /// @param ThreadCount number of threads provisioning units. 0 uses one thread per CPU
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int Run(FAT::Disk *FileSystem, const char *TemplatePath, FILE *ManifestStream, const char *Version, unsigned int ThreadCount) {
+        time_t now = time(0);
+        tm NowLocal;
+        localtime_r(&now, &NowLocal);
+        Manifest_t Manifest;
+        int ReturnCode = ReadManifest(ManifestStream, &Manifest, Format::SerialID(Version, NowLocal.tm_year + 1900));
+        if(!ReturnCode) ReturnCode = CheckUnits(&Manifest);
+        if(ReturnCode) {
+            FreeManifest(&Manifest);
+            return ReturnCode;
+        }
+
+        Template_t Template = {};
+        Template.Type = FileSystem->Type;
+        Template.BytesPerSector = FileSystem->FS_Info.BPB.BytesPerSector;
+        if(Template.Type == FAT::T_FAT32) Template.BackupBootSector = FileSystem->FS_Info.EBPB32.BackupBootSector;
+        for(FAT::DirectoryEntry_t &Entry : FileSystem->RootEntries()) {
+            if(Entry.Name[0] == FAT::N_END) break;
+            if(Entry.Name[0] == FAT::N_ENTRYFREE || Entry.Attributes != FAT::A_VOLUME_NAME) continue;
+            Template.LabelEntryOffset = FileSystem->EntryOffset(&Entry);
+            break;
+        }
+        Template.FileDescriptor = open(TemplatePath, O_RDONLY);
+        struct stat FileInfo;
+        if(Template.FileDescriptor < 0 || fstat(Template.FileDescriptor, &FileInfo) < 0 || !S_ISREG(FileInfo.st_mode)) {
+            std::cerr << "SCIM: Error - The template has to be a regular file\n";
+            if(Template.FileDescriptor >= 0) close(Template.FileDescriptor);
+            FreeManifest(&Manifest);
+            return -5;
+        }
+        Template.Size = FileInfo.st_size;
+
+        if(!ThreadCount) ThreadCount = std::thread::hardware_concurrency();
+        if(!ThreadCount) ThreadCount = 1;
+        if(ThreadCount > Manifest.UnitCount) ThreadCount = Manifest.UnitCount;
+        std::atomic<size_t> NextUnit(0);
+        std::atomic<unsigned int> Reflinked(0), Copied(0), Failed(0);
+        {
+            SCIM_TIME_DETAIL(P_DATA_COPY, "Provision");
+            std::thread *Workers = new std::thread[ThreadCount];
+            for(unsigned int i = 0; i < ThreadCount; i++)
+                Workers[i] = std::thread(Worker, &Template, &Manifest, &NextUnit, &Reflinked, &Copied, &Failed);
+            for(unsigned int i = 0; i < ThreadCount; i++)
+                Workers[i].join();
+            delete[] Workers;
+        }
+        close(Template.FileDescriptor);
+
+        printf("%zu images provisioned, %u failed. %u clones were reflinks and %u were copied\n", Manifest.UnitCount - Failed, (unsigned int)Failed,
+               (unsigned int)Reflinked, (unsigned int)Copied);
+        FreeManifest(&Manifest);
+        return Failed ? -41 : 0;
+    }
+
+}                           // contains the manifest reader and worker pool for provision mode
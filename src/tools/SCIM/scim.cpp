@@ -2,16 +2,22 @@
 // 
 // main source file for SCIM: the Sawcon Image Manipulator
 // This file was written as part of the SawconOS Host Tools
-// This version of the code was written for SCIM Alpha 1.3
+// This version of the code was written for SCIM Alpha 1.4
 // compiled using g++
 // 
 // Written: Saturday 12th August 2023
-// Last Updated: Sunday 10th September 2023
+// Last Updated: Saturday 17th October 2026
 // 
 // Written by Gabriel Jickells
 
 #include "scim.hpp"
 
+namespace scim {
+
+    #include "mode.hpp"
+
+}
+
 int main(int argc, char **argv) {
 
     // - argv[scim::MODE_INDEX] is expected to specify the mode that SCIM will 
@@ -40,8 +46,18 @@ int main(int argc, char **argv) {
     }
 
     // information that will be specified by the arguments passed to the tool
-    char *DiskImageFileName = NULL, *TargetEntryName = NULL, *HostFileName = NULL;
-    bool DiskImageSpecified = false, TargetEntrySpecified = false, HostFileSpecified = false;
+    char *DiskImageFileName = NULL, *TargetEntryName = NULL, *HostFileName = NULL, *OutputFileName = NULL, *HostDirectoryName = NULL;
+    bool DiskImageSpecified = false, TargetEntrySpecified = false, HostFileSpecified = false, OutputFileSpecified = false, HostDirectorySpecified = false;
+    const char *ProfileName = "sawcon", *SerialVersion = NULL;     // format mode makes a SawconOS disk stamped with the version of SCIM by default
+    bool ProfileSpecified = false, SerialVersionSpecified = false;
+    unsigned int ThreadCount = 0;               // 0 lets the mode pick one thread per CPU
+    char *TraceFileName = NULL;
+    bool StatsSpecified = false, TraceSpecified = false;
+    char *SocketPath = NULL;
+    bool SocketSpecified = false;
+    bool RepairSpecified = false;
+    char *OverlayFileName = NULL;
+    bool OverlaySpecified = false;
 
     // - parse any other arguments
     // - i starts at 1 instead of 0 because argv[0] is the program name
@@ -78,9 +94,138 @@ int main(int argc, char **argv) {
                }
                HostFileName = argv[++i];
                HostFileSpecified = true;
+        } else if(!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) {
+            // make sure the argument is being used correctly
+            if(i + 1 == argc || i + 1 == scim::MODE_INDEX ||
+               OutputFileSpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            OutputFileName = argv[++i];
+            OutputFileSpecified = true;
+        } else if(!strcmp(argv[i], "-d") || !strcmp(argv[i], "--directory")) {
+            // make sure the argument is being used correctly
+            if(i + 1 == argc || i + 1 == scim::MODE_INDEX ||
+               HostDirectorySpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            HostDirectoryName = argv[++i];
+            HostDirectorySpecified = true;
+        } else if(!strcmp(argv[i], "-j") || !strcmp(argv[i], "--jobs")) {
+            // make sure the argument is being used correctly
+            if(i + 1 == argc || i + 1 == scim::MODE_INDEX ||
+               atoi(argv[i + 1]) <= 0) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            ThreadCount = atoi(argv[++i]);
+        } else if(!strcmp(argv[i], "-p") || !strcmp(argv[i], "--profile")) {
+            // make sure the argument is being used correctly
+            if(i + 1 == argc || i + 1 == scim::MODE_INDEX ||
+               ProfileSpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            ProfileName = argv[++i];
+            ProfileSpecified = true;
+        } else if(!strcmp(argv[i], "-s") || !strcmp(argv[i], "--serial-version")) {
+            // make sure the argument is being used correctly
+            if(i + 1 == argc || i + 1 == scim::MODE_INDEX ||
+               SerialVersionSpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            SerialVersion = argv[++i];
+            SerialVersionSpecified = true;
+        } else if(!strcmp(argv[i], "--stats")) {
+            if(StatsSpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            StatsSpecified = true;
+        } else if(!strcmp(argv[i], "--trace")) {
+            // make sure the argument is being used correctly
+            if(i + 1 == argc || i + 1 == scim::MODE_INDEX ||
+               TraceSpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            TraceFileName = argv[++i];
+            TraceSpecified = true;
+        } else if(!strcmp(argv[i], "--socket")) {
+            // make sure the argument is being used correctly
+            if(i + 1 == argc || i + 1 == scim::MODE_INDEX ||
+               SocketSpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            SocketPath = argv[++i];
+            SocketSpecified = true;
+        } else if(!strcmp(argv[i], "--repair")) {
+            if(RepairSpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            RepairSpecified = true;
+        } else if(!strcmp(argv[i], "--overlay")) {
+            // make sure the argument is being used correctly
+            if(i + 1 == argc || i + 1 == scim::MODE_INDEX ||
+               OverlaySpecified == true) {
+                std::cerr << "SCIM: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+                return -2;
+            }
+            OverlayFileName = argv[++i];
+            OverlaySpecified = true;
         }
     }
 
+    // turn on the instrumentation before anything gets counted
+    if(StatsSpecified || TraceSpecified) {
+#ifdef SCIM_STATS
+        FILE *TraceFile = NULL;
+        if(TraceSpecified) {
+            // "-" sends the trace to stderr so it doesn't get mixed up with file data written to stdout
+            TraceFile = strcmp(TraceFileName, "-") ? fopen(TraceFileName, "w") : stderr;
+            if(!TraceFile) {
+                std::cerr << "SCIM: Error - Could not open the trace file\n";
+                return -30;
+            }
+        }
+        scim::Stats::Enable(TraceFile);
+        if(StatsSpecified) atexit(scim::Stats::PrintSummary);
+#else
+        (void)TraceFileName;            // only used when the instrumentation is compiled in
+        std::cerr << "SCIM: Error - This build of SCIM doesn't have --stats or --trace. Build it with -DSCIM_STATS\n";
+        return -30;
+#endif
+    }
+
+    // format and provision write whole image files themselves and servers open their own images, so none of them can go
+    // through an overlay
+    if(OverlaySpecified && (mode == scim::M_FORMAT || mode == scim::M_PROVISION || mode == scim::M_SERVE || SocketSpecified)) {
+        std::cerr << "SCIM: Error - " << scim::ValidModes[mode - 1] << " can't be used with an overlay here\n";
+        return -2;
+    }
+
+    // serve mode doesn't need an image because clients say which one they want. -i just opens one before the first request
+    if(mode == scim::M_SERVE) {
+        if(!SocketSpecified) {
+            std::cerr << "SCIM: Error - Socket not specified\n";
+            return -35;
+        }
+        return scim::Serve::Run(SocketPath, DiskImageSpecified ? DiskImageFileName : NULL);
+    }
+
+    // geometry mode only writes out a profile, so it doesn't need an image either
+    if(mode == scim::M_GEOMETRY) {
+        if(!OutputFileSpecified) {
+            std::cerr << "SCIM: Error - Output file not specified\n";
+            return -20;
+        }
+        return scim::Format::Geometry(ProfileName, OutputFileName);
+    }
+
     // do mode independent operations such as opening the disk image
 
     // make sure a disk image was specified before SCIM tries to read it
@@ -89,38 +234,102 @@ int main(int argc, char **argv) {
         return -3;
     }
 
-    // open the image for reading and writing in binary mode
-    FILE *ImageStream = fopen(DiskImageFileName, "rb+");
-    if(!ImageStream) {
+    SCIM_TIME_DETAIL(P_MODE, scim::ValidModes[mode - 1]);
+
+    // with --socket the request is sent to a SCIM server that already has the image open instead of being carried out here
+    if(SocketSpecified) {
+        if((mode == scim::M_READ || mode == scim::M_WRITE || mode == scim::M_DELETE) && !TargetEntrySpecified) {
+            std::cerr << "SCIM: Error - No target entry was specified\n";
+            return -7;
+        }
+        if(mode == scim::M_WRITE && !HostFileSpecified) {
+            std::cerr << "SCIM: Error - Host file not specified\n";
+            return -14;
+        }
+        int OutputFileDescriptor = STDOUT_FILENO;
+        if(mode == scim::M_READ && OutputFileSpecified) {
+            OutputFileDescriptor = open(OutputFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(OutputFileDescriptor < 0) {
+                std::cerr << "SCIM: Error - Could not open the output file\n";
+                return -20;
+            }
+        }
+        int RequestResult;
+        switch(mode) {
+            case scim::M_LIST: RequestResult = scim::Serve::Request(SocketPath, scim::Serve::OP_LIST, DiskImageFileName, NULL, NULL, OutputFileDescriptor); break;
+            case scim::M_READ: RequestResult = scim::Serve::Request(SocketPath, scim::Serve::OP_READ, DiskImageFileName, TargetEntryName, NULL, OutputFileDescriptor); break;
+            case scim::M_WRITE: RequestResult = scim::Serve::Request(SocketPath, scim::Serve::OP_WRITE, DiskImageFileName, TargetEntryName, HostFileName, OutputFileDescriptor); break;
+            case scim::M_DELETE: RequestResult = scim::Serve::Request(SocketPath, scim::Serve::OP_DELETE, DiskImageFileName, TargetEntryName, NULL, OutputFileDescriptor); break;
+            default:
+                std::cerr << "SCIM: Error - Only list, read, write, and delete can be sent to a server\n";
+                RequestResult = -2;
+        }
+        if(OutputFileDescriptor != STDOUT_FILENO) close(OutputFileDescriptor);
+        return RequestResult;
+    }
+
+    // format mode creates the image so there isn't anything to open yet. -f is the boot sector to put on the disk
+    if(mode == scim::M_FORMAT)
+        return scim::Format::Run(DiskImageFileName, ProfileName, HostFileSpecified ? HostFileName : NULL, SerialVersion);
+
+    // commit and diff work on whole images and deltas rather than on a file system
+    if(mode == scim::M_COMMIT || mode == scim::M_DIFF) {
+        if(!OutputFileSpecified) {
+            std::cerr << "SCIM: Error - Output file not specified\n";
+            return -20;
+        }
+        if(mode == scim::M_COMMIT) {
+            if(!OverlaySpecified) {
+                std::cerr << "SCIM: Error - Overlay not specified\n";
+                return -42;
+            }
+            return scim::Overlay::Commit(DiskImageFileName, OverlayFileName, OutputFileName);
+        }
+        // -f is the image that the delta in -o turns -i into
+        if(!HostFileSpecified) {
+            std::cerr << "SCIM: Error - Host file not specified\n";
+            return -14;
+        }
+        return scim::Overlay::Diff(DiskImageFileName, HostFileName, OutputFileName);
+    }
+
+    // open the image for reading and writing. The image is memory mapped where possible. With --overlay the image is only
+    // read and every write goes into the delta instead
+    scim::Device::BlockDevice *ImageDevice = OverlaySpecified ? scim::Device::OpenOverlay(DiskImageFileName, OverlayFileName)
+                                                              : scim::Device::Open(DiskImageFileName);
+    if(!ImageDevice && OverlaySpecified) {
+        std::cerr << "SCIM: Error - Could not open the overlay. It has to be a delta made against this image\n";
+        return -42;
+    }
+    if(!ImageDevice) {
         std::cerr << "SCIM: Error - Could not open disk image\n";
         return -5;
     }
     // perform operations exclusive to the different modes
 
-    scim::FAT12::Disk FileSystem;
+    scim::FAT::Disk FileSystem;
     scim::FAT::DirectoryEntry_t *TargetEntry;
-    scim::byte *EntryBuffer = NULL;
+    int OutputFileDescriptor;
     FILE *HostFileStream;
 
     switch(mode) {
         case scim::M_LIST:
-            if(!FileSystem.Initialise(ImageStream)) {
-                std::cerr << "SCIM: Error - Could not initalise FAT12\n";
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
                 return -6;
             }
-            for(int i = 0; i < FileSystem.FS_Info.BPB.RootDirectoryEntries; i++) {
-                if(FileSystem.RootDirectory[i].Name[0] == scim::FAT::N_END) break;
-                if(FileSystem.RootDirectory[i].Name[0] == scim::FAT::N_ENTRYFREE) continue;
-                if(FileSystem.RootDirectory[i].Name[0] == scim::FAT::N_SIGMALOW) FileSystem.RootDirectory->Name[0] = (char)0xe5;
-                printf("%.11s\n", FileSystem.RootDirectory[i].Name);
+            // -e is optional here and picks a sub-directory such as "/SYS/DRIVERS" to list instead of the root directory
+            if(!scim::Operations::List(&FileSystem, TargetEntrySpecified ? TargetEntryName : NULL)) {
+                std::cerr << "SCIM: Error - Could not find the directory\n";
+                return -8;
             }
 
             FileSystem.Clean();
             break;
 
         case scim::M_READ:
-            if(!FileSystem.Initialise(ImageStream)) {
-                std::cerr << "SCIM: Error - Could not initialise FAT12\n";
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
                 return -6;
             }
             if(!TargetEntrySpecified) {
@@ -133,18 +342,24 @@ int main(int argc, char **argv) {
                 std::cerr << "SCIM: Error - Could not find the file entry\n";
                 return -8;
             }
-            
-            // very long line that just mallocs the size of the file entry rounded up to the next cluster
-            EntryBuffer = (scim::byte *)malloc(TargetEntry->Size + (FileSystem.FS_Info.BPB.SectorsPerCluster * FileSystem.FS_Info.BPB.BytesPerSector - (TargetEntry->Size % (FileSystem.FS_Info.BPB.SectorsPerCluster * FileSystem.FS_Info.BPB.BytesPerSector))));
-            if(!FileSystem.ReadEntry(ImageStream, TargetEntry, EntryBuffer)) {
+
+            // the file is streamed to -o if it was given, otherwise to stdout
+            OutputFileDescriptor = STDOUT_FILENO;
+            if(OutputFileSpecified) {
+                OutputFileDescriptor = open(OutputFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if(OutputFileDescriptor < 0) {
+                    std::cerr << "SCIM: Error - Could not open the output file\n";
+                    return -20;
+                }
+            }
+
+            if(!FileSystem.StreamEntry(TargetEntry, OutputFileDescriptor)) {
                 std::cerr << "SCIM: Error - Could not read the target entry\n";
                 return -9;
             }
 
-            std::cout << EntryBuffer;
-            
             // clean up
-            free(EntryBuffer);
+            if(OutputFileSpecified) close(OutputFileDescriptor);
             FileSystem.Clean();
             break;
 
@@ -156,8 +371,8 @@ int main(int argc, char **argv) {
             }
 
             // scan the surroundings
-            if(!FileSystem.Initialise(ImageStream)) {
-                std::cerr << "SCIM: Error - Could not initialise FAT12\n";
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
                 return -6;
             }
 
@@ -169,7 +384,7 @@ int main(int argc, char **argv) {
             }
 
             // KILL HIM
-            if(!FileSystem.DeleteEntry(ImageStream, TargetEntry)) {
+            if(!FileSystem.DeleteEntry(TargetEntry)) {
                 std::cerr << "SCIM: Error - Could not delete the file\n";
                 return -10;
             }
@@ -178,8 +393,8 @@ int main(int argc, char **argv) {
             break;
 
         case scim::M_WRITE:
-            if(!FileSystem.Initialise(ImageStream)) {
-                std::cerr << "SCIM: Error - Could not initialise FAT12\n";
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
                 return -11;
             }
 
@@ -199,7 +414,7 @@ int main(int argc, char **argv) {
                 return -13;
             }
 
-            if(!FileSystem.CreateEntry(ImageStream, TargetEntryName, scim::FAT::A_ARCHIVE, HostFileStream)) {
+            if(!FileSystem.CreateEntry(TargetEntryName, scim::FAT::A_ARCHIVE, HostFileStream)) {
                 std::cerr << "SCIM: Error - Could not create entry\n";
                 return -12;
             }
@@ -207,11 +422,182 @@ int main(int argc, char **argv) {
             FileSystem.Clean();
             break;
 
+        case scim::M_BATCH: {
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
+                return -6;
+            }
+
+            // the manifest comes from -f if it was given, otherwise from stdin
+            FILE *Manifest = stdin;
+            if(HostFileSpecified) {
+                Manifest = fopen(HostFileName, "r");
+                if(!Manifest) {
+                    std::cerr << "SCIM: Error - Could not open the manifest\n";
+                    return -16;
+                }
+            }
+
+            int BatchResult = scim::Batch::Run(&FileSystem, Manifest);
+            if(Manifest != stdin) fclose(Manifest);
+            FileSystem.Clean();
+            if(BatchResult) {
+                delete ImageDevice;
+                return BatchResult;
+            }
+            break;
+        }
+
+        case scim::M_IMPORT: {
+            if(!HostDirectorySpecified) {
+                std::cerr << "SCIM: Error - Host directory not specified\n";
+                return -25;
+            }
+
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
+                return -6;
+            }
+
+            int ImportResult = scim::Import::Run(&FileSystem, HostDirectoryName, ThreadCount);
+            FileSystem.Clean();
+            if(ImportResult) {
+                delete ImageDevice;
+                return ImportResult;
+            }
+            break;
+        }
+
+        case scim::M_DEFRAG: {
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
+                return -6;
+            }
+
+            // -e is optional here and picks the file that goes first in the data section
+            int DefragResult = scim::Defrag::Run(&FileSystem, TargetEntrySpecified ? TargetEntryName : NULL);
+            FileSystem.Clean();
+            if(DefragResult) {
+                delete ImageDevice;
+                return DefragResult;
+            }
+            break;
+        }
+
+        case scim::M_SYNC: {
+            // files come from -d if it was given, otherwise from a manifest in -f or stdin
+            FILE *Manifest = stdin;
+            if(!HostDirectorySpecified && HostFileSpecified) {
+                Manifest = fopen(HostFileName, "r");
+                if(!Manifest) {
+                    std::cerr << "SCIM: Error - Could not open the manifest\n";
+                    return -16;
+                }
+            }
+
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
+                return -6;
+            }
+
+            int SyncResult = scim::Sync::Run(&FileSystem, HostDirectorySpecified ? HostDirectoryName : NULL, Manifest);
+            if(Manifest != stdin) fclose(Manifest);
+            FileSystem.Clean();
+            if(SyncResult) {
+                delete ImageDevice;
+                return SyncResult;
+            }
+            break;
+        }
+
+        case scim::M_CHECK: {
+            // check mode validates the boot record before initialising the file system itself
+            int CheckResult = scim::Check::Run(ImageDevice, RepairSpecified);
+            if(CheckResult) {
+                delete ImageDevice;
+                return CheckResult;
+            }
+            break;
+        }
+
+        case scim::M_EXTRACT: {
+            if(!HostDirectorySpecified) {
+                std::cerr << "SCIM: Error - Host directory not specified\n";
+                return -25;
+            }
+
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
+                return -6;
+            }
+
+            // -e is optional here and is a pattern such as "*.BIN" that picks which files come out
+            int ExtractResult = scim::Extract::Run(&FileSystem, ImageDevice, HostDirectoryName, TargetEntrySpecified ? TargetEntryName : NULL, ThreadCount);
+            FileSystem.Clean();
+            if(ExtractResult) {
+                delete ImageDevice;
+                return ExtractResult;
+            }
+            break;
+        }
+
+        case scim::M_MKDIR:
+        case scim::M_RMDIR:
+            // -e is the path of the directory such as "/SYS/DRIVERS"
+            if(!TargetEntrySpecified) {
+                std::cerr << "SCIM: Error - No target entry was specified\n";
+                return -7;
+            }
+
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
+                return -6;
+            }
+
+            if(mode == scim::M_MKDIR && !FileSystem.MakeDirectory(TargetEntryName)) {
+                std::cerr << "SCIM: Error - Could not create the directory\n";
+                return -39;
+            }
+            if(mode == scim::M_RMDIR && !FileSystem.RemoveDirectory(TargetEntryName)) {
+                std::cerr << "SCIM: Error - Could not remove the directory. It must exist and be empty\n";
+                return -40;
+            }
+
+            FileSystem.Clean();
+            break;
+
+        case scim::M_PROVISION: {
+            // -i is the template and the units come from a manifest in -f or stdin
+            FILE *Manifest = stdin;
+            if(HostFileSpecified) {
+                Manifest = fopen(HostFileName, "r");
+                if(!Manifest) {
+                    std::cerr << "SCIM: Error - Could not open the manifest\n";
+                    return -16;
+                }
+            }
+
+            if(!FileSystem.Initialise(ImageDevice)) {
+                std::cerr << "SCIM: Error - Could not initialise the file system\n";
+                return -6;
+            }
+
+            int ProvisionResult = scim::Provision::Run(&FileSystem, DiskImageFileName, Manifest, SerialVersion, ThreadCount);
+            if(Manifest != stdin) fclose(Manifest);
+            FileSystem.Clean();
+            if(ProvisionResult) {
+                delete ImageDevice;
+                return ProvisionResult;
+            }
+            break;
+        }
+
         default:
             std::cerr << "SCIM: Error - Unexpected Mode\n";
             return -6;          // I don't think this error is possible to produce but better safe than sorry
     }
 
+    delete ImageDevice;
     return 0;
 
 }
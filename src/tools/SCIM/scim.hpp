@@ -2,31 +2,196 @@
 //
 // main header file for the Sawcon Image Manipulator
 // This file was written for the Sawcon Image Manipulator
-// This version of the header was written for SCIM Alpha 1.3
+// This version of the header was written for SCIM Alpha 1.4
 // 
 // Written: Sunday 13th August 2023
-// Last Updated: Wednesday 13th September 2023
+// Last Updated: Saturday 17th October 2026
 // 
 // Written by Gabriel Jickells
 
 #pragma once
 #include <iostream>
+#include <array>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctime>
+#include <ctype.h>
+#include <dirent.h>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <thread>
+#include <utility>
+#include <errno.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 namespace scim {
 
     using byte = unsigned char;
     using word = unsigned short;
     using dword = unsigned int;
+    using qword = unsigned long long;
 
-    size_t min(size_t a, size_t b) {
+    #include "stats.hpp"
+
+    inline size_t min(size_t a, size_t b) {
         return a < b ? a : b;
     }
 
+    enum ShiftInfo {
+        NO_SHIFT = 0xFF,                                // ShiftFor couldn't find a shift so a multiply or divide has to be used
+    };
+
+    /// @brief find the shift that multiplies by a number, so sizes from a BPB can be used without multiplies and divides
+    /// @param Value number to multiply by
+    /// @return log2 of Value if it is a power of two, NO_SHIFT if it isn't
+    constexpr byte ShiftFor(dword Value) {
+        if(!Value || (Value & (Value - 1))) return NO_SHIFT;
+        byte Shift = 0;
+        while(Value >>= 1) Shift++;
+        return Shift;
+    }
+
+    /// @brief write a whole buffer to a file descriptor, carrying on after partial writes and interrupts
+    /// @param FileDescriptor where to write the data
+    /// @param Buffer data to write
+    /// @param Length number of bytes to write
+    /// @return true on success, false on failure
+    inline bool WriteAll(int FileDescriptor, const void *Buffer, size_t Length) {
+        const byte *Remaining = (const byte *)Buffer;
+        while(Length) {
+            ssize_t Written = write(FileDescriptor, Remaining, Length);
+            SCIM_COUNT(C_SYSCALLS, 1);
+            if(Written < 0) {
+                if(errno == EINTR) continue;
+                return false;
+            }
+            Remaining += Written;
+            Length -= Written;
+        }
+        return true;
+    }
+
+    /// @brief write a whole buffer to a byte offset in a file without moving the file position, so several threads can write to
+    /// different parts of the same file at once
+    /// @param FileDescriptor where to write the data
+    /// @param Buffer data to write
+    /// @param Length number of bytes to write
+    /// @param Offset byte offset in the file to write at
+    /// @return true on success, false on failure
+    inline bool WriteAllAt(int FileDescriptor, const void *Buffer, size_t Length, qword Offset) {
+        const byte *Remaining = (const byte *)Buffer;
+        while(Length) {
+            ssize_t Written = pwrite(FileDescriptor, Remaining, Length, Offset);
+            SCIM_COUNT(C_SYSCALLS, 1);
+            if(Written < 0) {
+                if(errno == EINTR) continue;
+                return false;
+            }
+            Remaining += Written;
+            Length -= Written;
+            Offset += Written;
+        }
+        return true;
+    }
+
+    /// @brief read a whole buffer from a byte offset in a file without moving the file position, carrying on after partial reads
+    /// and interrupts
+    /// @param FileDescriptor where to read the data from
+    /// @param BufferOut where the data will be stored
+    /// @param Length number of bytes to read
+    /// @param Offset byte offset in the file to read from
+    /// @return true on success, false on failure or if the file ends first
+    inline bool ReadAllAt(int FileDescriptor, void *BufferOut, size_t Length, qword Offset) {
+        byte *Remaining = (byte *)BufferOut;
+        while(Length) {
+            ssize_t Got = pread(FileDescriptor, Remaining, Length, Offset);
+            SCIM_COUNT(C_SYSCALLS, 1);
+            if(Got < 0 && errno == EINTR) continue;
+            if(Got <= 0) return false;
+            Remaining += Got;
+            Length -= Got;
+            Offset += Got;
+        }
+        return true;
+    }
+
+    /// @brief 64 bit hash that can be fed data a piece at a time and gives the same result no matter how the data is split up.
+    /// It isn't cryptographic. It only has to notice when a file has changed, and it takes 8 bytes at a time so it is quick
+    class Hash_t {
+
+        public:
+
+            /// @brief add some data to the hash
+            /// @param Data data to add
+            /// @param Length number of bytes to add
+            void Update(const void *Data, size_t Length) {
+                const byte *Bytes = (const byte *)Data;
+                TotalLength += Length;
+                // top up the bytes left over from last time first
+                while(PendingLength && Length) {
+                    Pending[PendingLength++] = *Bytes++;
+                    Length--;
+                    if(PendingLength == 8) {
+                        Mix(Pending);
+                        PendingLength = 0;
+                    }
+                }
+                for(; Length >= 8; Bytes += 8, Length -= 8)
+                    Mix(Bytes);
+                memcpy(Pending, Bytes, Length);
+                PendingLength += Length;
+            }
+
+            /// @return the hash of everything passed to Update
+            qword Finish() {
+                memset(Pending + PendingLength, 0, 8 - PendingLength);
+                if(PendingLength) Mix(Pending);
+                // the length goes in so that trailing zeroes still change the hash
+                qword Result = State ^ TotalLength;
+                Result ^= Result >> 33;
+                Result *= 0xFF51AFD7ED558CCDULL;
+                Result ^= Result >> 33;
+                Result *= 0xC4CEB9FE1A85EC53ULL;
+                return Result ^ (Result >> 33);
+            }
+
+        private:
+
+            qword State = 0x9E3779B97F4A7C15ULL;
+            qword TotalLength = 0;
+            byte Pending[8];
+            size_t PendingLength = 0;
+
+            void Mix(const byte *Bytes) {
+                qword Word;
+                memcpy(&Word, Bytes, 8);
+                State ^= Word * 0x87C37B91114253D5ULL;
+                State = ((State << 31) | (State >> 33)) * 0x4CF5AD432745937FULL;
+            }
+
+    };
+
+    #include "device.hpp"
+
+    // fat.hpp includes geometry.hpp for the layouts of the geometry profiles
     #include "fat.hpp"
     
-    #include "mode.hpp"
+    // the modes are compiled into libscim once by libscim.cpp, so only their entry points are declared here
+    #include "library.hpp"
 
 }
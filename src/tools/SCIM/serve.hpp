@@ -0,0 +1,375 @@
+// serve.hpp
+//
+// serve mode for SCIM, which keeps disk images open and answers requests from other SCIM processes over a Unix domain socket
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// protocol
+// - the client sends a RequestHeader_t, then the absolute path of the disk image, then the file data if it is a write
+// - the server sends back a ResponseHeader_t, then the entry names (one per line) for a list or the file data for a read
+// - a connection can carry any number of requests one after the other. Everything is in host byte order because both ends
+//   are on the same machine
+//
+// images are opened the first time a request names them and stay open until the server exits, so nothing else should change
+// them while they are being served
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Serve {
+
+    // OPERATIONS is in library.hpp because clients need it too
+
+    enum ProtocolInfo {
+        MAX_IMAGE_PATH = 4096,                          // longest image path a request can have
+        LISTEN_BACKLOG = 64,
+    };
+
+    typedef struct RequestHeader_t {
+        scim::qword Length;                             // number of bytes after the header: the image path followed by the file data
+        scim::byte Operation;                           // one of OPERATIONS
+        char EntryName[11];                             // "NAME    EXT" format. Ignored by list
+        scim::word ImagePathLength;                     // length of the image path, which isn't null terminated
+    } __attribute__((packed)) RequestHeader_t;
+
+    typedef struct ResponseHeader_t {
+        scim::qword Length;                             // number of bytes after the header
+        int Status;                                     // 0 on success, otherwise one of the SCIM error codes
+    } __attribute__((packed)) ResponseHeader_t;
+
+    /// @brief a disk image that the server has open. List and read requests share Lock so they can run at the same time, and
+    /// write and delete requests take it for themselves
+    struct Image_t {
+        char *Path = NULL;                              // path the image was opened with. malloced
+        Device::BlockDevice *ImageDevice = NULL;
+        FAT::Disk FileSystem;
+        std::shared_mutex Lock;
+        Image_t *Next = NULL;
+    };
+
+    Image_t *Images = NULL;                             // every image that has been opened so far
+    std::mutex ImagesLock;                              // held while Images is searched or added to
+
+    /// @brief read a whole buffer from a file descriptor, carrying on after partial reads and interrupts
+    /// @param FileDescriptor where to read the data from
+    /// @param BufferOut where the data will be stored
+    /// @param Length number of bytes to read
+    /// @return true on success, false on failure or if the other end closed before everything arrived
+    bool ReadAll(int FileDescriptor, void *BufferOut, size_t Length) {
+        scim::byte *Remaining = (scim::byte *)BufferOut;
+        while(Length) {
+            ssize_t BytesRead = read(FileDescriptor, Remaining, Length);
+            SCIM_COUNT(C_SYSCALLS, 1);
+            if(BytesRead < 0 && errno == EINTR) continue;
+            if(BytesRead <= 0) return false;
+            Remaining += BytesRead;
+            Length -= BytesRead;
+        }
+        return true;
+    }
+
+    /// @brief find an image that is already open, or open it and read its file system if this is the first request for it
+    /// @param Path path of the disk image
+    /// @param StatusOut where the SCIM error code is stored on failure
+    /// @return the image on success, NULL on failure
+    Image_t *GetImage(const char *Path, int *StatusOut) {
+        std::lock_guard<std::mutex> Guard(ImagesLock);
+        for(Image_t *Image = Images; Image; Image = Image->Next)
+            if(!strcmp(Image->Path, Path)) return Image;
+
+        Image_t *Image = new Image_t;
+        Image->Path = strdup(Path);
+        Image->ImageDevice = Device::Open(Path);
+        if(!Image->Path || !Image->ImageDevice) *StatusOut = -5;
+        else if(!Image->FileSystem.Initialise(Image->ImageDevice)) *StatusOut = -6;
+        else {
+            Image->Next = Images;
+            Images = Image;
+            return Image;
+        }
+        Image->FileSystem.Clean();
+        delete Image->ImageDevice;
+        free(Image->Path);
+        delete Image;
+        return NULL;
+    }
+
+    /// @brief send a response that doesn't have any data after it
+    /// @param Connection socket to send the response on
+    /// @param Status 0 on success, otherwise one of the SCIM error codes
+    /// @return true on success, false if the client has gone
+    bool SendStatus(int Connection, int Status) {
+        ResponseHeader_t Response = { 0, Status };
+        return scim::WriteAll(Connection, &Response, sizeof(Response));
+    }
+
+    /// @brief answer a list request with the name of every entry in the root directory, one per line
+    /// @param Connection socket to send the response on
+    /// @param Image image to list
+    /// @return true on success, false if the client has gone
+    bool List(int Connection, Image_t *Image) {
+        std::shared_lock<std::shared_mutex> Guard(Image->Lock);
+        FAT::Disk *FileSystem = &Image->FileSystem;
+        std::span<FAT::DirectoryEntry_t> RootEntries = FileSystem->RootEntries();
+        char *Names = (char *)malloc(RootEntries.size() * 12 + 1);
+        if(!Names) return SendStatus(Connection, -22);
+        size_t Length = 0;
+        for(const FAT::DirectoryEntry_t &Entry : RootEntries) {
+            if(Entry.Name[0] == FAT::N_END) break;
+            if(Entry.Name[0] == FAT::N_ENTRYFREE) continue;
+            memcpy(Names + Length, Entry.Name, 11);
+            if(Names[Length] == FAT::N_SIGMALOW) Names[Length] = (char)0xe5;
+            Names[Length + 11] = '\n';
+            Length += 12;
+        }
+        ResponseHeader_t Response = { Length, 0 };
+        bool Success = scim::WriteAll(Connection, &Response, sizeof(Response)) && scim::WriteAll(Connection, Names, Length);
+        free(Names);
+        return Success;
+    }
+
+    /// @brief answer a read request with the contents of a file entry, streamed straight from the image to the socket
+    /// @param Connection socket to send the response on
+    /// @param Image image to read from
+    /// @param EntryName name of the file entry in "NAME    EXT" format
+    /// @return true on success, false if the client has gone or the read failed part way through
+    bool Read(int Connection, Image_t *Image, const char *EntryName) {
+        std::shared_lock<std::shared_mutex> Guard(Image->Lock);
+        FAT::DirectoryEntry_t *Entry = Image->FileSystem.FindEntry(EntryName);
+        if(!Entry) return SendStatus(Connection, -8);
+        ResponseHeader_t Response = { Entry->Size, 0 };
+        // the length has already gone out so a failure after this point can only be reported by dropping the connection
+        return scim::WriteAll(Connection, &Response, sizeof(Response)) && Image->FileSystem.StreamEntry(Entry, Connection);
+    }
+
+    /// @brief answer a write request by creating a new file entry
+    /// @param Connection socket to send the response on
+    /// @param Image image to write to
+    /// @param EntryName name of the new file entry in "NAME    EXT" format
+    /// @param Data file data that came with the request
+    /// @param Length size of the file data in bytes
+    /// @return true on success, false if the client has gone
+    bool Write(int Connection, Image_t *Image, const char *EntryName, scim::byte *Data, size_t Length) {
+        std::unique_lock<std::shared_mutex> Guard(Image->Lock);
+        bool Success;
+        // fmemopen won't open an empty buffer on some systems, and empty files don't have any data to copy anyway
+        if(!Length) Success = Image->FileSystem.AddEntry(EntryName, FAT::A_ARCHIVE, 0) != NULL;
+        else {
+            FILE *DataStream = fmemopen(Data, Length, "rb");
+            Success = DataStream && Image->FileSystem.CreateEntry(EntryName, FAT::A_ARCHIVE, DataStream);
+            if(DataStream) fclose(DataStream);
+        }
+        return SendStatus(Connection, Success ? 0 : -12);
+    }
+
+    /// @brief answer a delete request
+    /// @param Connection socket to send the response on
+    /// @param Image image to delete from
+    /// @param EntryName name of the file entry in "NAME    EXT" format
+    /// @return true on success, false if the client has gone
+    bool Delete(int Connection, Image_t *Image, const char *EntryName) {
+        std::unique_lock<std::shared_mutex> Guard(Image->Lock);
+        FAT::DirectoryEntry_t *Entry = Image->FileSystem.FindEntry(EntryName);
+        if(!Entry) return SendStatus(Connection, -8);
+        return SendStatus(Connection, Image->FileSystem.DeleteEntry(Entry) ? 0 : -10);
+    }
+
+    /// @brief read one request from a client and answer it
+    /// @param Connection socket connected to the client
+    /// @return true if the connection can carry on, false if it should be closed
+    bool HandleRequest(int Connection) {
+        RequestHeader_t Request;
+        if(!ReadAll(Connection, &Request, sizeof(Request))) return false;
+        if(!Request.ImagePathLength || Request.ImagePathLength > MAX_IMAGE_PATH || Request.Length < Request.ImagePathLength) return false;
+        scim::qword DataLength = Request.Length - Request.ImagePathLength;
+        // only writes carry data, and FAT files can't be bigger than 4GiB
+        if((Request.Operation != OP_WRITE && DataLength) || DataLength > 0xFFFFFFFF) return false;
+
+        char ImagePath[MAX_IMAGE_PATH + 1];
+        if(!ReadAll(Connection, ImagePath, Request.ImagePathLength)) return false;
+        ImagePath[Request.ImagePathLength] = '\0';
+        char EntryName[12];
+        memcpy(EntryName, Request.EntryName, 11);
+        EntryName[11] = '\0';
+
+        // the data is taken off the socket before any lock is held so a slow client can't hold everyone else up
+        scim::byte *Data = NULL;
+        if(DataLength) {
+            Data = (scim::byte *)malloc(DataLength);
+            if(!Data) return false;
+            if(!ReadAll(Connection, Data, DataLength)) {
+                free(Data);
+                return false;
+            }
+        }
+
+        int Status = 0;
+        Image_t *Image = GetImage(ImagePath, &Status);
+        bool Continue;
+        if(!Image) Continue = SendStatus(Connection, Status);
+        // readers share the image lock so they mustn't load sub-directories, which keeps the server to names in the root directory
+        else if(Request.Operation != OP_LIST && strchr(EntryName, '/')) Continue = SendStatus(Connection, -8);
+        else switch(Request.Operation) {
+            case OP_LIST:
+                Continue = List(Connection, Image);
+                break;
+            case OP_READ:
+                Continue = Read(Connection, Image, EntryName);
+                break;
+            case OP_WRITE:
+                Continue = Write(Connection, Image, EntryName, Data, DataLength);
+                break;
+            case OP_DELETE:
+                Continue = Delete(Connection, Image, EntryName);
+                break;
+            default:
+                Continue = false;
+        }
+        free(Data);
+        return Continue;
+    }
+
+    /// @brief answer requests from one client until it disconnects. Each client gets its own thread running this
+    /// @param Connection socket connected to the client. Closed when the client is done
+    void HandleConnection(int Connection) {
+        while(HandleRequest(Connection));
+        close(Connection);
+    }
+
+    /// @brief listen on a Unix domain socket and answer requests until SCIM is killed
+    /// @param SocketPath path of the socket. Anything already there is replaced if it is a socket
+    /// @param PreloadImage disk image to open before any requests come in, or NULL
+    /// @return one of the SCIM error codes. Only returns if something goes wrong
+    int Run(const char *SocketPath, const char *PreloadImage) {
+        sockaddr_un Address = {};
+        Address.sun_family = AF_UNIX;
+        if(strlen(SocketPath) >= sizeof(Address.sun_path)) {
+            std::cerr << "SCIM: Error - The socket path is too long\n";
+            return -35;
+        }
+        strcpy(Address.sun_path, SocketPath);
+
+        if(PreloadImage) {
+            char ImagePath[PATH_MAX];
+            int Status = -5;
+            if(!realpath(PreloadImage, ImagePath) || !GetImage(ImagePath, &Status)) {
+                std::cerr << "SCIM: Error - Could not open disk image\n";
+                return Status;
+            }
+        }
+
+        // a client that goes away mid response would otherwise kill the whole server
+        signal(SIGPIPE, SIG_IGN);
+
+        struct stat SocketInfo;
+        if(!lstat(SocketPath, &SocketInfo) && S_ISSOCK(SocketInfo.st_mode)) unlink(SocketPath);
+        int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(Listener < 0 || bind(Listener, (sockaddr *)&Address, sizeof(Address)) < 0 || listen(Listener, LISTEN_BACKLOG) < 0) {
+            std::cerr << "SCIM: Error - Could not listen on the socket\n";
+            if(Listener >= 0) close(Listener);
+            return -35;
+        }
+
+        for(;;) {
+            int Client = accept(Listener, NULL, NULL);
+            if(Client < 0) {
+                if(errno == EINTR || errno == ECONNABORTED) continue;
+                std::cerr << "SCIM: Error - Could not accept a connection\n";
+                close(Listener);
+                return -35;
+            }
+            std::thread(HandleConnection, Client).detach();
+        }
+    }
+
+    /// @brief send one request to a SCIM server and print or save the response, which is how list, read, write, and delete work when
+    /// --socket is given
+    /// @param SocketPath path of the server's socket
+    /// @param Operation one of OPERATIONS
+    /// @param ImageFileName disk image to operate on. Sent to the server as an absolute path
+    /// @param EntryName name of the file entry in "NAME    EXT" format, or NULL for list
+    /// @param HostFileName host file to send for a write, otherwise NULL
+    /// @param OutputFileDescriptor where the response data from a list or read goes
+    /// @return 0 on success, or one of the SCIM error codes on failure. Errors from the server are passed on as they are
+    int Request(const char *SocketPath, unsigned int Operation, const char *ImageFileName, const char *EntryName, const char *HostFileName, int OutputFileDescriptor) {
+        char ImagePath[PATH_MAX];
+        if(!realpath(ImageFileName, ImagePath)) {
+            std::cerr << "SCIM: Error - Could not open disk image\n";
+            return -5;
+        }
+        sockaddr_un Address = {};
+        Address.sun_family = AF_UNIX;
+        if(strlen(SocketPath) >= sizeof(Address.sun_path)) {
+            std::cerr << "SCIM: Error - The socket path is too long\n";
+            return -35;
+        }
+        strcpy(Address.sun_path, SocketPath);
+
+        // the size of a write has to be known before the header goes out
+        int HostFileDescriptor = -1;
+        scim::qword DataLength = 0;
+        if(HostFileName) {
+            struct stat FileInfo;
+            HostFileDescriptor = open(HostFileName, O_RDONLY);
+            if(HostFileDescriptor < 0 || fstat(HostFileDescriptor, &FileInfo) < 0) {
+                std::cerr << "SCIM: Error - Could not open host file\n";
+                if(HostFileDescriptor >= 0) close(HostFileDescriptor);
+                return -13;
+            }
+            DataLength = FileInfo.st_size;
+        }
+
+        int Server = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(Server < 0 || connect(Server, (sockaddr *)&Address, sizeof(Address)) < 0) {
+            std::cerr << "SCIM: Error - Could not connect to the server\n";
+            if(Server >= 0) close(Server);
+            if(HostFileDescriptor >= 0) close(HostFileDescriptor);
+            return -35;
+        }
+
+        RequestHeader_t RequestHeader = {};
+        RequestHeader.Operation = Operation;
+        if(EntryName) memcpy(RequestHeader.EntryName, EntryName, scim::min(strlen(EntryName), 11));
+        RequestHeader.ImagePathLength = strlen(ImagePath);
+        RequestHeader.Length = RequestHeader.ImagePathLength + DataLength;
+        bool Sent = scim::WriteAll(Server, &RequestHeader, sizeof(RequestHeader)) && scim::WriteAll(Server, ImagePath, RequestHeader.ImagePathLength);
+        if(Sent && HostFileDescriptor >= 0)
+            Sent = Device::KernelCopy(HostFileDescriptor, 0, Server, Device::CURRENT_POSITION, DataLength) == DataLength;
+        if(HostFileDescriptor >= 0) close(HostFileDescriptor);
+
+        ResponseHeader_t Response;
+        if(!Sent || !ReadAll(Server, &Response, sizeof(Response))) {
+            std::cerr << "SCIM: Error - Lost the connection to the server\n";
+            close(Server);
+            return -36;
+        }
+        if(Response.Status) {
+            std::cerr << "SCIM: Error - The server could not carry out the request (" << Response.Status << ")\n";
+            close(Server);
+            return Response.Status;
+        }
+
+        // copy whatever came back to the output
+        scim::byte *Buffer = (scim::byte *)malloc(FAT::STREAM_BUFFER_SIZE);
+        scim::qword Remaining = Response.Length;
+        while(Buffer && Remaining) {
+            size_t TransferBytes = scim::min(FAT::STREAM_BUFFER_SIZE, Remaining);
+            if(!ReadAll(Server, Buffer, TransferBytes) || !scim::WriteAll(OutputFileDescriptor, Buffer, TransferBytes)) break;
+            Remaining -= TransferBytes;
+        }
+        free(Buffer);
+        close(Server);
+        if(Remaining) {
+            std::cerr << "SCIM: Error - Lost the connection to the server\n";
+            return -36;
+        }
+        return 0;
+    }
+
+}                           // contains the server and client for serve mode
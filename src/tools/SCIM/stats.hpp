@@ -0,0 +1,168 @@
+// stats.hpp
+//
+// I/O counters and phase timers for SCIM, used by --stats and --trace
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// everything in here is only compiled if SCIM_STATS is defined. Without it SCIM_COUNT and SCIM_TIME expand to nothing so the
+// instrumentation costs nothing at all. With it, each counter is a relaxed atomic add and each timer is two reads of the
+// monotonic clock, and both are skipped by a single branch unless --stats or --trace was used
+
+#pragma once
+
+#include "scim.hpp"
+
+#ifdef SCIM_STATS
+
+namespace Stats {
+
+    enum COUNTERS {
+        C_SECTORS_READ = 0,
+        C_SECTORS_WRITTEN,
+        C_SEEKS,                                        // fseeko and lseek calls
+        C_SYSCALLS,                                     // syscalls SCIM makes itself. stdio reads and writes are counted as one each
+        C_FAT_SCANS,                                    // full passes over the FAT or the free cluster bitmap
+        C_CLUSTERS_ALLOCATED,
+        C_BYTES_COPIED,                                 // file data moved between the host and the disk image
+        C_COUNT,                                        // number of counters
+    };
+
+    inline const char *CounterNames[C_COUNT] {
+        "sectors_read",
+        "sectors_written",
+        "seeks",
+        "syscalls",
+        "fat_scans",
+        "clusters_allocated",
+        "bytes_copied",
+    };
+
+    // phases can be nested, such as a chain walk inside a data copy, and each one includes the time spent in the phases inside it
+    enum PHASES {
+        P_MODE = 0,                                     // the whole mode, timed by scim.cpp
+        P_READ_BOOT_RECORD,
+        P_READ_LAYOUT,
+        P_READ_FAT,
+        P_READ_ROOT_DIRECTORY,
+        P_CHAIN_WALK,                                   // following cluster chains. Too frequent to trace so it only shows up in the summary
+        P_ALLOCATE,
+        P_DATA_COPY,
+        P_METADATA_WRITE,                               // root directory, FAT, and FSInfo writes
+        P_COUNT,                                        // number of phases
+    };
+
+    inline const char *PhaseNames[P_COUNT] {
+        "mode",
+        "ReadBootRecord",
+        "ReadLayout",
+        "ReadFAT",
+        "ReadRootDirectory",
+        "chain_walk",
+        "allocate",
+        "data_copy",
+        "metadata_write",
+    };
+
+    inline bool Enabled = false;                        // set by --stats or --trace before anything else happens
+    inline FILE *TraceOutput = NULL;                    // where --trace writes its JSON lines. NULL if tracing is off
+    inline std::atomic<scim::qword> Counters[C_COUNT];
+    inline std::atomic<scim::qword> PhaseNanoseconds[P_COUNT];
+    inline std::atomic<scim::qword> PhaseCalls[P_COUNT];
+    inline scim::qword StartTime = 0;                   // trace timestamps are measured from here
+
+    /// @return monotonic time in nanoseconds
+    inline scim::qword Now() {
+        timespec Time;
+        clock_gettime(CLOCK_MONOTONIC, &Time);
+        return (scim::qword)Time.tv_sec * 1000000000 + Time.tv_nsec;
+    }
+
+    /// @brief turn the counters and timers on
+    /// @param TraceFile where to write a JSON line for each phase, or NULL to only keep totals
+    inline void Enable(FILE *TraceFile) {
+        Enabled = true;
+        TraceOutput = TraceFile;
+        StartTime = Now();
+    }
+
+    /// @brief add to a counter
+    inline void Count(COUNTERS Counter, scim::qword Amount) {
+        if(Enabled) Counters[Counter].fetch_add(Amount, std::memory_order_relaxed);
+    }
+
+    /// @brief times everything from when it is created to when it goes out of scope and adds it to a phase. With --trace
+    /// it also writes a JSON line with how much each counter went up by during the phase
+    class Timer {
+
+        public:
+
+            /// @param Phase phase to add the time to
+            /// @param Detail extra information for the trace such as the mode name, or NULL
+            Timer(PHASES Phase, const char *Detail = NULL) : Phase(Phase), Detail(Detail) {
+                if(!Enabled) return;
+                if(TraceOutput && Phase != P_CHAIN_WALK)
+                    for(int i = 0; i < C_COUNT; i++) Before[i] = Counters[i].load(std::memory_order_relaxed);
+                Start = Now();
+            }
+
+            ~Timer() {
+                if(!Enabled) return;
+                scim::qword Elapsed = Now() - Start;
+                PhaseNanoseconds[Phase].fetch_add(Elapsed, std::memory_order_relaxed);
+                PhaseCalls[Phase].fetch_add(1, std::memory_order_relaxed);
+                if(!TraceOutput || Phase == P_CHAIN_WALK) return;
+
+                // the whole line is built first so lines from different threads don't get mixed together
+                char Line[512];
+                int Length = snprintf(Line, sizeof(Line), "{\"phase\":\"%s\",", PhaseNames[Phase]);
+                if(Detail) {
+                    Length += snprintf(Line + Length, sizeof(Line) - Length, "\"detail\":\"");
+                    // names can have any characters in them so anything JSON doesn't allow is dropped
+                    for(const char *Character = Detail; *Character && Length < 300; Character++)
+                        if((unsigned char)*Character >= 0x20 && *Character != '"' && *Character != '\\') Line[Length++] = *Character;
+                    Length += snprintf(Line + Length, sizeof(Line) - Length, "\",");
+                }
+                Length += snprintf(Line + Length, sizeof(Line) - Length, "\"start_ns\":%llu,\"duration_ns\":%llu", Start - StartTime, Elapsed);
+                for(int i = 0; i < C_COUNT; i++)
+                    Length += snprintf(Line + Length, sizeof(Line) - Length, ",\"%s\":%llu", CounterNames[i], Counters[i].load(std::memory_order_relaxed) - Before[i]);
+                fprintf(TraceOutput, "%s}\n", Line);
+            }
+
+        private:
+
+            PHASES Phase;
+            const char *Detail;
+            scim::qword Start = 0;
+            scim::qword Before[C_COUNT] = {};
+
+    };
+
+    /// @brief print the total for every counter and phase to stderr. Registered with atexit by --stats
+    inline void PrintSummary() {
+        fprintf(stderr, "SCIM: Stats\n");
+        fprintf(stderr, "  %-20s %10s %14s\n", "phase", "calls", "total ms");
+        for(int i = 0; i < P_COUNT; i++)
+            fprintf(stderr, "  %-20s %10llu %14.3f\n", PhaseNames[i], PhaseCalls[i].load(), PhaseNanoseconds[i].load() / 1e6);
+        fprintf(stderr, "  %-20s %10s\n", "counter", "value");
+        for(int i = 0; i < C_COUNT; i++)
+            fprintf(stderr, "  %-20s %10llu\n", CounterNames[i], Counters[i].load());
+    }
+
+}                           // contains the counters and timers behind --stats and --trace
+
+#define SCIM_COUNT(Counter, Amount) scim::Stats::Count(scim::Stats::Counter, Amount)
+#define SCIM_TIME(Phase) scim::Stats::Timer PhaseTimer(scim::Stats::Phase)
+#define SCIM_TIME_DETAIL(Phase, Detail) scim::Stats::Timer PhaseTimer(scim::Stats::Phase, Detail)
+
+#else
+
+#define SCIM_COUNT(Counter, Amount) do {} while(0)
+#define SCIM_TIME(Phase) do {} while(0)
+#define SCIM_TIME_DETAIL(Phase, Detail) do {} while(0)
+
+#endif
@@ -0,0 +1,319 @@
+// sync.hpp
+//
+// sync mode for SCIM, which makes the root directory of a disk image match a host directory or a manifest
+// This file was written as part of the Sawcon Image Manipulator
+// This version of the header was written for SCIM Alpha 1.4
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// manifest format
+// - one file per line. Blank lines and lines starting with # are ignored
+// - the 11 character entry name in "NAME    EXT" format comes first, followed by the host file that it should contain
+// - any file in the root directory that isn't listed is deleted
+//
+// SAWCON  BIN bin/stage2.bin
+// CONFIG  SYS bin/config.sys
+
+#pragma once
+
+#include "scim.hpp"
+
+namespace Sync {
+
+    typedef struct Target_t {
+        char EntryName[12];                             // "NAME    EXT" format with a null terminator on the end
+        char *HostPath;                                 // host file the entry should contain. malloced
+    } Target_t;
+
+    typedef struct Job_t {
+        const char *HostPath;                           // points into the target list
+        scim::dword FirstCluster;                       // first cluster of the chain the data goes into
+        scim::qword Size;                               // size of the host file in bytes when it was planned
+    } Job_t;
+
+    typedef struct Summary_t {
+        unsigned int Added;
+        unsigned int Changed;
+        unsigned int InPlace;                           // changed files that were written over their old chain
+        unsigned int Removed;
+        unsigned int Unchanged;
+    } Summary_t;
+
+    /// @brief add a file to the end of a target list
+    /// @param Targets target list, which is realloced as it grows
+    /// @param Count number of targets in the list
+    /// @param Capacity number of targets the list has space for
+    /// @param EntryName entry name in "NAME    EXT" format
+    /// @param HostPath host file the entry should contain. Copied into the list
+    /// @return true on success, false if there isn't enough memory
+    bool AddTarget(Target_t **Targets, size_t *Count, size_t *Capacity, const char *EntryName, const char *HostPath) {
+        if(*Count == *Capacity) {
+            *Capacity = *Capacity ? *Capacity * 2 : 64;
+            Target_t *Resized = (Target_t *)realloc(*Targets, *Capacity * sizeof(Target_t));
+            if(!Resized) return false;
+            *Targets = Resized;
+        }
+        memcpy((*Targets)[*Count].EntryName, EntryName, 12);
+        (*Targets)[*Count].HostPath = strdup(HostPath);
+        if(!(*Targets)[*Count].HostPath) return false;
+        (*Count)++;
+        return true;
+    }
+
+    /// @brief build the target list from every regular file in a host directory. Sub-directories are skipped
+    /// @param HostDirectory path of the host directory
+    /// @param Targets where the target list is stored
+    /// @param Count where the number of targets is stored
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int ReadDirectory(const char *HostDirectory, Target_t **Targets, size_t *Count) {
+        DIR *Directory = opendir(HostDirectory);
+        if(!Directory) {
+            std::cerr << "SCIM: Error - Could not open the host directory\n";
+            return -21;
+        }
+        size_t Capacity = 0;
+        int ReturnCode = 0;
+        for(dirent *DirectoryEntry = readdir(Directory); !ReturnCode && DirectoryEntry; DirectoryEntry = readdir(Directory)) {
+            if(DirectoryEntry->d_name[0] == '.' && (!DirectoryEntry->d_name[1] || !strcmp(DirectoryEntry->d_name, ".."))) continue;
+            char *HostPath = (char *)malloc(strlen(HostDirectory) + strlen(DirectoryEntry->d_name) + 2);
+            if(!HostPath) {
+                ReturnCode = -22;
+                break;
+            }
+            sprintf(HostPath, "%s/%s", HostDirectory, DirectoryEntry->d_name);
+
+            struct stat FileInfo;
+            char EntryName[12];
+            if(stat(HostPath, &FileInfo) < 0 || !S_ISREG(FileInfo.st_mode))
+                std::cerr << "SCIM: Warning - Skipping \"" << HostPath << "\" because it isn't a regular file\n";
+            else if(!FAT::HostName2FatName(DirectoryEntry->d_name, EntryName)) {
+                std::cerr << "SCIM: Error - \"" << DirectoryEntry->d_name << "\" can't be stored as an 8.3 file name\n";
+                ReturnCode = -23;
+            }
+            else if(!AddTarget(Targets, Count, &Capacity, EntryName, HostPath)) ReturnCode = -22;
+            free(HostPath);
+        }
+        closedir(Directory);
+        return ReturnCode;
+    }
+
+    /// @brief build the target list from a manifest
+    /// @param Manifest stream to read the manifest from
+    /// @param Targets where the target list is stored
+    /// @param Count where the number of targets is stored
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int ReadManifest(FILE *Manifest, Target_t **Targets, size_t *Count) {
+        size_t Capacity = 0;
+        char *Line = NULL;
+        size_t LineCapacity = 0;
+        int ReturnCode = 0;
+        for(unsigned int LineNumber = 1; !ReturnCode && getline(&Line, &LineCapacity, Manifest) >= 0; LineNumber++) {
+            Line[strcspn(Line, "\r\n")] = '\0';
+            char *Arguments = Line + strspn(Line, " \t");
+            if(*Arguments == '#' || *Arguments == '\0') continue;
+
+            // entry names can have spaces in them so the first 11 characters are taken as they are
+            char EntryName[12];
+            if(strlen(Arguments) < 12 || (Arguments[11] != ' ' && Arguments[11] != '\t')) {
+                std::cerr << "SCIM: Error - Invalid line " << LineNumber << " in the manifest\n";
+                ReturnCode = -33;
+                break;
+            }
+            memcpy(EntryName, Arguments, 11);
+            EntryName[11] = '\0';
+            Arguments += 11;
+            Arguments += strspn(Arguments, " \t");
+            if(!*Arguments) {
+                std::cerr << "SCIM: Error - Invalid line " << LineNumber << " in the manifest\n";
+                ReturnCode = -33;
+                break;
+            }
+            if(!AddTarget(Targets, Count, &Capacity, EntryName, Arguments)) ReturnCode = -22;
+        }
+        free(Line);
+        return ReturnCode;
+    }
+
+    /// @brief pick the modification time to store in a file entry. FAT only keeps times to the nearest 2 seconds, so a file that was
+    /// modified in the last 2 seconds could be modified again without its time changing. Those files get a time that is 2 seconds early
+    /// so the quick check fails next time and the contents are hashed instead
+    /// @param FileInfo stat of the host file
+    /// @return time to pass to FAT::Disk.SetModificationTime
+    time_t StoredTime(const struct stat *FileInfo) {
+        if(FileInfo->st_mtime + 2 >= time(NULL)) return FileInfo->st_mtime - 2;
+        return FileInfo->st_mtime;
+    }
+
+    /// @brief check whether the contents of a file entry match a host file by hashing both. Only called when the sizes already match
+    /// @param FileSystem disk the entry is on
+    /// @param Entry file entry to compare
+    /// @param HostPath host file to compare
+    /// @param SameOut set to true if the contents are the same
+    /// @return true on success, false if either file can't be read
+    bool SameContents(FAT::Disk *FileSystem, FAT::DirectoryEntry_t *Entry, const char *HostPath, bool *SameOut) {
+        scim::qword EntryHash;
+        if(!FileSystem->HashEntry(Entry, &EntryHash)) return false;
+
+        int HostFileDescriptor = open(HostPath, O_RDONLY);
+        if(HostFileDescriptor < 0) return false;
+        scim::Hash_t Hash;
+        scim::byte *Buffer = (scim::byte *)malloc(FAT::STREAM_BUFFER_SIZE);
+        ssize_t BytesRead = -1;
+        if(Buffer) {
+            while((BytesRead = read(HostFileDescriptor, Buffer, FAT::STREAM_BUFFER_SIZE)) != 0) {
+                SCIM_COUNT(C_SYSCALLS, 1);
+                if(BytesRead < 0 && errno == EINTR) continue;
+                if(BytesRead < 0) break;
+                Hash.Update(Buffer, BytesRead);
+            }
+        }
+        free(Buffer);
+        close(HostFileDescriptor);
+        if(BytesRead) return false;
+        *SameOut = Hash.Finish() == EntryHash;
+        return true;
+    }
+
+    /// @brief makes the root directory of a disk match a list of host files. Files that aren't in the list are deleted, and a file that
+    /// is in both is only rewritten if its contents changed. Matching sizes and modification times are trusted without reading anything,
+    /// otherwise files with matching sizes are compared by hash. Changed files are written over their old cluster chain when they still
+    /// fit in it. Everything is planned first, then the file data is copied, then the root directory and FAT are committed once, so an
+    /// image that is already up to date gets no data writes at all
+    /// @param FileSystem disk to sync. Must have been initialised
+    /// @param HostDirectory host directory to sync from, or NULL to use Manifest
+    /// @param Manifest stream to read the manifest from if HostDirectory is NULL
+    /// @return 0 on success, or one of the SCIM error codes on failure
+    int Run(FAT::Disk *FileSystem, const char *HostDirectory, FILE *Manifest) {
+        Target_t *Targets = NULL;
+        size_t TargetCount = 0;
+        int ReturnCode = HostDirectory ? ReadDirectory(HostDirectory, &Targets, &TargetCount) : ReadManifest(Manifest, &Targets, &TargetCount);
+        Job_t *Jobs = (Job_t *)calloc(TargetCount ? TargetCount : 1, sizeof(Job_t));
+        size_t JobCount = 0;
+        Summary_t Summary = {};
+        if(!ReturnCode && !Jobs) ReturnCode = -22;
+        if(!ReturnCode && !FileSystem->BeginTransaction()) ReturnCode = -18;
+
+        // remove anything that isn't a target first so its entry and clusters can't get in the way
+        // deleting never moves the root directory so the view stays valid for the whole loop
+        std::span<FAT::DirectoryEntry_t> RootEntries = FileSystem->RootEntries();
+        for(size_t i = 0; !ReturnCode && i < RootEntries.size(); i++) {
+            FAT::DirectoryEntry_t *Entry = &RootEntries[i];
+            if(Entry->Name[0] == FAT::N_END) break;
+            if(Entry->Name[0] == FAT::N_ENTRYFREE || (Entry->Attributes & (FAT::A_DIRECTORY | FAT::A_VOLUME_NAME))) continue;
+            bool Wanted = false;
+            for(size_t j = 0; !Wanted && j < TargetCount; j++)
+                Wanted = !memcmp(Entry->Name, Targets[j].EntryName, 11);
+            if(Wanted) continue;
+            char EntryName[12];
+            memcpy(EntryName, Entry->Name, 11);
+            EntryName[11] = '\0';
+            if(!FileSystem->DeleteEntry(Entry)) {
+                std::cerr << "SCIM: Error - Could not delete " << EntryName << "\n";
+                ReturnCode = -34;
+            }
+            Summary.Removed++;
+        }
+
+        // planning phase: decide what happens to each target and set up the entries and cluster chains
+        for(size_t i = 0; !ReturnCode && i < TargetCount; i++) {
+            struct stat FileInfo;
+            if(stat(Targets[i].HostPath, &FileInfo) < 0 || !S_ISREG(FileInfo.st_mode)) {
+                std::cerr << "SCIM: Error - Could not open host file \"" << Targets[i].HostPath << "\"\n";
+                ReturnCode = -13;
+                break;
+            }
+            tm *ModificationTime = localtime(&FileInfo.st_mtime);
+            if(!ModificationTime) {
+                ReturnCode = -34;
+                break;
+            }
+
+            FAT::DirectoryEntry_t *Entry = FileSystem->FindEntry(Targets[i].EntryName);
+            if(Entry && (Entry->Attributes & (FAT::A_DIRECTORY | FAT::A_VOLUME_NAME))) {
+                std::cerr << "SCIM: Error - " << Targets[i].EntryName << " is a directory or volume name on the disk image\n";
+                ReturnCode = -34;
+                break;
+            }
+
+            if(Entry && Entry->Size == (scim::qword)FileInfo.st_size) {
+                // the quick check: same size and the same time to the nearest 2 seconds means nothing is read at all
+                if(Entry->ModificationDate == FAT::localtime2FatDate(ModificationTime) && Entry->ModificationTime == FAT::localtime2FatTime(ModificationTime)) {
+                    Summary.Unchanged++;
+                    continue;
+                }
+                bool Same;
+                if(!SameContents(FileSystem, Entry, Targets[i].HostPath, &Same)) {
+                    std::cerr << "SCIM: Error - Could not compare " << Targets[i].EntryName << " with \"" << Targets[i].HostPath << "\"\n";
+                    ReturnCode = -34;
+                    break;
+                }
+                // only the time is out of date, and fixing it means the quick check works next time
+                if(Same) {
+                    if(!FileSystem->SetModificationTime(Entry, StoredTime(&FileInfo))) ReturnCode = -34;
+                    Summary.Unchanged++;
+                    continue;
+                }
+            }
+
+            if(Entry && FileSystem->ResizeEntry(Entry, FileInfo.st_size)) {
+                Summary.Changed++;
+                Summary.InPlace++;
+            }
+            else {
+                // it is either a new file or it doesn't fit where it was, so it gets a new chain
+                if(Entry) {
+                    if(!FileSystem->DeleteEntry(Entry)) {
+                        ReturnCode = -34;
+                        break;
+                    }
+                    Summary.Changed++;
+                }
+                else Summary.Added++;
+                Entry = FileSystem->AddEntry(Targets[i].EntryName, FAT::A_ARCHIVE, FileInfo.st_size);
+                if(!Entry) {
+                    std::cerr << "SCIM: Error - Could not create an entry for \"" << Targets[i].HostPath << "\"\n";
+                    ReturnCode = -12;
+                    break;
+                }
+            }
+            if(!FileSystem->SetModificationTime(Entry, StoredTime(&FileInfo))) {
+                ReturnCode = -34;
+                break;
+            }
+            Jobs[JobCount].HostPath = Targets[i].HostPath;
+            Jobs[JobCount].FirstCluster = FileSystem->FirstCluster(Entry);
+            Jobs[JobCount].Size = FileInfo.st_size;
+            JobCount++;
+        }
+
+        // data phase: only files that were added or changed get written. Chains that are being reused get their new data before the
+        // commit, so a failure from here on can leave a changed file with its new data but its old size
+        for(size_t i = 0; !ReturnCode && i < JobCount; i++) {
+            FILE *HostFileStream = fopen(Jobs[i].HostPath, "rb");
+            if(!HostFileStream || !FileSystem->WriteChain(Jobs[i].FirstCluster, HostFileStream, Jobs[i].Size)) {
+                std::cerr << "SCIM: Error - Could not copy \"" << Jobs[i].HostPath << "\" into the disk image\n";
+                ReturnCode = -24;
+            }
+            if(HostFileStream) fclose(HostFileStream);
+        }
+
+        if(!ReturnCode && !FileSystem->Commit()) {
+            std::cerr << "SCIM: Error - Could not commit the changes to the disk image\n";
+            ReturnCode = -18;
+        }
+
+        if(!ReturnCode)
+            printf("%u added, %u changed (%u in place), %u removed, %u unchanged\n",
+                   Summary.Added, Summary.Changed, Summary.InPlace, Summary.Removed, Summary.Unchanged);
+
+        for(size_t i = 0; i < TargetCount; i++)
+            free(Targets[i].HostPath);
+        free(Targets);
+        free(Jobs);
+        return ReturnCode;
+    }
+
+}                           // contains the planner for sync mode
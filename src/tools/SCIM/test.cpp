@@ -0,0 +1,152 @@
+// test.cpp
+//
+// regression tests for the Sawcon Image Manipulator. Builds disk images, damages them on purpose, and checks that SCIM copes
+// This file was written as part of the SawconOS Host Tools
+// This version of the code was written for SCIM Alpha 1.4
+// compiled using g++
+//
+// Written: Saturday 17th October 2026
+// Last Updated: Saturday 17th October 2026
+//
+// Written by Gabriel Jickells
+
+// usage: scim_test [-d working directory]
+// prints a line for each test and exits with 0 if every test passed, or with the number of tests that failed
+
+#include "scim.hpp"
+#include <string>
+
+namespace scim {
+namespace Test {
+
+    typedef struct Test_t {
+        const char *Name;
+        bool (*Run)(const char *WorkingDirectory);
+    } Test_t;
+
+    /// @brief print why a test failed
+    /// @param Reason what went wrong
+    /// @return false so a test can return the result of this straight away
+    bool Fail(const char *Reason) {
+        fprintf(stderr, "    %s\n", Reason);
+        return false;
+    }
+
+    /// @brief a chain whose last cluster points at ClusterCount, one past the end of the decoded FAT, has to be treated as broken
+    /// by everything that walks chains instead of being read past the end of ClusterTable
+    bool ChainPastEndOfTable(const char *WorkingDirectory) {
+        std::string ImageFileName = std::string(WorkingDirectory) + "/scim_test_chain.img";
+        const Format::Profile_t *Profile = Format::FindProfile("hdd64");
+        const Format::Layout_t *Layout = Format::FindLayout(Profile);
+        if(Format::Run(ImageFileName.c_str(), Profile->Name, NULL, NULL)) return Fail("could not format the image");
+
+        // the file takes the last two clusters and the FAT sends the chain on to the cluster after them, which doesn't exist
+        dword ClusterCount = Layout->DataClusters + FAT::FIRST_AVAILABLE_CLUSTER;
+        word Links[2] = { (word)(ClusterCount - 1), (word)ClusterCount };
+        FAT::DirectoryEntry_t Entry = {};
+        memcpy(Entry.Name, "BROKEN  BIN", 11);
+        Entry.Attributes = FAT::A_ARCHIVE;
+        Entry.FirstClusterLow = ClusterCount - 2;
+        Entry.Size = 2 * Profile->SectorsPerCluster * Profile->BytesPerSector;
+        Device::BlockDevice *Image = Device::Open(ImageFileName.c_str());
+        if(!Image) return Fail("could not open the image");
+        bool Damaged = true;
+        for(dword i = 0; i < Profile->TotalFATs; i++)
+            Damaged = Damaged && Image->Write(Layout->SectorOffset(Profile->ReservedSectors + i * Layout->FATSectors) + (ClusterCount - 2) * sizeof(word),
+                                              sizeof(Links), Links);
+        Damaged = Damaged && Image->Write(Layout->SectorOffset(Layout->RootDirectoryLBA), sizeof(Entry), &Entry);
+        delete Image;
+        if(!Damaged) return Fail("could not damage the image");
+
+        Image = Device::Open(ImageFileName.c_str());
+        FAT::Disk FileSystem;
+        bool Passed = false;
+        if(!Image || !FileSystem.Initialise(Image)) Fail("could not open the damaged image");
+        else {
+            FAT::Disk::ExtentIterator Chain(&FileSystem, ClusterCount - 2);
+            FAT::Extent_t Extent;
+            FAT::Fragmentation_t Fragmentation;
+            FAT::CheckReport_t Report = {};
+            if(!Chain.Next(&Extent) || Extent.FirstCluster != ClusterCount - 2 || Extent.Length != 2) Fail("the first extent should be the last two clusters");
+            else if(Chain.Next(&Extent) || !Chain.Error) Fail("the cluster past the end of the table should break the chain");
+            else if(FileSystem.MeasureFragmentation(&Fragmentation)) Fail("MeasureFragmentation should report the broken chain");
+            else if(FileSystem.Defragment(NULL)) Fail("Defragment should refuse to move a broken chain");
+            else if(!FileSystem.Check(&Report, false)) Fail("Check should finish on the damaged image");
+            else if(!Report.Counts[FAT::CP_BAD_REFERENCE]) Fail("Check should report the chain running off the end of the FAT");
+            else Passed = true;
+            free(Report.Problems);
+        }
+        FileSystem.Clean();
+        delete Image;
+        unlink(ImageFileName.c_str());
+        return Passed;
+    }
+
+    /// @brief every unit in a provision manifest that uses "auto" has to get its own serial number, and each one has to follow
+    /// the 0xZZYxxx5C scheme
+    bool AutoSerialsAreUnique(const char *WorkingDirectory) {
+        const unsigned int UNITS = 12;
+        std::string TemplateFileName = std::string(WorkingDirectory) + "/scim_test_template.img";
+        if(Format::Run(TemplateFileName.c_str(), "floppy", NULL, "Alpha_1.4")) return Fail("could not format the template");
+        std::string ManifestText;
+        for(unsigned int i = 0; i < UNITS; i++)
+            ManifestText += "image " + std::string(WorkingDirectory) + "/scim_test_unit" + std::to_string(i) + ".img auto\n";
+
+        Device::BlockDevice *Image = Device::Open(TemplateFileName.c_str());
+        FAT::Disk FileSystem;
+        FILE *Manifest = fmemopen((void *)ManifestText.data(), ManifestText.size(), "r");
+        int ReturnCode = -1;
+        if(Image && FileSystem.Initialise(Image) && Manifest) ReturnCode = Provision::Run(&FileSystem, TemplateFileName.c_str(), Manifest, "Alpha_1.4", 4);
+        if(Manifest) fclose(Manifest);
+        FileSystem.Clean();
+        delete Image;
+        unlink(TemplateFileName.c_str());
+
+        bool Passed = ReturnCode == 0;
+        if(!Passed) Fail("provision mode refused a manifest where every unit uses \"auto\"");
+        scim::dword Serials[UNITS] = {};
+        for(unsigned int i = 0; i < UNITS; i++) {
+            std::string UnitFileName = std::string(WorkingDirectory) + "/scim_test_unit" + std::to_string(i) + ".img";
+            Image = Passed ? Device::Open(UnitFileName.c_str()) : NULL;
+            if(Image && FileSystem.Initialise(Image)) memcpy(&Serials[i], FileSystem.FS_Info.EBPB.SerialID, sizeof(Serials[i]));
+            else if(Passed) Passed = Fail("could not open a provisioned unit");
+            FileSystem.Clean();
+            delete Image;
+            unlink(UnitFileName.c_str());
+        }
+        for(unsigned int i = 0; Passed && i < UNITS; i++) {
+            if(!Format::ValidSerialID(Serials[i])) Passed = Fail("a unit got a serial number that doesn't follow the scheme");
+            for(unsigned int j = 0; Passed && j < i; j++)
+                if(Serials[i] == Serials[j]) Passed = Fail("two units got the same serial number");
+        }
+        return Passed;
+    }
+
+    const Test_t Tests[] {
+        { "chain past the end of the FAT", ChainPastEndOfTable },
+        { "unique \"auto\" serial numbers", AutoSerialsAreUnique },
+        { NULL, NULL }
+    };
+
+}                           // contains the regression tests for scim_test
+}
+
+int main(int argc, char **argv) {
+
+    const char *WorkingDirectory = "/tmp";
+    for(int i = 1; i < argc; i++) {
+        if(i + 1 < argc && (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--directory"))) WorkingDirectory = argv[++i];
+        else {
+            std::cerr << "SCIM Test: Error - Invalid usage of switch \"" << argv[i] << "\"\n";
+            return -2;
+        }
+    }
+
+    int Failed = 0;
+    for(int i = 0; scim::Test::Tests[i].Name; i++) {
+        bool Passed = scim::Test::Tests[i].Run(WorkingDirectory);
+        printf("%s: %s\n", Passed ? "PASS" : "FAIL", scim::Test::Tests[i].Name);
+        if(!Passed) Failed++;
+    }
+    return Failed;
+}